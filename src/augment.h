@@ -0,0 +1,134 @@
+#ifndef __AUGMENT_H_
+#define __AUGMENT_H_
+
+#include <limits>
+#include <algorithm>
+#include <cstddef>
+
+//
+// Augments for Tree<..., Augment>: a monoid over the entries. Inner nodes keep the aggregate of every child
+// subtree next to its pointer, Tree::aggregate(lo, hi) then combines whole subtrees instead of visiting their
+// leaves. An augment is
+//
+//   typedef ... type;                                   // default constructible
+//   static type identity();                             // combine(identity(), a) == a
+//   static type of(const KeyType& key, const DataType* data);
+//   static type combine(const type& left, const type& right);  // associative, left holds the smaller keys
+//   static constexpr bool commutative;                  // combine(a, b) == combine(b, a)
+//
+// Writes recompute the aggregates on the path of the changed leaf, which reads every value of the leaf.
+// A commutative augment lets an insert without a split combine the new entry into the path instead.
+//
+// The aggregates see the value pointers, not what they point to: change a value through Tree::modify /
+// upsert / set, writing *data behind the tree's back leaves the aggregates stale.
+// data may be null (set(key, nullptr) is allowed), the augments below count such an entry as identity().
+//
+
+// The default, no aggregates and no extra memory in the nodes.
+struct NoAugment {
+	struct type {};
+
+	static constexpr bool commutative = true;
+
+	static type identity() {
+		return type();
+	}
+
+	template<typename KeyType, typename DataType>
+	static type of(const KeyType&, const DataType*) {
+		return type();
+	}
+
+	static type combine(const type&, const type&) {
+		return type();
+	}
+};
+
+template<typename T>
+struct SumOf {
+	typedef T type;
+
+	static constexpr bool commutative = true;
+
+	static type identity() {
+		return T();
+	}
+
+	template<typename KeyType>
+	static type of(const KeyType&, const T* data) {
+		return data ? *data : identity();
+	}
+
+	static type combine(const type& left, const type& right) {
+		return left + right;
+	}
+};
+
+template<typename T>
+struct MinOf {
+	typedef T type;
+
+	static constexpr bool commutative = true;
+
+	static type identity() {
+		return std::numeric_limits<T>::max();
+	}
+
+	template<typename KeyType>
+	static type of(const KeyType&, const T* data) {
+		return data ? *data : identity();
+	}
+
+	static type combine(const type& left, const type& right) {
+		return std::min(left, right);
+	}
+};
+
+template<typename T>
+struct MaxOf {
+	typedef T type;
+
+	static constexpr bool commutative = true;
+
+	static type identity() {
+		return std::numeric_limits<T>::lowest();
+	}
+
+	template<typename KeyType>
+	static type of(const KeyType&, const T* data) {
+		return data ? *data : identity();
+	}
+
+	static type combine(const type& left, const type& right) {
+		return std::max(left, right);
+	}
+};
+
+// Count, sum, min and max in 1 aggregate, what a dashboard row needs from 1 query.
+template<typename T>
+struct StatsOf {
+	struct type {
+		size_t count = 0;
+		T sum = T();
+		T min = std::numeric_limits<T>::max();
+		T max = std::numeric_limits<T>::lowest();
+	};
+
+	static constexpr bool commutative = true;
+
+	static type identity() {
+		return type();
+	}
+
+	template<typename KeyType>
+	static type of(const KeyType&, const T* data) {
+		return data ? type{ 1, *data, *data, *data } : identity();
+	}
+
+	static type combine(const type& left, const type& right) {
+		return type{ left.count + right.count, left.sum + right.sum, std::min(left.min, right.min),
+			std::max(left.max, right.max) };
+	}
+};
+
+#endif // __AUGMENT_H_
@@ -0,0 +1,238 @@
+#ifndef __BASELINES_H_
+#define __BASELINES_H_
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#ifdef USE_LEDA
+#include <LEDA/core/impl/ab_tree.h>
+#include <LEDA/core/dictionary.h>
+#endif
+
+//
+// Dictionaries our tree gets compared against. They all map int -> int* and share the same interface
+// so every benchmark phase is written once as a template:
+//
+//	static const char* Name();
+//	static constexpr bool Ordered;			// forEach / scan visit keys in ascending order
+//	void insert(int key, int* value);		// insert or overwrite
+//	bool lookup(int key, int*& outValue);
+//	void erase(int key);
+//	template<typename F> void forEach(F f);	// f(key) for every element
+//	template<typename F> void scan(int key, int count, F f);	// f(key) for up to count elements starting at an existing key
+//	size_t size() const;
+//
+
+struct MapBaseline {
+	static const char* Name() {
+		return "std::map";
+	}
+	static constexpr bool Ordered = true;
+
+	std::map<int, int*> dic;
+
+	void insert(int key, int* value) {
+		dic[key] = value;
+	}
+
+	bool lookup(int key, int*& outValue) {
+		auto it = dic.find(key);
+		if (it == dic.end()) {
+			return false;
+		}
+		outValue = it->second;
+		return true;
+	}
+
+	void erase(int key) {
+		dic.erase(key);
+	}
+
+	template<typename F>
+	void forEach(F f) {
+		for (const auto& elem : dic) {
+			f(elem.first);
+		}
+	}
+
+	template<typename F>
+	void scan(int key, int count, F f) {
+		auto it = dic.find(key);
+		for (int n = 0; it != dic.end() && n < count; ++n, ++it) {
+			f(it->first);
+		}
+	}
+
+	size_t size() const {
+		return dic.size();
+	}
+};
+
+// Not ordered: scans visit elements in bucket order, so scan checksums do not match the tree.
+struct UnorderedMapBaseline {
+	static const char* Name() {
+		return "std::unordered_map";
+	}
+	static constexpr bool Ordered = false;
+
+	std::unordered_map<int, int*> dic;
+
+	void insert(int key, int* value) {
+		dic[key] = value;
+	}
+
+	bool lookup(int key, int*& outValue) {
+		auto it = dic.find(key);
+		if (it == dic.end()) {
+			return false;
+		}
+		outValue = it->second;
+		return true;
+	}
+
+	void erase(int key) {
+		dic.erase(key);
+	}
+
+	template<typename F>
+	void forEach(F f) {
+		for (const auto& elem : dic) {
+			f(elem.first);
+		}
+	}
+
+	template<typename F>
+	void scan(int key, int count, F f) {
+		auto it = dic.find(key);
+		for (int n = 0; it != dic.end() && n < count; ++n, ++it) {
+			f(it->first);
+		}
+	}
+
+	size_t size() const {
+		return dic.size();
+	}
+};
+
+// Flat map: binary search for lookups, O(n) element moves for every insert / erase in the middle.
+// Only usable for small sizes or append heavy phases.
+struct SortedVectorBaseline {
+	static const char* Name() {
+		return "sorted std::vector";
+	}
+	static constexpr bool Ordered = true;
+
+	typedef std::pair<int, int*> Elem;
+	std::vector<Elem> dic;
+
+	std::vector<Elem>::iterator lowerBound(int key) {
+		return std::lower_bound(dic.begin(), dic.end(), key,
+			[](const Elem& elem, int k) { return elem.first < k; });
+	}
+
+	void insert(int key, int* value) {
+		if (dic.empty() || dic.back().first < key) {
+			dic.emplace_back(key, value);
+			return;
+		}
+		auto it = lowerBound(key);
+		if (it != dic.end() && it->first == key) {
+			it->second = value;
+			return;
+		}
+		dic.insert(it, Elem(key, value));
+	}
+
+	bool lookup(int key, int*& outValue) {
+		auto it = lowerBound(key);
+		if (it == dic.end() || it->first != key) {
+			return false;
+		}
+		outValue = it->second;
+		return true;
+	}
+
+	void erase(int key) {
+		auto it = lowerBound(key);
+		if (it != dic.end() && it->first == key) {
+			dic.erase(it);
+		}
+	}
+
+	template<typename F>
+	void forEach(F f) {
+		for (const Elem& elem : dic) {
+			f(elem.first);
+		}
+	}
+
+	template<typename F>
+	void scan(int key, int count, F f) {
+		auto it = lowerBound(key);
+		for (int n = 0; it != dic.end() && n < count; ++n, ++it) {
+			f(it->first);
+		}
+	}
+
+	size_t size() const {
+		return dic.size();
+	}
+};
+
+#ifdef USE_LEDA
+template<int NodeSize>
+struct LedaBaseline {
+	static const char* Name() {
+		return "LEDA";
+	}
+	static constexpr bool Ordered = true;
+
+	leda::dictionary<int, int*, leda::ab_tree> dic;
+
+	LedaBaseline()
+		: dic(NodeSize / 2, NodeSize) {}
+
+	void insert(int key, int* value) {
+		dic.insert(key, value);
+	}
+
+	bool lookup(int key, int*& outValue) {
+		leda::dic_item r = dic.lookup(key);
+		if (!r) {
+			return false;
+		}
+		outValue = dic.inf(r);
+		return true;
+	}
+
+	void erase(int key) {
+		dic.undefine(key);
+	}
+
+	template<typename F>
+	void forEach(F f) {
+		int n;
+		forall_defined(n, dic) {
+			f(n);
+		}
+	}
+
+	template<typename F>
+	void scan(int key, int count, F f) {
+		leda::dic_item r = dic.lookup(key);
+		for (int n = 0; r && n < count; ++n) {
+			f(dic.key(r));
+			r = dic.next_item(r);
+		}
+	}
+
+	size_t size() const {
+		return dic.size();
+	}
+};
+#endif
+
+#endif //__BASELINES_H_
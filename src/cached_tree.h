@@ -0,0 +1,151 @@
+#ifndef __CACHED_TREE_H_
+#define __CACHED_TREE_H_
+
+#include "tree.h"
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+//
+// Tree with a direct mapped hash cache of recent lookups in front of it, for skewed reads where a few keys
+// take most of the gets. A cached get is 1 hash and 1 slot compare instead of a descent.
+//
+// The cache maps a key to its value (or to "missing"), never to a leaf position, so splits, merges,
+// redistribution and compaction inside the tree can not make an entry stale. Only changing the value of a key
+// can, and every set / maybe_add / remove of a key goes through here and rewrites or drops its slot.
+// Writing the tree directly (tree()) bypasses the cache, call clearCache() after.
+//
+
+template<typename KeyType, typename DataType, uint N = 10, typename Hash = std::hash<KeyType>>
+struct CachedTree {
+	typedef Tree<KeyType, DataType, N> TTree;
+
+	// slots is rounded up to a power of 2.
+	explicit CachedTree(size_t slots = 4096, uint capacity = N != DynamicSize ? N : 10)
+		: impl(capacity) {
+		size_t size = 1;
+		while (size < slots) {
+			size *= 2;
+		}
+		cache.resize(size);
+		mask = size - 1;
+	}
+
+	bool set(const KeyType& key, DataType* data) {
+		const bool inserted = impl.set(key, data);
+		store(key, data, true);
+		return inserted;
+	}
+
+	bool maybe_add(const KeyType& key, DataType* data) {
+		const bool inserted = impl.maybe_add(key, data);
+		if (inserted) {
+			store(key, data, true);
+		}
+		return inserted;
+	}
+
+	bool get(const KeyType& key, DataType*& outData) {
+		Slot& slot = slotOf(key);
+		if (slot.used && slot.key == key) {
+			hitCount++;
+			outData = slot.data;
+			return slot.exists;
+		}
+		missCount++;
+		DataType* data = nullptr;
+		const bool exists = impl.get(key, data);
+		fill(slot, key, data, exists);
+		outData = data;
+		return exists;
+	}
+
+	bool remove(const KeyType& key) {
+		DataType* popped;
+		return removePop(key, popped);
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped) {
+		const bool removed = impl.removePop(key, popped);
+		store(key, nullptr, false);
+		return removed;
+	}
+
+	uint size() const {
+		return impl.size();
+	}
+
+	const TTree& tree() const {
+		return impl;
+	}
+
+	TTree& tree() {
+		return impl;
+	}
+
+	void clearCache() {
+		for (Slot& slot : cache) {
+			slot.used = false;
+		}
+	}
+
+	size_t cacheSlots() const {
+		return cache.size();
+	}
+
+	// gets answered by the cache and gets that went to the tree
+	uint64_t hits() const {
+		return hitCount;
+	}
+
+	uint64_t misses() const {
+		return missCount;
+	}
+
+	double hitRate() const {
+		return hitCount + missCount ? double(hitCount) / (hitCount + missCount) : 0.0;
+	}
+
+	void resetCounters() {
+		hitCount = 0;
+		missCount = 0;
+	}
+
+private:
+	struct Slot {
+		KeyType key;
+		DataType* data = nullptr;
+		bool used = false;
+		// negative entries answer gets of missing keys
+		bool exists = false;
+	};
+
+	TTree impl;
+	std::vector<Slot> cache;
+	size_t mask;
+	uint64_t hitCount = 0;
+	uint64_t missCount = 0;
+
+	Slot& slotOf(const KeyType& key) {
+		// spread the bits first, std::hash of integers is the identity
+		const uint64_t hash = uint64_t(Hash()(key)) * 0x9E3779B97F4A7C15ull;
+		return cache[(hash >> 32) & mask];
+	}
+
+	void fill(Slot& slot, const KeyType& key, DataType* data, bool exists) {
+		slot.key = key;
+		slot.data = data;
+		slot.used = true;
+		slot.exists = exists;
+	}
+
+	// After a write: refresh the slot if it caches key, a write does not evict another key.
+	void store(const KeyType& key, DataType* data, bool exists) {
+		Slot& slot = slotOf(key);
+		if (slot.used && slot.key == key) {
+			fill(slot, key, data, exists);
+		}
+	}
+};
+
+#endif // __CACHED_TREE_H_
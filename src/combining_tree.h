@@ -0,0 +1,185 @@
+#ifndef __COMBINING_TREE_H_
+#define __COMBINING_TREE_H_
+
+#include "tree.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+//
+// Flat combining front end for a Tree shared by many writers.
+// A thread publishes its operation in a free slot and then either waits for the result or, if it gets the lock,
+// becomes the combiner: it collects every pending slot, sorts the operations by key and applies them as one
+// batch with finger search (each operation starts from the position of the previous one), then hands every
+// result back through its slot. One lock hand off serves the whole batch and the tree is walked left to right.
+//
+// Slots are a shared pool, not 1 per thread: any thread can use any tree without registering first. A thread starts
+// looking for a free slot at the hash of its id, so with fewer threads than slots each one mostly gets the same slot.
+//
+// Operations of a thread are applied in its program order (it has at most 1 pending), operations of different
+// threads on the same key are concurrent and get applied in slot order.
+//
+
+template<typename KeyType, typename DataType, uint N = 10>
+struct CombiningTree {
+	typedef Tree<KeyType, DataType, N> TTree;
+
+	// Max operations in flight. A thread that finds no free slot retries.
+	static constexpr int SlotCount = 128;
+
+	CombiningTree() {}
+
+	CombiningTree(const CombiningTree&) = delete;
+	CombiningTree& operator=(const CombiningTree&) = delete;
+
+	bool set(const KeyType& key, DataType* data) {
+		return submit(OpType::Set, key, data).result;
+	}
+
+	bool get(const KeyType& key, DataType*& outData) {
+		typename Slot::Result result = submit(OpType::Get, key, nullptr);
+		outData = result.data;
+		return result.result;
+	}
+
+	bool remove(const KeyType& key) {
+		return submit(OpType::Remove, key, nullptr).result;
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped) {
+		typename Slot::Result result = submit(OpType::Remove, key, nullptr);
+		popped = result.data;
+		return result.result;
+	}
+
+	// Only the tree, without going through the slots. The caller has to make sure no operation runs.
+	TTree& unsafeTree() {
+		return tree;
+	}
+
+	// Operations applied and batches run, for reporting the average batch size.
+	uint64_t combinedOps() const {
+		return opsCombined;
+	}
+
+	uint64_t batches() const {
+		return batchCount;
+	}
+
+private:
+	enum class OpType {
+		Set,
+		Get,
+		Remove
+	};
+
+	enum SlotState : int {
+		Free = 0,
+		Claimed,
+		Pending,
+		Done
+	};
+
+	struct alignas(64) Slot {
+		struct Result {
+			bool result;
+			DataType* data;
+		};
+
+		std::atomic<int> state{ Free };
+		OpType op;
+		KeyType key;
+		DataType* data;
+		Result out;
+	};
+
+	TTree tree;
+	std::mutex lock;
+	Slot slots[SlotCount];
+	// only written by the combiner
+	uint64_t opsCombined = 0;
+	uint64_t batchCount = 0;
+	std::vector<Slot*> batch;
+
+	Slot* claimSlot() {
+		const size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % SlotCount;
+		for (int attempt = 0;; ++attempt) {
+			for (size_t i = 0; i < SlotCount; ++i) {
+				Slot& slot = slots[(start + i) % SlotCount];
+				int expected = Free;
+				if (slot.state.load(std::memory_order_relaxed) == Free
+					&& slot.state.compare_exchange_strong(expected, Claimed, std::memory_order_acquire)) {
+					return &slot;
+				}
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	typename Slot::Result submit(OpType op, const KeyType& key, DataType* data) {
+		Slot* slot = claimSlot();
+		slot->op = op;
+		slot->key = key;
+		slot->data = data;
+		slot->state.store(Pending, std::memory_order_release);
+
+		for (int spins = 0; slot->state.load(std::memory_order_acquire) != Done; ++spins) {
+			if (lock.try_lock()) {
+				combine();
+				lock.unlock();
+				continue;
+			}
+			if (spins > 32) {
+				std::this_thread::yield();
+			}
+		}
+
+		typename Slot::Result result = slot->out;
+		slot->state.store(Free, std::memory_order_release);
+		return result;
+	}
+
+	// Holds the lock.
+	void combine() {
+		batch.clear();
+		for (Slot& slot : slots) {
+			if (slot.state.load(std::memory_order_acquire) == Pending) {
+				batch.push_back(&slot);
+			}
+		}
+		if (batch.empty()) {
+			return;
+		}
+		std::stable_sort(batch.begin(), batch.end(), [](const Slot* a, const Slot* b) { return a->key < b->key; });
+
+		typename TTree::Iterator hint = tree.find(batch.front()->key);
+		for (Slot* slot : batch) {
+			switch (slot->op) {
+			case OpType::Set:
+				slot->out.result = tree.set(slot->key, slot->data, hint);
+				slot->out.data = nullptr;
+				break;
+			case OpType::Get:
+				hint = tree.find(slot->key, hint);
+				slot->out.result = hint.exists;
+				slot->out.data = hint.exists ? hint.value() : nullptr;
+				break;
+			case OpType::Remove:
+				slot->out.data = nullptr;
+				slot->out.result = tree.removePop(slot->key, slot->out.data, hint);
+				break;
+			}
+		}
+		opsCombined += batch.size();
+		batchCount++;
+
+		for (Slot* slot : batch) {
+			slot->state.store(Done, std::memory_order_release);
+		}
+	}
+};
+
+#endif // __COMBINING_TREE_H_
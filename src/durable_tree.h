@@ -0,0 +1,475 @@
+#ifndef __DURABLE_TREE_H_
+#define __DURABLE_TREE_H_
+
+#include "tree.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+//
+// Tree with a write ahead log and checkpoints in a directory, so it can be rebuilt after a crash without going
+// back to where the data came from.
+//
+// Every set / maybe_add / remove that changes the tree appends a fixed size record (type, key, value, checksum)
+// to a buffer. Group commit: the buffer goes to the log with 1 write and 1 fdatasync every syncInterval records
+// instead of 1 per operation. A checkpoint writes the whole tree to a new file, renames it over the old one and
+// empties the log. open() loads the checkpoint and replays the log up to the first torn or damaged record.
+// Replaying records the checkpoint already contains gives the same tree, so a crash between the rename and
+// emptying the log is harmless.
+//
+// The log holds the values, not the pointers: keys and values must be trivially copyable. After recovery the
+// values point into storage owned by the DurableTree, which keeps them until it is destroyed.
+// A failed write or sync is kept in lastError(). From then on the tree takes no more writes: set / maybe_add /
+// remove change nothing and return false, until open() succeeds again. The operation whose record failed stays
+// applied in memory, it is the one that may not survive a crash.
+//
+
+struct DurabilityOptions {
+	// Records per fdatasync. 1 makes every operation durable before it returns, larger values can lose the last
+	// syncInterval - 1 operations in a crash, 0 only syncs in sync() and checkpoint().
+	uint syncInterval = 64;
+	// Logged operations between automatic checkpoints, 0 for none.
+	uint64_t checkpointInterval = 0;
+	// Records are written when this many bytes are buffered, even if it is not time to sync.
+	size_t bufferBytes = 64 * 1024;
+	// Syncs the directory after a checkpoint is renamed into it, fsync if null. Replaceable to inject failures.
+	int (*syncDirectory)(int fd) = nullptr;
+};
+
+template<typename KeyType, typename DataType, uint N = 10>
+struct DurableTree {
+	static_assert(std::is_trivially_copyable<KeyType>::value, "DurableTree logs keys as bytes");
+	static_assert(std::is_trivially_copyable<DataType>::value, "DurableTree logs values as bytes");
+
+	typedef Tree<KeyType, DataType, N> TTree;
+
+	explicit DurableTree(DurabilityOptions options = DurabilityOptions(), uint capacity = N != DynamicSize ? N : 10)
+		: impl(capacity)
+		, options(options) {}
+
+	~DurableTree() {
+		close();
+	}
+
+	DurableTree(const DurableTree&) = delete;
+	DurableTree& operator=(const DurableTree&) = delete;
+
+	// Creates the directory if needed, recovers its checkpoint and log and starts logging. What the tree held
+	// before is dropped, it holds the state of the directory only.
+	// Returns false with lastError() set if the files can not be read or opened.
+	bool open(const std::string& path) {
+		close();
+		impl.clear();
+		storage.clear();
+		buffer.clear();
+		unsynced = 0;
+		sinceCheckpoint = 0;
+		directory = path;
+		error.clear();
+		recovered = 0;
+#if defined(__unix__) || defined(__APPLE__)
+		if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+			return fail("mkdir " + directory);
+		}
+		std::vector<char> bytes;
+		if (!readFile(checkpointPath(), bytes)) {
+			return false;
+		}
+		if (!bytes.empty() && !loadCheckpoint(bytes)) {
+			return false;
+		}
+		if (!readFile(logPath(), bytes)) {
+			return false;
+		}
+		const size_t valid = replay(bytes);
+		logFd = ::open(logPath().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (logFd < 0) {
+			return fail("open " + logPath());
+		}
+		// drop a torn tail, new records must follow the last good one
+		if (valid < bytes.size() && ftruncate(logFd, off_t(valid)) != 0) {
+			return fail("truncate " + logPath());
+		}
+		return true;
+#else
+		error = "DurableTree needs POSIX file I/O";
+		return false;
+#endif
+	}
+
+	// Syncs what is buffered and closes the log, the tree stays.
+	void close() {
+#if defined(__unix__) || defined(__APPLE__)
+		if (logFd >= 0) {
+			sync();
+			::close(logFd);
+			logFd = -1;
+		}
+#endif
+	}
+
+	bool set(const KeyType& key, DataType* data) {
+		if (!error.empty()) {
+			return false;
+		}
+		const bool inserted = impl.set(key, data);
+		log(RecordType::Set, key, data);
+		return inserted;
+	}
+
+	bool maybe_add(const KeyType& key, DataType* data) {
+		if (!error.empty()) {
+			return false;
+		}
+		const bool inserted = impl.maybe_add(key, data);
+		if (inserted) {
+			log(RecordType::Set, key, data);
+		}
+		return inserted;
+	}
+
+	bool get(const KeyType& key, DataType*& outData) const {
+		return impl.get(key, outData);
+	}
+
+	bool remove(const KeyType& key) {
+		DataType* popped;
+		return removePop(key, popped);
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped) {
+		if (!error.empty()) {
+			return false;
+		}
+		const bool removed = impl.removePop(key, popped);
+		if (removed) {
+			log(RecordType::Remove, key, nullptr);
+		}
+		return removed;
+	}
+
+	// Writes and fdatasyncs the buffered records, every operation before is durable after it returns true.
+	bool sync() {
+		return flush(true);
+	}
+
+	// Writes the tree to a new checkpoint and empties the log.
+	bool checkpoint() {
+#if defined(__unix__) || defined(__APPLE__)
+		if (logFd < 0 || !flush(false)) {
+			return false;
+		}
+		std::vector<char> bytes(sizeof(CheckpointMagic) + sizeof(uint64_t));
+		const uint64_t count = impl.size();
+		std::memcpy(bytes.data(), &CheckpointMagic, sizeof(CheckpointMagic));
+		std::memcpy(bytes.data() + sizeof(CheckpointMagic), &count, sizeof(count));
+		bytes.reserve(bytes.size() + count * EntryBytes + sizeof(uint32_t));
+		for (auto it = impl.first(); it.isValid(); it.next()) {
+			appendEntry(bytes, it.key(), it.value());
+		}
+		const uint32_t sum = checksum(bytes.data(), bytes.size());
+		bytes.insert(bytes.end(), reinterpret_cast<const char*>(&sum), reinterpret_cast<const char*>(&sum) + sizeof(sum));
+
+		const std::string temporary = checkpointPath() + ".tmp";
+		const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			return fail("open " + temporary);
+		}
+		if (!writeAll(fd, bytes.data(), bytes.size()) || fdatasync(fd) != 0) {
+			fail("write " + temporary);
+			::close(fd);
+			return false;
+		}
+		::close(fd);
+		if (rename(temporary.c_str(), checkpointPath().c_str()) != 0) {
+			return fail("rename " + temporary);
+		}
+		// the rename is only durable once the directory is synced, until then the log must keep its records
+		const int dirFd = ::open(directory.c_str(), O_RDONLY);
+		if (dirFd < 0) {
+			return fail("fsync " + directory);
+		}
+		const int synced = (options.syncDirectory ? options.syncDirectory : fsync)(dirFd);
+		const int syncErrno = errno;
+		::close(dirFd);
+		if (synced != 0) {
+			errno = syncErrno;
+			return fail("fsync " + directory);
+		}
+		if (ftruncate(logFd, 0) != 0) {
+			return fail("truncate " + logPath());
+		}
+		sinceCheckpoint = 0;
+		checkpoints++;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	uint size() const {
+		return impl.size();
+	}
+
+	// Reads only, writing it directly is not logged.
+	const TTree& tree() const {
+		return impl;
+	}
+
+	// Records replayed from the log by the last open().
+	uint64_t recoveredRecords() const {
+		return recovered;
+	}
+
+	uint64_t syncCount() const {
+		return syncs;
+	}
+
+	uint64_t checkpointCount() const {
+		return checkpoints;
+	}
+
+	const std::string& lastError() const {
+		return error;
+	}
+
+private:
+	enum class RecordType : uint8_t {
+		Set = 1,
+		SetNull,
+		Remove
+	};
+
+	static constexpr uint64_t CheckpointMagic = 0x31504b4345455254ull; // "TREECKP1"
+	// key, has value, value
+	static constexpr size_t EntryBytes = sizeof(KeyType) + 1 + sizeof(DataType);
+	// type, key, value (zero for removes), checksum of the bytes before it
+	static constexpr size_t RecordBytes = 1 + sizeof(KeyType) + sizeof(DataType) + sizeof(uint32_t);
+
+	TTree impl;
+	DurabilityOptions options;
+	std::string directory;
+	int logFd = -1;
+	std::vector<char> buffer;
+	uint unsynced = 0;
+	uint64_t sinceCheckpoint = 0;
+	uint64_t recovered = 0;
+	uint64_t syncs = 0;
+	uint64_t checkpoints = 0;
+	std::string error;
+	// values of recovered elements
+	std::deque<DataType> storage;
+
+	std::string logPath() const {
+		return directory + "/wal.log";
+	}
+
+	std::string checkpointPath() const {
+		return directory + "/checkpoint";
+	}
+
+	bool fail(const std::string& what) {
+		error = what + ": " + std::strerror(errno);
+		return false;
+	}
+
+	// FNV-1a
+	static uint32_t checksum(const char* bytes, size_t size) {
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ uint8_t(bytes[i])) * 16777619u;
+		}
+		return hash;
+	}
+
+	void log(RecordType type, const KeyType& key, const DataType* data) {
+		if (logFd < 0 || !error.empty()) {
+			return;
+		}
+		if (type == RecordType::Set && !data) {
+			type = RecordType::SetNull;
+		}
+		const size_t at = buffer.size();
+		buffer.resize(at + RecordBytes);
+		char* out = buffer.data() + at;
+		out[0] = char(type);
+		std::memcpy(out + 1, &key, sizeof(KeyType));
+		if (type == RecordType::Set) {
+			std::memcpy(out + 1 + sizeof(KeyType), data, sizeof(DataType));
+		}
+		else {
+			std::memset(out + 1 + sizeof(KeyType), 0, sizeof(DataType));
+		}
+		const uint32_t sum = checksum(out, RecordBytes - sizeof(uint32_t));
+		std::memcpy(out + RecordBytes - sizeof(uint32_t), &sum, sizeof(sum));
+
+		unsynced++;
+		sinceCheckpoint++;
+		if (options.syncInterval && unsynced >= options.syncInterval) {
+			flush(true);
+		}
+		else if (buffer.size() >= options.bufferBytes) {
+			flush(false);
+		}
+		if (options.checkpointInterval && sinceCheckpoint >= options.checkpointInterval) {
+			checkpoint();
+		}
+	}
+
+	bool flush(bool durable) {
+#if defined(__unix__) || defined(__APPLE__)
+		if (logFd < 0 || !error.empty()) {
+			return false;
+		}
+		if (!buffer.empty() && !writeAll(logFd, buffer.data(), buffer.size())) {
+			return fail("write " + logPath());
+		}
+		buffer.clear();
+		if (durable && unsynced > 0) {
+			if (fdatasync(logFd) != 0) {
+				return fail("fdatasync " + logPath());
+			}
+			syncs++;
+			unsynced = 0;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void appendEntry(std::vector<char>& bytes, const KeyType& key, const DataType* data) {
+		const size_t at = bytes.size();
+		bytes.resize(at + EntryBytes);
+		char* out = bytes.data() + at;
+		std::memcpy(out, &key, sizeof(KeyType));
+		out[sizeof(KeyType)] = data != nullptr;
+		if (data) {
+			std::memcpy(out + sizeof(KeyType) + 1, data, sizeof(DataType));
+		}
+		else {
+			std::memset(out + sizeof(KeyType) + 1, 0, sizeof(DataType));
+		}
+	}
+
+	// A value read from disk, kept alive by the tree.
+	DataType* store(const char* bytes) {
+		storage.emplace_back();
+		std::memcpy(&storage.back(), bytes, sizeof(DataType));
+		return &storage.back();
+	}
+
+	KeyType readKey(const char* bytes) const {
+		KeyType key;
+		std::memcpy(&key, bytes, sizeof(KeyType));
+		return key;
+	}
+
+	bool loadCheckpoint(const std::vector<char>& bytes) {
+		const size_t header = sizeof(CheckpointMagic) + sizeof(uint64_t);
+		uint64_t magic = 0;
+		uint64_t count = 0;
+		if (bytes.size() >= header) {
+			std::memcpy(&magic, bytes.data(), sizeof(magic));
+			std::memcpy(&count, bytes.data() + sizeof(magic), sizeof(count));
+		}
+		uint32_t sum = 0;
+		if (magic != CheckpointMagic || bytes.size() != header + count * EntryBytes + sizeof(uint32_t)) {
+			error = "malformed checkpoint " + checkpointPath();
+			return false;
+		}
+		std::memcpy(&sum, bytes.data() + bytes.size() - sizeof(sum), sizeof(sum));
+		if (sum != checksum(bytes.data(), bytes.size() - sizeof(sum))) {
+			error = "checkpoint checksum mismatch " + checkpointPath();
+			return false;
+		}
+		for (uint64_t i = 0; i < count; ++i) {
+			const char* entry = bytes.data() + header + i * EntryBytes;
+			impl.set(readKey(entry), entry[sizeof(KeyType)] ? store(entry + sizeof(KeyType) + 1) : nullptr);
+		}
+		return true;
+	}
+
+	// Applies the records up to the first incomplete or damaged one, returns the bytes applied.
+	size_t replay(const std::vector<char>& bytes) {
+		size_t at = 0;
+		for (; at + RecordBytes <= bytes.size(); at += RecordBytes) {
+			const char* record = bytes.data() + at;
+			uint32_t sum;
+			std::memcpy(&sum, record + RecordBytes - sizeof(uint32_t), sizeof(sum));
+			if (sum != checksum(record, RecordBytes - sizeof(uint32_t))) {
+				break;
+			}
+			const KeyType key = readKey(record + 1);
+			switch (RecordType(record[0])) {
+			case RecordType::Set:
+				impl.set(key, store(record + 1 + sizeof(KeyType)));
+				break;
+			case RecordType::SetNull:
+				impl.set(key, nullptr);
+				break;
+			case RecordType::Remove:
+				impl.remove(key);
+				break;
+			default:
+				return at;
+			}
+			recovered++;
+		}
+		return at;
+	}
+
+#if defined(__unix__) || defined(__APPLE__)
+	static bool writeAll(int fd, const char* bytes, size_t size) {
+		while (size > 0) {
+			const ssize_t written = ::write(fd, bytes, size);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			bytes += written;
+			size -= size_t(written);
+		}
+		return true;
+	}
+
+	// A missing file reads as empty.
+	bool readFile(const std::string& path, std::vector<char>& out) {
+		out.clear();
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return errno == ENOENT || fail("open " + path);
+		}
+		char chunk[1 << 16];
+		for (;;) {
+			const ssize_t got = ::read(fd, chunk, sizeof(chunk));
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			if (got < 0) {
+				fail("read " + path);
+				::close(fd);
+				return false;
+			}
+			if (got == 0) {
+				::close(fd);
+				return true;
+			}
+			out.insert(out.end(), chunk, chunk + got);
+		}
+	}
+#endif
+};
+
+#endif // __DURABLE_TREE_H_
@@ -0,0 +1,211 @@
+#ifndef __FROZEN_TREE_H_
+#define __FROZEN_TREE_H_
+
+#include "node.h"
+#include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+
+//
+// Read only tree in an implicit level order layout (CSS-tree): all keys sorted in 1 array cut into blocks of
+// B keys (the leaves), and above them levels of nodes with B separator keys each, stored level after level in
+// a second array. Node k of a level has its children at k * (B + 1) + j on the next level, so nodes hold no
+// pointers, parents, sibling links or counts, and everything is 100% full.
+// B fills a cache line (at least 4 keys), nodes are aligned to lines: a lookup reads 1 line per level.
+//
+// Only the last node of a level can be partial, its missing separators are copies of the largest key.
+// A key routed past the last existing child can only be >= that largest key, so it is clamped to the last node.
+//
+// Built by Tree::freeze() or from sorted keys, values are the same pointers as in the tree.
+//
+
+template<typename KeyType, typename DataType>
+struct FrozenTree {
+	static constexpr int B = std::max<int>(4, int(CacheLineSize / sizeof(KeyType)));
+
+	// Same interface as the Tree iterator: index -1 means before the first element.
+	struct Iterator {
+		const FrozenTree* tree;
+		long long index;
+		bool exists;
+
+		void operator++() {
+			next();
+		}
+
+		void next() {
+			++index;
+		}
+
+		bool isValid() const {
+			return index >= 0 && index < (long long)tree->count;
+		}
+
+		const KeyType& key() const {
+			return tree->leafKeys[index];
+		}
+
+		DataType* value() const {
+			return tree->values[index];
+		}
+	};
+
+	FrozenTree() {}
+
+	// count elements in order from a Tree iterator (or anything with isValid / key / value / next).
+	template<typename SourceIterator>
+	FrozenTree(SourceIterator it, size_t count) {
+		build(count, [&](KeyType* keys, DataType** data) {
+			for (size_t i = 0; i < count && it.isValid(); ++i, it.next()) {
+				new (keys + i) KeyType(it.key());
+				data[i] = it.value();
+			}
+		});
+	}
+
+	// Keys must be sorted and unique.
+	FrozenTree(const std::vector<KeyType>& keys, const std::vector<DataType*>& data) {
+		build(keys.size(), [&](KeyType* out, DataType** outData) {
+			std::uninitialized_copy(keys.begin(), keys.end(), out);
+			std::copy(data.begin(), data.end(), outData);
+		});
+	}
+
+	FrozenTree(FrozenTree&& other) = default;
+	FrozenTree& operator=(FrozenTree&& other) = default;
+
+	bool get(const KeyType& key, DataType*& outData) const {
+		Iterator it = find(key);
+		if (!it.exists) {
+			return false;
+		}
+		outData = it.value();
+		return true;
+	}
+
+	// Iterator at key, or at the largest smaller key with exists false (index -1 if there is none).
+	Iterator find(const KeyType& key) const {
+		if (count == 0) {
+			return Iterator{ this, -1, false };
+		}
+		size_t node = 0;
+		const size_t levels = height();
+		for (size_t level = 0; level < levels; ++level) {
+			const KeyType* separators = &innerKeys[(levelOffsets[level] + node) * B];
+			const size_t below = level + 1 < levels ? levelOffsets[level + 2] - levelOffsets[level + 1] : leafBlocks;
+			// routed past the last node of the level below, only keys >= the largest key get there
+			node = std::min(node * (B + 1) + countNotAbove(separators, key), below - 1);
+		}
+		const long long index = std::min<long long>((long long)(node * B + countNotAbove(&leafKeys[node * B], key)) - 1,
+			(long long)count - 1);
+		return Iterator{ this, index, index >= 0 && leafKeys[index] == key };
+	}
+
+	Iterator first() const {
+		return Iterator{ this, 0, count > 0 };
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	// Inner levels, 0 if all keys fit in 1 leaf block.
+	uint height() const {
+		return levelOffsets.empty() ? 0 : uint(levelOffsets.size() - 1);
+	}
+
+	size_t allocatedBytes() const {
+		return (leafBlocks + innerNodes) * B * sizeof(KeyType) + count * sizeof(DataType*)
+			+ levelOffsets.capacity() * sizeof(size_t);
+	}
+
+private:
+	struct AlignedDelete {
+		size_t elements = 0;
+
+		void operator()(KeyType* keys) const {
+			for (size_t i = 0; i < elements; ++i) {
+				keys[i].~KeyType();
+			}
+			::operator delete(keys, std::align_val_t(CacheLineSize));
+		}
+	};
+	typedef std::unique_ptr<KeyType[], AlignedDelete> KeyArray;
+
+	size_t count = 0;
+	size_t leafBlocks = 0;
+	size_t innerNodes = 0;
+	// leafBlocks * B keys, padded with the largest key
+	KeyArray leafKeys;
+	std::unique_ptr<DataType*[]> values;
+	// inner nodes level by level from the root, levelOffsets[l] is the first node of level l and
+	// levelOffsets[height()] the end
+	KeyArray innerKeys;
+	std::vector<size_t> levelOffsets;
+
+	static KeyArray allocate(size_t elements) {
+		void* memory = ::operator new(std::max<size_t>(1, elements) * sizeof(KeyType), std::align_val_t(CacheLineSize));
+		return KeyArray(static_cast<KeyType*>(memory), AlignedDelete{ 0 });
+	}
+
+	// keys <= key among the B keys of a node, a fixed count loop without early exit
+	static size_t countNotAbove(const KeyType* keys, const KeyType& key) {
+		size_t notAbove = 0;
+		for (int i = 0; i < B; ++i) {
+			notAbove += !(key < keys[i]);
+		}
+		return notAbove;
+	}
+
+	template<typename Fill>
+	void build(size_t elements, Fill fill) {
+		count = elements;
+		if (count == 0) {
+			return;
+		}
+		leafBlocks = (count + B - 1) / B;
+		leafKeys = allocate(leafBlocks * B);
+		values.reset(new DataType*[count]);
+		fill(leafKeys.get(), values.get());
+		std::uninitialized_fill(leafKeys.get() + count, leafKeys.get() + leafBlocks * B, leafKeys[count - 1]);
+		leafKeys.get_deleter().elements = leafBlocks * B;
+
+		// level sizes from the leaves up, the root level has 1 node
+		std::vector<size_t> sizes;
+		for (size_t below = leafBlocks; below > 1;) {
+			below = (below + B) / (B + 1);
+			sizes.push_back(below);
+		}
+		if (sizes.empty()) {
+			return;
+		}
+		std::reverse(sizes.begin(), sizes.end());
+		levelOffsets.push_back(0);
+		for (size_t size : sizes) {
+			levelOffsets.push_back(levelOffsets.back() + size);
+		}
+		innerNodes = levelOffsets.back();
+
+		innerKeys = allocate(innerNodes * B);
+		// leaf blocks under each child of a node: 1 on the lowest level, B + 1 times more every level up
+		size_t span = 1;
+		for (size_t level = sizes.size(); level-- > 0; span *= B + 1) {
+			for (size_t node = 0; node < sizes[level]; ++node) {
+				KeyType* separators = &innerKeys[(levelOffsets[level] + node) * B];
+				for (int j = 0; j < B; ++j) {
+					// the smallest key under child j + 1
+					const size_t block = (node * (B + 1) + j + 1) * span;
+					new (separators + j) KeyType(block < leafBlocks ? leafKeys[block * B] : leafKeys[count - 1]);
+				}
+			}
+		}
+		innerKeys.get_deleter().elements = innerNodes * B;
+	}
+};
+
+#endif // __FROZEN_TREE_H_
@@ -0,0 +1,217 @@
+#ifndef __IO_SIM_H_
+#define __IO_SIM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// External memory (I/O model) simulator fed by the INCR_BLOCKS hook.
+// Memory is split in blocks of B bytes, a level caches M blocks and replaces them with LRU or CLOCK.
+// Every node touch is translated to the blocks the node spans. Levels are ordered from the fastest to the slowest,
+// a block that misses a level is looked up in the next one and gets loaded in every level it missed (inclusive).
+// The misses of the last level are the simulated transfers from disk.
+//
+// Every node is passed to the hook once when it is created, the root included. Descents start below the root,
+// which is assumed to stay in memory, same as the plain block counter.
+//
+
+struct BlockCache {
+	virtual ~BlockCache() {}
+
+	// Returns true on a hit. On a miss the block gets loaded, evicting another if full.
+	virtual bool Access(uint64_t Block) = 0;
+	virtual void Clear() = 0;
+	virtual const char* PolicyName() const = 0;
+};
+
+struct LruCache : BlockCache {
+	size_t Capacity;
+	std::list<uint64_t> Order; // most recent first
+	std::unordered_map<uint64_t, std::list<uint64_t>::iterator> Where;
+
+	LruCache(size_t Capacity)
+		: Capacity(Capacity) {
+		Where.reserve(Capacity);
+	}
+
+	bool Access(uint64_t Block) override {
+		auto Found = Where.find(Block);
+		if (Found != Where.end()) {
+			Order.splice(Order.begin(), Order, Found->second);
+			return true;
+		}
+		if (Order.size() >= Capacity) {
+			Where.erase(Order.back());
+			Order.pop_back();
+		}
+		Order.push_front(Block);
+		Where[Block] = Order.begin();
+		return false;
+	}
+
+	void Clear() override {
+		Order.clear();
+		Where.clear();
+	}
+
+	const char* PolicyName() const override {
+		return "lru";
+	}
+};
+
+// Second chance approximation of LRU, what most buffer pools actually run.
+struct ClockCache : BlockCache {
+	std::vector<uint64_t> Frames;
+	std::vector<bool> Referenced;
+	std::unordered_map<uint64_t, size_t> Where;
+	size_t Capacity;
+	size_t Hand;
+
+	ClockCache(size_t Capacity)
+		: Capacity(Capacity)
+		, Hand(0) {
+		Frames.reserve(Capacity);
+		Referenced.reserve(Capacity);
+		Where.reserve(Capacity);
+	}
+
+	bool Access(uint64_t Block) override {
+		auto Found = Where.find(Block);
+		if (Found != Where.end()) {
+			Referenced[Found->second] = true;
+			return true;
+		}
+		if (Frames.size() < Capacity) {
+			Where[Block] = Frames.size();
+			Frames.push_back(Block);
+			Referenced.push_back(true);
+			return false;
+		}
+		while (Referenced[Hand]) {
+			Referenced[Hand] = false;
+			Hand = (Hand + 1) % Capacity;
+		}
+		Where.erase(Frames[Hand]);
+		Frames[Hand] = Block;
+		Referenced[Hand] = true;
+		Where[Block] = Hand;
+		Hand = (Hand + 1) % Capacity;
+		return false;
+	}
+
+	void Clear() override {
+		Frames.clear();
+		Referenced.clear();
+		Where.clear();
+		Hand = 0;
+	}
+
+	const char* PolicyName() const override {
+		return "clock";
+	}
+};
+
+struct IoLevel {
+	size_t BlockSize;
+	size_t BlockCount;
+	std::unique_ptr<BlockCache> Cache;
+};
+
+struct IoSimulator {
+	std::vector<IoLevel> Levels;
+	std::vector<uint64_t> Misses; // per level, since the last ResetCounters()
+
+	void AddLevel(const std::string& Policy, size_t BlockSize, size_t BlockCount) {
+		IoLevel Level;
+		Level.BlockSize = BlockSize;
+		Level.BlockCount = BlockCount;
+		if (Policy == "clock") {
+			Level.Cache.reset(new ClockCache(BlockCount));
+		}
+		else {
+			Level.Cache.reset(new LruCache(BlockCount));
+		}
+		Levels.push_back(std::move(Level));
+		Misses.push_back(0);
+	}
+
+	void Access(const void* Address, size_t Size) {
+		const uint64_t Begin = reinterpret_cast<uintptr_t>(Address);
+		const uint64_t End = Begin + (Size > 0 ? Size - 1 : 0);
+		Access(0, Begin, End);
+	}
+
+	// Bytes [Begin, End] at level l, only the byte ranges of the blocks that missed go on to level l + 1.
+	// Adjacent missed blocks are forwarded as 1 range.
+	void Access(size_t l, uint64_t Begin, uint64_t End) {
+		if (l == Levels.size()) {
+			return;
+		}
+		const IoLevel& Level = Levels[l];
+		const uint64_t Last = End / Level.BlockSize;
+		bool Missing = false;
+		uint64_t MissBegin = 0;
+		for (uint64_t Block = Begin / Level.BlockSize; Block <= Last; ++Block) {
+			const bool Hit = Level.Cache->Access(Block);
+			if (!Hit) {
+				Misses[l]++;
+				if (!Missing) {
+					MissBegin = std::max(Begin, Block * Level.BlockSize);
+					Missing = true;
+				}
+			}
+			if (Missing && (Hit || Block == Last)) {
+				const uint64_t MissEnd = Hit ? Block * Level.BlockSize - 1 : End;
+				Access(l + 1, MissBegin, MissEnd);
+				Missing = false;
+			}
+		}
+	}
+
+	void ResetCounters() {
+		std::fill(Misses.begin(), Misses.end(), 0);
+	}
+
+	std::string LevelName(size_t l) const {
+		std::stringstream ss;
+		ss << "L" << l + 1 << " " << Levels[l].Cache->PolicyName() << " " << Levels[l].BlockCount << "x" << Levels[l].BlockSize << "B";
+		return ss.str();
+	}
+
+	// Parses "policy:blockSize:blockCount[,policy:blockSize:blockCount...]", policy is lru or clock.
+	// Returns nullptr if the description is malformed.
+	static std::unique_ptr<IoSimulator> Parse(const std::string& Description) {
+		std::unique_ptr<IoSimulator> Sim(new IoSimulator());
+		std::stringstream Levels(Description);
+		std::string Level;
+		while (std::getline(Levels, Level, ',')) {
+			std::stringstream Parts(Level);
+			std::string Policy, BlockSize, BlockCount;
+			if (!std::getline(Parts, Policy, ':') || !std::getline(Parts, BlockSize, ':') || !std::getline(Parts, BlockCount, ':')) {
+				return nullptr;
+			}
+			if (Policy != "lru" && Policy != "clock") {
+				return nullptr;
+			}
+			long long B = std::atoll(BlockSize.c_str());
+			long long M = std::atoll(BlockCount.c_str());
+			if (B <= 0 || M <= 0) {
+				return nullptr;
+			}
+			Sim->AddLevel(Policy, size_t(B), size_t(M));
+		}
+		if (Sim->Levels.empty()) {
+			return nullptr;
+		}
+		return Sim;
+	}
+};
+
+#endif //__IO_SIM_H_
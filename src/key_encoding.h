@@ -0,0 +1,220 @@
+#ifndef __KEY_ENCODING_H_
+#define __KEY_ENCODING_H_
+
+#include <array>
+#include <algorithm>
+#include <tuple>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+//
+// Order preserving binary encoding of composite keys. KeyEncoder<Fields...> writes every field big endian at a
+// fixed width, so comparing 2 encoded keys byte by byte (memcmp) gives the same order as comparing the tuples
+// field by field. The tree then stores NormalizedKey<Width>, which keeps the bytes as big endian 8 byte words,
+// and every comparison of the binary search is a short loop of integer compares instead of a chain of
+// field comparisons with a type of its own each.
+//
+// Field types:
+// - unsigned integers: big endian
+// - signed integers: big endian with the sign bit flipped, so negative values sort first
+// - FixedString<Width>: the first Width bytes of a string, padded with zeros. Longer strings are cut
+//   (keys that only differ after Width bytes compare equal) and trailing zero bytes are lost on decode.
+//
+
+template<size_t Width>
+struct NormalizedKey {
+	static constexpr size_t Words = (Width + 7) / 8;
+
+	// The encoded bytes as big endian words (zero padded at the end), comparing the words as integers is
+	// comparing the bytes with memcmp, without swapping bytes in every comparison.
+	std::array<uint64_t, Words> words{};
+
+	// <0, 0, >0 like memcmp
+	int compare(const NormalizedKey& other) const {
+		for (size_t i = 0; i < Words; ++i) {
+			if (words[i] != other.words[i]) {
+				return words[i] < other.words[i] ? -1 : 1;
+			}
+		}
+		return 0;
+	}
+
+	bool operator<(const NormalizedKey& other) const {
+		for (size_t i = 0; i + 1 < Words; ++i) {
+			if (words[i] < other.words[i]) {
+				return true;
+			}
+			if (other.words[i] < words[i]) {
+				return false;
+			}
+		}
+		return words[Words - 1] < other.words[Words - 1];
+	}
+	bool operator<=(const NormalizedKey& other) const {
+		return !(other < *this);
+	}
+	bool operator>(const NormalizedKey& other) const {
+		return other < *this;
+	}
+	bool operator>=(const NormalizedKey& other) const {
+		return !(*this < other);
+	}
+	bool operator==(const NormalizedKey& other) const {
+		bool equal = true;
+		for (size_t i = 0; i < Words; ++i) {
+			equal &= words[i] == other.words[i];
+		}
+		return equal;
+	}
+	bool operator!=(const NormalizedKey& other) const {
+		return !(*this == other);
+	}
+
+	void fromBytes(const uint8_t* bytes) {
+		uint8_t padded[Words * 8] = {};
+		std::memcpy(padded, bytes, Width);
+		for (size_t i = 0; i < Words; ++i) {
+			uint64_t word;
+			std::memcpy(&word, padded + i * 8, sizeof(word));
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			word = __builtin_bswap64(word);
+#else
+			word = 0;
+			for (size_t b = 0; b < 8; ++b) {
+				word = (word << 8) | padded[i * 8 + b];
+			}
+#endif
+			words[i] = word;
+		}
+	}
+
+	void toBytes(uint8_t* bytes) const {
+		for (size_t i = 0; i < Width; ++i) {
+			bytes[i] = uint8_t(words[i / 8] >> (56 - 8 * (i % 8)));
+		}
+	}
+};
+
+// String field of a composite key, see FixedString in the comment above.
+template<size_t Width>
+struct FixedString {
+	std::string value;
+
+	FixedString() {}
+	FixedString(std::string value)
+		: value(std::move(value)) {}
+};
+
+// Width and encoding of one field type.
+template<typename T, typename Enable = void>
+struct FieldCodec;
+
+template<typename T>
+struct FieldCodec<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+	typedef typename std::make_unsigned<T>::type Unsigned;
+	static constexpr size_t Width = sizeof(T);
+
+	static void encode(uint8_t* out, T value) {
+		Unsigned bits = Unsigned(value);
+		if (std::is_signed<T>::value) {
+			bits ^= Unsigned(1) << (8 * sizeof(T) - 1);
+		}
+		for (size_t i = 0; i < Width; ++i) {
+			out[Width - 1 - i] = uint8_t(bits >> (8 * i));
+		}
+	}
+
+	static T decode(const uint8_t* in) {
+		Unsigned bits = 0;
+		for (size_t i = 0; i < Width; ++i) {
+			bits = Unsigned(bits << 8) | in[i];
+		}
+		if (std::is_signed<T>::value) {
+			bits ^= Unsigned(1) << (8 * sizeof(T) - 1);
+		}
+		return T(bits);
+	}
+};
+
+template<size_t StringWidth>
+struct FieldCodec<FixedString<StringWidth>> {
+	static constexpr size_t Width = StringWidth;
+
+	static void encode(uint8_t* out, const std::string& value) {
+		const size_t length = std::min(value.size(), Width);
+		std::memcpy(out, value.data(), length);
+		std::memset(out + length, 0, Width - length);
+	}
+
+	static void encode(uint8_t* out, const FixedString<StringWidth>& value) {
+		encode(out, value.value);
+	}
+
+	static FixedString<StringWidth> decode(const uint8_t* in) {
+		size_t length = Width;
+		while (length > 0 && in[length - 1] == 0) {
+			--length;
+		}
+		return FixedString<StringWidth>(std::string(reinterpret_cast<const char*>(in), length));
+	}
+};
+
+template<typename... Fields>
+struct KeyEncoder {
+	static constexpr size_t Width = (FieldCodec<Fields>::Width + ...);
+	typedef NormalizedKey<Width> Key;
+	typedef std::tuple<Fields...> Tuple;
+
+	// Values convert to the field types, a FixedString field also takes a std::string without copying it.
+	template<typename... Values>
+	static Key encode(const Values&... values) {
+		static_assert(sizeof...(Values) == sizeof...(Fields), "one value per field");
+		uint8_t bytes[Width];
+		uint8_t* out = bytes;
+		((FieldCodec<Fields>::encode(out, values), out += FieldCodec<Fields>::Width), ...);
+		Key key;
+		key.fromBytes(bytes);
+		return key;
+	}
+
+	template<typename... Values>
+	static Key encode(const std::tuple<Values...>& values) {
+		return std::apply([](const Values&... fields) { return encode(fields...); }, values);
+	}
+
+	static Tuple decode(const Key& key) {
+		return decodeFields(key, std::index_sequence_for<Fields...>());
+	}
+
+	// Single field, without decoding the others.
+	template<size_t Index>
+	static typename std::tuple_element<Index, Tuple>::type field(const Key& key) {
+		typedef typename std::tuple_element<Index, Tuple>::type T;
+		uint8_t bytes[Width];
+		key.toBytes(bytes);
+		return FieldCodec<T>::decode(bytes + offset<Index>());
+	}
+
+private:
+	template<size_t Index>
+	static constexpr size_t offset() {
+		constexpr size_t widths[] = { FieldCodec<Fields>::Width... };
+		size_t sum = 0;
+		for (size_t i = 0; i < Index; ++i) {
+			sum += widths[i];
+		}
+		return sum;
+	}
+
+	template<size_t... Indexes>
+	static Tuple decodeFields(const Key& key, std::index_sequence<Indexes...>) {
+		uint8_t bytes[Width];
+		key.toBytes(bytes);
+		return Tuple(FieldCodec<typename std::tuple_element<Indexes, Tuple>::type>::decode(bytes + offset<Indexes>())...);
+	}
+};
+
+#endif // __KEY_ENCODING_H_
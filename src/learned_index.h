@@ -0,0 +1,179 @@
+#ifndef __LEARNED_INDEX_H_
+#define __LEARNED_INDEX_H_
+
+#include "node.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+//
+// Read only map for integer keys where a piecewise linear model replaces the inner levels. The keys are one
+// sorted array (the leaves) and the model is a short list of segments, each a line from key to position that is
+// off by at most Error positions for every key it covers. A lookup finds the segment (binary search over the
+// segment start keys, there are far fewer segments than inner nodes), predicts the position and finishes with a
+// binary search over the 2 * Error + 5 keys around it.
+//
+// Segments are built in 1 pass (shrinking cone): a segment starts at a key and takes keys while some slope
+// through its first point still keeps all of them within Error. Evenly spread keys fit in a few segments,
+// clustered or skewed keys need more, the memory of the index follows the shape of the data.
+//
+// Built from a Tree iterator or from sorted keys, values are the same pointers as in the tree.
+//
+
+template<typename KeyType, typename DataType, uint Error = 32>
+struct LearnedIndex {
+	static_assert(std::is_integral<KeyType>::value, "LearnedIndex needs integer keys");
+
+	typedef typename std::make_unsigned<KeyType>::type UKey;
+
+	// Same interface as the Tree iterator: index -1 means before the first element.
+	struct Iterator {
+		const LearnedIndex* index;
+		long long position;
+		bool exists;
+
+		void operator++() {
+			next();
+		}
+
+		void next() {
+			++position;
+		}
+
+		bool isValid() const {
+			return position >= 0 && position < (long long)index->keys.size();
+		}
+
+		const KeyType& key() const {
+			return index->keys[position];
+		}
+
+		DataType* value() const {
+			return index->values[position];
+		}
+	};
+
+	LearnedIndex() {}
+
+	// count elements in order from a Tree iterator (or anything with isValid / key / value / next).
+	template<typename SourceIterator>
+	LearnedIndex(SourceIterator it, size_t count) {
+		keys.reserve(count);
+		values.reserve(count);
+		for (size_t i = 0; i < count && it.isValid(); ++i, it.next()) {
+			keys.push_back(it.key());
+			values.push_back(it.value());
+		}
+		build();
+	}
+
+	// Keys must be sorted and unique.
+	LearnedIndex(std::vector<KeyType> sortedKeys, std::vector<DataType*> data)
+		: keys(std::move(sortedKeys))
+		, values(std::move(data)) {
+		build();
+	}
+
+	bool get(const KeyType& key, DataType*& outData) const {
+		Iterator it = find(key);
+		if (!it.exists) {
+			return false;
+		}
+		outData = it.value();
+		return true;
+	}
+
+	// Iterator at key, or at the largest smaller key with exists false (position -1 if there is none).
+	Iterator find(const KeyType& key) const {
+		if (keys.empty() || key < keys[0]) {
+			return Iterator{ this, -1, false };
+		}
+		const size_t segment = std::upper_bound(segmentKeys.begin(), segmentKeys.end(), key) - segmentKeys.begin() - 1;
+		const Segment& model = segments[segment];
+		const long long start = (long long)model.start;
+		const long long end = segment + 1 < segments.size() ? (long long)segments[segment + 1].start : (long long)keys.size();
+		// keys past the last key of the segment predict past its end, they all belong to its last key
+		const long long predicted = std::min(end - 1,
+			start + (long long)(model.slope * double(UKey(key) - UKey(segmentKeys[segment]))));
+		// + 2: a missing key lies between 2 modeled keys, and the prediction is rounded down
+		const long long from = std::max(start, predicted - (long long)Error - 2);
+		const long long to = std::min(end, predicted + (long long)Error + 3);
+		// the largest key <= key, keys[from] is one of them. Without branches the loads of the next steps do not
+		// wait for the compare of the last one
+		const KeyType* base = keys.data() + from;
+		for (size_t len = size_t(to - from); len > 1;) {
+			const size_t half = len / 2;
+			base = base[half] <= key ? base + half : base;
+			len -= half;
+		}
+		return Iterator{ this, base - keys.data(), *base == key };
+	}
+
+	Iterator first() const {
+		return Iterator{ this, 0, !keys.empty() };
+	}
+
+	size_t size() const {
+		return keys.size();
+	}
+
+	bool empty() const {
+		return keys.empty();
+	}
+
+	size_t segmentCount() const {
+		return segments.size();
+	}
+
+	// Bytes of the model alone, what replaces the inner levels.
+	size_t indexBytes() const {
+		return segments.capacity() * sizeof(Segment) + segmentKeys.capacity() * sizeof(KeyType);
+	}
+
+	size_t allocatedBytes() const {
+		return indexBytes() + keys.capacity() * sizeof(KeyType) + values.capacity() * sizeof(DataType*);
+	}
+
+private:
+	struct Segment {
+		double slope;
+		size_t start;
+	};
+
+	std::vector<KeyType> keys;
+	std::vector<DataType*> values;
+	// first key of every segment, searched on its own so the search touches only keys
+	std::vector<KeyType> segmentKeys;
+	std::vector<Segment> segments;
+
+	void build() {
+		const double error = double(Error);
+		size_t start = 0;
+		double low = 0.0;
+		double high = std::numeric_limits<double>::infinity();
+		for (size_t i = 1; i <= keys.size(); ++i) {
+			if (i < keys.size()) {
+				// slopes through the first point that keep key i within Error
+				const double dx = double(UKey(keys[i]) - UKey(keys[start]));
+				const double dy = double(i - start);
+				const double newLow = std::max(low, (dy - error) / dx);
+				const double newHigh = std::min(high, (dy + error) / dx);
+				if (newLow <= newHigh) {
+					low = newLow;
+					high = newHigh;
+					continue;
+				}
+			}
+			segmentKeys.push_back(keys[start]);
+			segments.push_back(Segment{ high == std::numeric_limits<double>::infinity() ? 0.0 : (low + high) / 2, start });
+			start = i;
+			low = 0.0;
+			high = std::numeric_limits<double>::infinity();
+		}
+		segmentKeys.shrink_to_fit();
+		segments.shrink_to_fit();
+	}
+};
+
+#endif // __LEARNED_INDEX_H_
@@ -3,13 +3,24 @@
 #define DECLARE_EXTERN_TESTBENCH_VARS
 #define COUNT_BLOCKS 1
 #include "testbench.h"
+#include "results.h"
 
 #include "tree.h"
 #include "random_gen.h"
-#include <LEDA/core/impl/ab_tree.h>
-#include <LEDA/core/dictionary.h>
+#include "workload.h"
+#include "baselines.h"
+#include "sharded_tree.h"
+#include "combining_tree.h"
+#include "packed_tree.h"
+#include "key_encoding.h"
+#include "cached_tree.h"
+#include "learned_index.h"
+#include "durable_tree.h"
+#include "multi_tree.h"
 #include <iostream>
 #include <unordered_set>
+#include <cstdlib>
+#include <optional>
 
 AggregateTimer timer;
 Benchmark bench;
@@ -17,10 +28,10 @@ Benchmark bench;
 //constexpr int NodeSize = 338; // blocksize
 constexpr int NodeSize = 128;
 
-using LedaTree = leda::dictionary<int, int*, leda::ab_tree>;
 using ImplTree = Tree<int, int, NodeSize>;
 
-void add_no_bench(LedaTree& leda, ImplTree& impl, int N, int seed, std::vector<int*>& outPtrs) {
+template<typename Baseline>
+void add_no_bench(Baseline& base, ImplTree& impl, int N, int seed, std::vector<int*>& outPtrs) {
 	
 	rd::seed(seed);
 
@@ -35,7 +46,7 @@ void add_no_bench(LedaTree& leda, ImplTree& impl, int N, int seed, std::vector<i
 	}
 
 	for (int i = 0; i < N; ++i) {
-		leda.insert(numbers[i], outPtrs[i]);
+		base.insert(numbers[i], outPtrs[i]);
 	}
 
 	for (int i = 0; i < N; ++i) {
@@ -43,7 +54,8 @@ void add_no_bench(LedaTree& leda, ImplTree& impl, int N, int seed, std::vector<i
 	}
 }
 
-void add_test(LedaTree& leda, ImplTree& impl, int N, int seed, std::vector<int*>& outPtrs) {
+template<typename Baseline>
+void add_test(Baseline& base, ImplTree& impl, int N, int seed, std::vector<int*>& outPtrs) {
 	rd::seed(seed);
 
 	std::vector<int> numbers;
@@ -59,19 +71,22 @@ void add_test(LedaTree& leda, ImplTree& impl, int N, int seed, std::vector<int*>
 
 	bench.StartTest();
 	for (int i = 0; i < N; ++i) {
-		leda.insert(numbers[i], outPtrs[i]);
+		auto sample = bench.SampleOp();
+		base.insert(numbers[i], outPtrs[i]);
 	}
-	bench.StopLeda();
+	bench.StopBaseline();
 
 	bench.StartTest();
 	for (int i = 0; i < N; ++i) {
+		auto sample = bench.SampleOp();
 		impl.set(numbers[i], outPtrs[i]);
 	}
 	bench.StopImpl();
-	bench.PrintLast({ TestType::Add }, "Add " + std::to_string(N / 1000) + "k");
+	bench.PrintLast({ TestType::Add, NodeSize, N }, "Add " + std::to_string(N / 1000) + "k");
 }
 
-void get_test(LedaTree& leda, ImplTree& impl, int N, int seed) {
+template<typename Baseline>
+void get_test(Baseline& base, ImplTree& impl, int N, int seed) {
 	rd::seed(seed);
 
 	std::vector<int> numbers;
@@ -79,33 +94,36 @@ void get_test(LedaTree& leda, ImplTree& impl, int N, int seed) {
 		numbers.push_back(rd::get());
 	}
 
-	int ledaR = 0;
+	int baseR = 0;
 	int implR = 0;
 	bench.StartTest();
 	for (int number : numbers) {
-		leda::dic_item r = leda.lookup(number);
-		if (r) {
-			ledaR ^= *leda.inf(r);
+		auto sample = bench.SampleOp();
+		int* num;
+		if (base.lookup(number, num)) {
+			baseR ^= *num;
 		}
 	}
-	bench.StopLeda();
+	bench.StopBaseline();
 
 	bench.StartTest();
 	for (int number : numbers) {
+		auto sample = bench.SampleOp();
 		int* num;
 		if (impl.get(number, num)) {
 			implR ^= *num;
 		}
 	}
 	bench.StopImpl();
-	bench.PrintLast({ TestType::Get }, "Get " + std::to_string(N / 1000) + "k");
+	bench.PrintLast({ TestType::Get, NodeSize, N }, "Get " + std::to_string(N / 1000) + "k");
 
-	if (ledaR != implR) {
+	if (baseR != implR) {
 		std::cout << "comparision resulted in differences.\n";
 	}
 }
 
-void delete_test(LedaTree& leda, ImplTree& impl, int N, int seed) {
+template<typename Baseline>
+void delete_test(Baseline& base, ImplTree& impl, int N, int seed) {
 	rd::seed(seed);
 	std::vector<int> numbers;
 	for (int i = 0; i < N; ++i) {
@@ -113,19 +131,22 @@ void delete_test(LedaTree& leda, ImplTree& impl, int N, int seed) {
 	}
 	bench.StartTest();
 	for (int number : numbers) {
-		leda.undefine(number);
+		auto sample = bench.SampleOp();
+		base.erase(number);
 	}
-	bench.StopLeda();
+	bench.StopBaseline();
 
 	bench.StartTest();
 	for (int number : numbers) {
+		auto sample = bench.SampleOp();
 		impl.remove(number);
 	}
 	bench.StopImpl();
-	bench.PrintLast({ TestType::Del }, "Del " + std::to_string(N / 1000) + "k");
+	bench.PrintLast({ TestType::Del, NodeSize, int(N) }, "Del " + std::to_string(N / 1000) + "k");
 }
 
-void delete_ex(LedaTree& leda, ImplTree& impl, unsigned int N, int seed) {
+template<typename Baseline>
+void delete_ex(Baseline& base, ImplTree& impl, unsigned int N, int seed) {
 	rd::seed(seed);
 
 	if (N > (impl.size() * 3) / 4) {
@@ -144,31 +165,33 @@ void delete_ex(LedaTree& leda, ImplTree& impl, unsigned int N, int seed) {
 
 	bench.StartTest();
 	for (int number : numbers) {
-		leda.undefine(number);
+		auto sample = bench.SampleOp();
+		base.erase(number);
 	}
-	bench.StopLeda();
+	bench.StopBaseline();
 
 	bench.StartTest();
 	for (int number : numbers) {
+		auto sample = bench.SampleOp();
 		impl.remove(number);
 	}
 	bench.StopImpl();
-	bench.PrintLast({ TestType::Del }, "Del Exact " + std::to_string(N / 1000) + "k");
+	bench.PrintLast({ TestType::Del, NodeSize, int(N) }, "Del Exact " + std::to_string(N / 1000) + "k");
 }
 
-void iterate_all(LedaTree& leda, ImplTree& impl) {
+template<typename Baseline>
+void iterate_all(Baseline& base, ImplTree& impl) {
 
 	int count = impl.size();
 
-	int ledaR = 0;
+	int baseR = 0;
 	int implR = 0;
 
 	bench.StartTest();
-	int n;
-	forall_defined(n, leda) {
-		ledaR ^= n;
-	}
-	bench.StopLeda();
+	base.forEach([&](int key) {
+		baseR ^= key;
+	});
+	bench.StopBaseline();
 
 	bench.StartTest();
 	for (Iterator it = impl.first(); it.isValid(); ++it) {
@@ -176,58 +199,1507 @@ void iterate_all(LedaTree& leda, ImplTree& impl) {
 	}
 	bench.StopImpl();
 
-	if (ledaR != implR) {
+	if (baseR != implR) {
 		std::cout << "iteration resulted in differences.\n";
 	}
-	bench.PrintLast({ TestType::Iterate }, "Iter " + std::to_string(count / 1000000) + "m");
+	bench.PrintLast({ TestType::Iterate, NodeSize, count }, "Iter " + std::to_string(count / 1000000) + "m");
+}
+
+// Monotonically increasing keys on empty containers, e.g. ids or timestamps.
+template<typename Baseline>
+void append_test(int N, std::vector<int*>& outPtrs) {
+	Baseline base;
+	ImplTree impl;
+
+	size_t firstPtr = outPtrs.size();
+	for (int i = 0; i < N; ++i) {
+		outPtrs.push_back(new int(i));
+	}
+
+	bench.StartTest();
+	for (int i = 0; i < N; ++i) {
+		auto sample = bench.SampleOp();
+		base.insert(i, outPtrs[firstPtr + i]);
+	}
+	bench.StopBaseline();
+
+	bench.StartTest();
+	for (int i = 0; i < N; ++i) {
+		auto sample = bench.SampleOp();
+		impl.set(i, outPtrs[firstPtr + i]);
+	}
+	bench.StopImpl();
+	bench.PrintLast({ TestType::Add, NodeSize, N }, "Append " + std::to_string(N / 1000) + "k");
+	std::cout << "#   leaf fill factor " << std::fixed << std::setprecision(3) << impl.fillFactor() << "\n";
+}
+
+// Lookups along a random walk over the key space (steps of at most maxStep), the tree searches from the
+// previous result. The same walk without hints is timed separately to show what the finger search saves.
+template<typename Baseline>
+void walk_test(int N, int maxStep, int seed) {
+	Baseline base;
+	ImplTree impl;
+
+	// every other key exists
+	for (int i = 0; i < N; ++i) {
+		base.insert(i * 2, nullptr);
+		impl.set(i * 2, nullptr);
+	}
+
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<> step(-maxStep, maxStep);
+	std::vector<int> walk;
+	walk.reserve(N);
+	int key = N;
+	for (int i = 0; i < N; ++i) {
+		key = std::min(2 * N - 1, std::max(0, key + step(gen)));
+		walk.push_back(key);
+	}
+
+	int baseR = 0;
+	int implR = 0;
+	bench.StartTest();
+	for (int k : walk) {
+		auto sample = bench.SampleOp();
+		int* num;
+		baseR += base.lookup(k, num);
+	}
+	bench.StopBaseline();
+
+	bench.StartTest();
+	ImplTree::Iterator hint = impl.find(walk[0]);
+	for (int k : walk) {
+		auto sample = bench.SampleOp();
+		hint = impl.find(k, hint);
+		implR += hint.exists;
+	}
+	bench.StopImpl();
+	bench.PrintLast({ TestType::Get, NodeSize, N }, "Walk " + std::to_string(N / 1000) + "k");
+
+	int plainR = 0;
+	auto start = ch::steady_clock::now();
+	for (int k : walk) {
+		plainR += impl.find(k).exists;
+	}
+	auto plainUs = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+	std::cout << "#   without hints " << plainUs << " us\n";
+
+	if (baseR != implR || plainR != implR) {
+		std::cout << "walk resulted in differences.\n";
+	}
+}
+
+void print_tree_stats(const ImplTree& impl) {
+	std::stringstream ss;
+	impl.stats().print(ss);
+	std::string line;
+	while (std::getline(ss, line)) {
+		std::cout << "#   " << line << "\n";
+	}
+}
+
+// Compaction after the delete phases: incremental steps of maxLeaves to 90% first (reports the longest pause),
+// then the full rebuild to 100%.
+void compact_test(ImplTree& impl, uint maxLeaves) {
+	auto report = [&](const char* when) {
+		std::cout << "#   " << when << ": nodes " << impl.nodes << " height " << impl.height
+			<< " leaf fill " << std::fixed << std::setprecision(3) << impl.fillFactor()
+			<< " bytes/key " << std::setprecision(1) << impl.stats().bytesPerKey() << "\n";
+	};
+	report("before compaction");
+
+	long long totalUs = 0;
+	long long maxStepUs = 0;
+	int steps = 0;
+	bool done = false;
+	while (!done) {
+		auto start = ch::steady_clock::now();
+		done = impl.compactStep(maxLeaves, 0.9);
+		long long us = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+		totalUs += us;
+		maxStepUs = std::max(maxStepUs, us);
+		++steps;
+	}
+	std::cout << "#   compactStep(" << maxLeaves << ", 0.9) x" << steps << ": " << totalUs << " us, longest step " << maxStepUs << " us\n";
+	report("after incremental");
+
+	auto start = ch::steady_clock::now();
+	impl.compact(1.0);
+	long long us = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+	std::cout << "#   compact(1.0): " << us << " us\n";
+	report("after compact");
+}
+
+// Random inserts and lookups on the tree with compressed leaves, the mutable tree is timed on the same keys
+// for the cost of the compression and both report their memory.
+template<typename Baseline>
+void packed_test(int N, int seed) {
+	Baseline base;
+	PackedTree<int, int> packed;
+	ImplTree impl;
+
+	rd::seed(seed);
+	std::vector<int> numbers;
+	numbers.reserve(N);
+	for (int i = 0; i < N; ++i) {
+		numbers.push_back(rd::get());
+	}
+
+	bench.StartTest();
+	for (int number : numbers) {
+		auto sample = bench.SampleOp();
+		base.insert(number, nullptr);
+	}
+	bench.StopBaseline();
+
+	bench.StartTest();
+	for (int number : numbers) {
+		auto sample = bench.SampleOp();
+		packed.set(number, nullptr);
+	}
+	bench.StopImpl();
+	bench.PrintLast({ TestType::Add, NodeSize, N }, "Packed add " + std::to_string(N / 1000) + "k");
+
+	auto start = ch::steady_clock::now();
+	for (int number : numbers) {
+		impl.set(number, nullptr);
+	}
+	auto addUs = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+
+	std::shuffle(numbers.begin(), numbers.end(), rd::gen);
+	for (int i = 0; i < N; i += 2) {
+		numbers[i]++;
+	}
+
+	int baseR = 0;
+	int packedR = 0;
+	bench.StartTest();
+	for (int number : numbers) {
+		auto sample = bench.SampleOp();
+		int* num;
+		baseR += base.lookup(number, num);
+	}
+	bench.StopBaseline();
+
+	bench.StartTest();
+	for (int number : numbers) {
+		auto sample = bench.SampleOp();
+		int* num;
+		packedR += packed.get(number, num);
+	}
+	bench.StopImpl();
+	bench.PrintLast({ TestType::Get, NodeSize, N }, "Packed get " + std::to_string(N / 1000) + "k");
+
+	int implR = 0;
+	start = ch::steady_clock::now();
+	for (int number : numbers) {
+		int* num;
+		implR += impl.get(number, num);
+	}
+	auto getUs = ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+
+	std::vector<int> widths = packed.deltaWidths();
+	std::cout << "#   uncompressed tree: add " << addUs << " us, get " << getUs << " us\n";
+	std::cout << "#   bytes/key packed " << std::fixed << std::setprecision(1) << double(packed.allocatedBytes()) / packed.size()
+		<< " tree " << impl.stats().bytesPerKey() << ", leaves " << packed.leafCount() << " with 1/2/4/8 byte deltas "
+		<< std::count(widths.begin(), widths.end(), 1) << "/" << std::count(widths.begin(), widths.end(), 2) << "/"
+		<< std::count(widths.begin(), widths.end(), 4) << "/" << std::count(widths.begin(), widths.end(), 8) << "\n";
+
+	if (baseR != packedR || implR != packedR) {
+		std::cout << "packed resulted in differences.\n";
+	}
+}
+
+// 1 test through bench: base() is timed as the baseline side, impl() as the implementation side.
+// For the tests of tree variants, where the baseline is the plain tree doing the same work.
+template<typename BaseBody, typename ImplBody>
+void bench_pair(TestInfo info, const std::string& title, BaseBody base, ImplBody impl) {
+	bench.StartTest();
+	base();
+	bench.StopBaseline();
+
+	bench.StartTest();
+	impl();
+	bench.StopImpl();
+	bench.PrintLast(info, title);
+}
+
+// Composite keys as std::tuple (baseline) against their normalized encoding, keys are inserted and then looked up
+// in random order (half of the lookups miss). The encoded tree encodes every key inside the timed loops.
+template<typename Encoder, typename Fields>
+void time_composite(const std::string& name, const std::vector<Fields>& keys, const std::vector<Fields>& probes) {
+	Tree<Fields, int, NodeSize> tupleTree;
+	Tree<typename Encoder::Key, int, NodeSize> encodedTree;
+	bench_pair({ TestType::Add, NodeSize, int(keys.size()) }, name + " add", [&] {
+		for (const Fields& key : keys) {
+			auto sample = bench.SampleOp();
+			tupleTree.set(key, nullptr);
+		}
+	}, [&] {
+		for (const Fields& key : keys) {
+			auto sample = bench.SampleOp();
+			encodedTree.set(Encoder::encode(key), nullptr);
+		}
+	});
+
+	int tupleR = 0;
+	int encodedR = 0;
+	bench_pair({ TestType::Get, NodeSize, int(probes.size()) }, name + " get", [&] {
+		for (const Fields& key : probes) {
+			auto sample = bench.SampleOp();
+			int* value;
+			tupleR += tupleTree.get(key, value);
+		}
+	}, [&] {
+		for (const Fields& key : probes) {
+			auto sample = bench.SampleOp();
+			int* value;
+			encodedR += encodedTree.get(Encoder::encode(key), value);
+		}
+	});
+	std::cout << "#   key bytes tuple " << sizeof(Fields) << " normalized " << sizeof(typename Encoder::Key) << "\n";
+	if (tupleR != encodedR || tupleTree.size() != encodedTree.size()) {
+		std::cout << "composite keys resulted in differences.\n";
+	}
+}
+
+// Secondary index keys (tenant, timestamp, id), with the tenant as an integer and as a short name.
+// Few tenants and clustered timestamps, so the comparisons usually reach the later fields.
+void composite_test(int N, int seed) {
+	typedef std::tuple<uint32_t, int64_t, uint64_t> IdFields;
+	typedef std::tuple<std::string, int64_t, uint64_t> NameFields;
+
+	std::mt19937_64 gen(seed);
+	std::vector<IdFields> ids;
+	ids.reserve(N);
+	for (int i = 0; i < N; ++i) {
+		ids.emplace_back(uint32_t(gen() % 16), int64_t(1700000000000LL + gen() % 100000), uint64_t(gen() % 1000));
+	}
+	std::vector<IdFields> idProbes = ids;
+	std::shuffle(idProbes.begin(), idProbes.end(), gen);
+	for (int i = 0; i < N; i += 2) {
+		std::get<2>(idProbes[i]) += 1000;
+	}
+
+	auto named = [](const IdFields& fields) {
+		return NameFields("tenant" + std::to_string(std::get<0>(fields)), std::get<1>(fields), std::get<2>(fields));
+	};
+	std::vector<NameFields> names;
+	std::vector<NameFields> nameProbes;
+	std::transform(ids.begin(), ids.end(), std::back_inserter(names), named);
+	std::transform(idProbes.begin(), idProbes.end(), std::back_inserter(nameProbes), named);
+
+	const std::string count = std::to_string(N / 1000) + "k";
+	time_composite<KeyEncoder<uint32_t, int64_t, uint64_t>>("Composite " + count, ids, idProbes);
+	// the names are at most 8 bytes, so the fixed width encoding keeps the order
+	time_composite<KeyEncoder<FixedString<8>, int64_t, uint64_t>>("Named " + count, names, nameProbes);
+}
+
+typedef std::tuple<std::string, int64_t, uint64_t> NamedKey;
+
+template<>
+struct KeyFingerprint<NamedKey> {
+	static uint8_t of(const NamedKey& key) {
+		const uint64_t hash = std::hash<std::string>()(std::get<0>(key)) ^ (uint64_t(std::get<1>(key)) * 31 + std::get<2>(key));
+		return uint8_t((hash * 0x9E3779B97F4A7C15ull) >> 56);
+	}
+};
+
+// Lookups in trees without (baseline) and with leaf fingerprints at several hit ratios, keys are inserted in
+// random order.
+template<typename KeyType, typename MakeKey>
+void time_fingerprints(const std::string& name, int N, int seed, MakeKey makeKey) {
+	Tree<KeyType, int, NodeSize> plain;
+	FingerprintTree<KeyType, int, NodeSize> printed;
+	std::mt19937 gen(seed);
+	std::vector<int> ids(N);
+	for (int i = 0; i < N; ++i) {
+		ids[i] = 2 * i;
+	}
+	std::shuffle(ids.begin(), ids.end(), gen);
+	for (int id : ids) {
+		plain.set(makeKey(id), nullptr);
+		printed.set(makeKey(id), nullptr);
+	}
+
+	for (int hitPercent : { 0, 50, 90, 100 }) {
+		// odd ids miss
+		std::vector<KeyType> probes;
+		probes.reserve(N);
+		for (int i = 0; i < N; ++i) {
+			probes.push_back(makeKey(ids[i] + (int(gen() % 100) < hitPercent ? 0 : 1)));
+		}
+		auto gets = [&](auto& tree, int& hits) {
+			return [&] {
+				for (const KeyType& key : probes) {
+					auto sample = bench.SampleOp();
+					int* value;
+					hits += tree.get(key, value);
+				}
+			};
+		};
+		int plainHits = 0;
+		int printedHits = 0;
+		bench_pair({ TestType::Get, NodeSize, N }, "Fingerprint " + name + " " + std::to_string(hitPercent) + "%",
+			gets(plain, plainHits), gets(printed, printedHits));
+		if (plainHits != printedHits) {
+			std::cout << "fingerprints resulted in differences.\n";
+		}
+	}
+}
+
+void fingerprint_test(int N, int seed) {
+	// a shared prefix, so comparisons of close keys run over several bytes
+	time_fingerprints<std::string>("string", N, seed, [](int id) { return "customer/" + std::to_string(id); });
+	time_fingerprints<NamedKey>("composite", N, seed, [](int id) {
+		return NamedKey("tenant" + std::to_string(id % 8), 1700000000000LL + id / 8 % 1000, uint64_t(id));
+	});
+}
+
+// Zipfian gets (theta 0.99, hashed keys) on the tree (baseline) against the tree behind hot key caches of
+// several sizes.
+void hot_cache_test(int N, int gets, int seed) {
+	std::vector<int> keys;
+	keys.reserve(N);
+	for (int id = 0; id < N; ++id) {
+		keys.push_back(wl::makeKey(id, true));
+	}
+	std::vector<int> probes;
+	probes.reserve(gets);
+	std::mt19937_64 gen(seed);
+	wl::ZipfianGenerator zipf(0.99);
+	zipf.grow(N);
+	for (int i = 0; i < gets; ++i) {
+		probes.push_back(keys[zipf.next(gen)]);
+	}
+
+	auto timedGets = [&](auto& tree) {
+		return [&] {
+			int found = 0;
+			for (int key : probes) {
+				auto sample = bench.SampleOp();
+				int* value;
+				found += tree.get(key, value);
+			}
+			if (found != gets) {
+				std::cout << "hot key cache resulted in differences.\n";
+			}
+		};
+	};
+
+	ImplTree plain;
+	for (int key : keys) {
+		plain.set(key, nullptr);
+	}
+	for (size_t slots : { 1 << 10, 1 << 14, 1 << 18 }) {
+		CachedTree<int, int, NodeSize> cached(slots);
+		for (int key : keys) {
+			cached.set(key, nullptr);
+		}
+		bench_pair({ TestType::Get, NodeSize, gets }, "Hot cache " + std::to_string(slots), timedGets(plain), timedGets(cached));
+		std::cout << "#   hit rate " << std::fixed << std::setprecision(3) << cached.hitRate() << "\n";
+	}
+}
+
+// Gets of get_test on the tree and on a frozen copy of it, then a full scan of both.
+void frozen_test(ImplTree& impl, int N, int seed) {
+	auto start = ch::steady_clock::now();
+	FrozenTree<int, int> frozen = impl.freeze();
+	const long long freezeUs = (long long)ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+
+	rd::seed(seed);
+	std::vector<int> numbers;
+	for (int i = 0; i < N; ++i) {
+		numbers.push_back(rd::get());
+	}
+
+	auto timeGets = [&](auto& tree, int& found) {
+		found = 0;
+		auto start = ch::steady_clock::now();
+		for (int number : numbers) {
+			int* num;
+			found += tree.get(number, num);
+		}
+		return (long long)ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+	};
+	auto timeScan = [](auto& tree, long long& sum) {
+		sum = 0;
+		auto start = ch::steady_clock::now();
+		for (auto it = tree.first(); it.isValid(); it.next()) {
+			sum += it.key();
+		}
+		return (long long)ch::duration_cast<ch::microseconds>(ch::steady_clock::now() - start).count();
+	};
+
+	int implFound, frozenFound;
+	long long implSum, frozenSum;
+	const long long implGet = timeGets(impl, implFound);
+	const long long frozenGet = timeGets(frozen, frozenFound);
+	const long long implScan = timeScan(impl, implSum);
+	const long long frozenScan = timeScan(frozen, frozenSum);
+	if (implFound != frozenFound || implSum != frozenSum) {
+		std::cout << "frozen tree resulted in differences.\n";
+	}
+	std::cout << "# Frozen " << frozen.size() / 1000 << "k keys, freeze " << freezeUs << " us, " << N / 1000 << "k gets tree "
+		<< implGet << " us frozen " << frozenGet << " us, scan tree " << implScan << " us frozen " << frozenScan
+		<< " us, bytes/key tree " << std::fixed << std::setprecision(1) << impl.stats().bytesPerKey()
+		<< " frozen " << double(frozen.allocatedBytes()) / std::max<size_t>(1, frozen.size()) << "\n";
+}
+
+// Learned segments against the inner nodes of a Tree (baseline) on the same 64 bit keys, evenly spread and
+// lognormal. The frozen copy of the tree is timed the same way, and built against the learned index.
+void learned_test(int N, int seed) {
+	std::mt19937_64 gen(seed);
+	std::lognormal_distribution<double> lognormal(0.0, 2.0);
+	for (bool skewed : { false, true }) {
+		std::vector<int64_t> keys;
+		keys.reserve(N);
+		for (int i = 0; i < N; ++i) {
+			keys.push_back(skewed ? int64_t(lognormal(gen) * 1e9) : int64_t(gen() >> 24));
+		}
+		std::vector<int64_t> probes;
+		probes.reserve(N);
+		for (int i = 0; i < N; ++i) {
+			// half hits, half misses
+			probes.push_back(i % 2 ? keys[gen() % keys.size()] : keys[gen() % keys.size()] + 1);
+		}
+
+		Tree<int64_t, int, NodeSize> tree;
+		for (int64_t key : keys) {
+			tree.set(key, nullptr);
+		}
+		const TreeStats stats = tree.stats();
+		const size_t innerBytes = stats.innerNodes * (stats.nodeBytes / (stats.leaves + stats.innerNodes));
+		const std::string name = skewed ? "lognormal" : "uniform";
+
+		std::optional<FrozenTree<int64_t, int>> frozen;
+		std::optional<LearnedIndex<int64_t, int>> learned;
+		bench_pair({ TestType::Add, NodeSize, int(tree.size()) }, "Learned build " + name,
+			[&] { frozen.emplace(tree.first(), tree.size()); },
+			[&] { learned.emplace(tree.first(), tree.size()); });
+
+		auto timedGets = [&](auto& index, int& found) {
+			return [&] {
+				for (int64_t probe : probes) {
+					auto sample = bench.SampleOp();
+					int* value;
+					found += index.get(probe, value);
+				}
+			};
+		};
+		int treeFound = 0;
+		int frozenFound = 0;
+		int learnedFound = 0;
+		bench_pair({ TestType::Get, NodeSize, N }, "Learned " + name, timedGets(tree, treeFound), timedGets(*learned, learnedFound));
+		std::cout << "#   inner bytes tree " << innerBytes << " learned " << learned->indexBytes() << " ("
+			<< learned->segmentCount() << " segments)\n";
+		treeFound = 0;
+		bench_pair({ TestType::Get, NodeSize, N }, "Frozen " + name, timedGets(tree, treeFound), timedGets(*frozen, frozenFound));
+		if (treeFound != frozenFound || treeFound != learnedFound) {
+			std::cout << "learned index resulted in differences.\n";
+		}
+	}
+}
+
+// Counting key occurrences: get followed by set (baseline) against upsert, which finds the slot once, and
+// against get with a set only for new keys. Keys come from a small range (mostly increments) and from a range
+// larger than N (mostly inserts).
+void counter_test(int N, int seed) {
+	struct Counters {
+		ImplTree tree;
+		std::vector<int> storage;
+	};
+	// the counter pattern as it is written without upsert, the value is written back every time
+	auto getSet = [](Counters& counters, int key) {
+		int* counter = nullptr;
+		if (!counters.tree.get(key, counter)) {
+			counters.storage.push_back(0);
+			counter = &counters.storage.back();
+		}
+		++*counter;
+		counters.tree.set(key, counter);
+	};
+	// a second descent only for new keys
+	auto getInsert = [](Counters& counters, int key) {
+		int* counter = nullptr;
+		if (counters.tree.get(key, counter)) {
+			++*counter;
+			return;
+		}
+		counters.storage.push_back(1);
+		counters.tree.set(key, &counters.storage.back());
+	};
+	auto upsert = [](Counters& counters, int key) {
+		counters.tree.upsert(key, [&](int*& counter, bool exists) {
+			if (!exists) {
+				counters.storage.push_back(0);
+				counter = &counters.storage.back();
+			}
+			++*counter;
+		});
+	};
+
+	for (int range : { N / 16, 4 * N }) {
+		std::mt19937 gen(seed);
+		std::uniform_int_distribution<int> dis(0, range - 1);
+		std::vector<int> keys;
+		keys.reserve(N);
+		for (int i = 0; i < N; ++i) {
+			keys.push_back(dis(gen));
+		}
+
+		auto counting = [&](Counters& counters, auto count) {
+			counters.storage.reserve(N);
+			return [&counters, &keys, count] {
+				for (int key : keys) {
+					auto sample = bench.SampleOp();
+					count(counters, key);
+				}
+			};
+		};
+		auto check = [](const Counters& base, const Counters& impl) {
+			if (base.storage.size() != base.tree.size() || impl.storage.size() != impl.tree.size()) {
+				std::cout << "counter test resulted in differences.\n";
+			}
+		};
+		const std::string keyCount = std::to_string(range / 1000) + "k";
+		{
+			Counters base, impl;
+			bench_pair({ TestType::Add, NodeSize, N }, "Upsert on " + keyCount, counting(base, getSet), counting(impl, upsert));
+			check(base, impl);
+		}
+		{
+			Counters base, impl;
+			bench_pair({ TestType::Add, NodeSize, N }, "Get/insert on " + keyCount, counting(base, getSet), counting(impl, getInsert));
+			check(base, impl);
+		}
+	}
+}
+
+// std::allocator that counts its allocations, only the key strings of key_move_test use it so the rest of the
+// benchmark allocates without the counter.
+template<typename T>
+struct CountingAllocator {
+	typedef T value_type;
+
+	static inline uint64_t count = 0;
+
+	CountingAllocator() = default;
+	template<typename U>
+	CountingAllocator(const CountingAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		count++;
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* memory, size_t n) {
+		std::allocator<T>().deallocate(memory, n);
+	}
+
+	template<typename U>
+	bool operator==(const CountingAllocator<U>&) const {
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const CountingAllocator<U>&) const {
+		return false;
+	}
+};
+
+// Inserts of string keys too long for the small string buffer: a copied key (baseline) against a moved key and
+// a key emplaced from its characters, with the key allocations per insert.
+void key_move_test(int N, int seed) {
+	typedef std::basic_string<char, std::char_traits<char>, CountingAllocator<char>> CountedString;
+	std::mt19937 gen(seed);
+	std::vector<CountedString> keys;
+	keys.reserve(N);
+	for (int i = 0; i < N; ++i) {
+		const std::string key = "customer/" + std::to_string(gen()) + "/orders";
+		keys.emplace_back(key.data(), key.size());
+	}
+
+	struct Inserts {
+		std::vector<CountedString> source;
+		Tree<CountedString, int, NodeSize> tree;
+		uint64_t allocations = 0;
+	};
+	auto inserting = [&](Inserts& run, auto insert) {
+		run.source = keys;
+		return [&run, insert] {
+			const uint64_t allocationsBefore = CountingAllocator<char>::count;
+			for (CountedString& key : run.source) {
+				auto sample = bench.SampleOp();
+				insert(run.tree, key);
+			}
+			run.allocations = CountingAllocator<char>::count - allocationsBefore;
+		};
+	};
+	auto copy = [](auto& tree, CountedString& key) { tree.set(key, nullptr); };
+	auto move = [](auto& tree, CountedString& key) { tree.set(std::move(key), nullptr); };
+	auto emplace = [](auto& tree, CountedString& key) { tree.emplace(nullptr, key.data(), key.size()); };
+	auto report = [&](const char* name, const Inserts& base, const Inserts& impl) {
+		std::cout << "#   allocs/insert copy " << std::fixed << std::setprecision(2) << double(base.allocations) / N
+			<< " " << name << " " << double(impl.allocations) / N << "\n";
+	};
+
+	const std::string count = std::to_string(N / 1000) + "k";
+	{
+		Inserts base, impl;
+		bench_pair({ TestType::Add, NodeSize, N }, "Key move " + count, inserting(base, copy), inserting(impl, move));
+		report("move", base, impl);
+	}
+	{
+		Inserts base, impl;
+		bench_pair({ TestType::Add, NodeSize, N }, "Key emplace " + count, inserting(base, copy), inserting(impl, emplace));
+		report("emplace", base, impl);
+	}
+}
+
+// Secondary index of N values over keys with zipfian popularity: a tree of composite (key, value) keys
+// (baseline) against posting lists, inserts, reading every key's values and bytes per value.
+void multimap_test(int N, int keys, int seed) {
+	std::mt19937_64 gen(seed);
+	wl::ZipfianGenerator zipf(0.99);
+	zipf.grow(keys);
+	std::vector<int> values(N);
+	std::vector<int> valueKeys;
+	valueKeys.reserve(N);
+	for (int i = 0; i < N; ++i) {
+		valueKeys.push_back(int(zipf.next(gen)));
+	}
+
+	// the value is part of the key, every value repeats its key
+	typedef std::pair<int, int> Composite;
+	Tree<Composite, int, NodeSize> composite;
+	MultiTree<int, int, NodeSize> multi;
+	const std::string count = std::to_string(N / 1000) + "k";
+	bench_pair({ TestType::Add, NodeSize, N }, "Multimap add " + count, [&] {
+		for (int i = 0; i < N; ++i) {
+			auto sample = bench.SampleOp();
+			composite.set(Composite(valueKeys[i], i), &values[i]);
+		}
+	}, [&] {
+		for (int i = 0; i < N; ++i) {
+			auto sample = bench.SampleOp();
+			multi.insert(valueKeys[i], &values[i]);
+		}
+	});
+
+	long long compositeSum = 0;
+	long long multiSum = 0;
+	bench_pair({ TestType::Iterate, NodeSize, keys }, "Multimap ranges " + std::to_string(keys / 1000) + "k", [&] {
+		for (int key = 0; key < keys; ++key) {
+			auto sample = bench.SampleOp();
+			auto it = composite.find(Composite(key, -1));
+			for (it.next(); it.isValid() && it.key().first == key; it.next()) {
+				compositeSum += it.value() - values.data();
+			}
+		}
+	}, [&] {
+		for (int key = 0; key < keys; ++key) {
+			auto sample = bench.SampleOp();
+			multi.forEachValue(key, [&](int* value) { multiSum += value - values.data(); });
+		}
+	});
+	std::cout << "#   bytes/value composite keys " << std::fixed << std::setprecision(1) << composite.stats().bytesPerKey()
+		<< " posting lists " << double(multi.allocatedBytes()) / N << "\n";
+	if (multiSum != compositeSum || multi.size() != composite.size()) {
+		std::cout << "multimap resulted in differences.\n";
+	}
+}
+
+// Range sum / min / max: the leaf scan of a plain tree (baseline) against aggregate(lo, hi) of an augmented one,
+// for growing range widths. Also shows what keeping the aggregates costs the inserts.
+void aggregate_test(int N, int seed) {
+	typedef StatsOf<long long> Stats;
+	std::mt19937_64 gen(seed);
+	std::vector<int> keys(N);
+	for (int i = 0; i < N; ++i) {
+		keys[i] = i;
+	}
+	std::shuffle(keys.begin(), keys.end(), gen);
+	std::vector<long long> values(N);
+	for (long long& value : values) {
+		value = (long long)(gen() % 100000);
+	}
+
+	Tree<int, long long, NodeSize> plain;
+	AugmentedTree<int, long long, Stats, NodeSize> augmented;
+	bench_pair({ TestType::Add, NodeSize, N }, "Aggregate add " + std::to_string(N / 1000) + "k", [&] {
+		for (int i = 0; i < N; ++i) {
+			auto sample = bench.SampleOp();
+			plain.set(keys[i], &values[i]);
+		}
+	}, [&] {
+		for (int i = 0; i < N; ++i) {
+			auto sample = bench.SampleOp();
+			augmented.set(keys[i], &values[i]);
+		}
+	});
+
+	bool differences = false;
+	for (int width : { 10, 100, 1000, 10000, 100000, N }) {
+		if (width > N) {
+			continue;
+		}
+		// about the same number of scanned entries for every width
+		const int queries = std::max(20, std::min(100000, 20000000 / width));
+		std::vector<int> from(queries);
+		for (int& lo : from) {
+			lo = int(gen() % (N - width + 1));
+		}
+
+		Stats::type scanned;
+		Stats::type aggregated;
+		bench_pair({ TestType::Get, NodeSize, queries }, "Range width " + std::to_string(width), [&] {
+			for (int lo : from) {
+				auto sample = bench.SampleOp();
+				auto it = plain.find(lo);
+				if (!it.exists) {
+					it.next();
+				}
+				for (; it.isValid() && it.key() < lo + width; it.next()) {
+					scanned = Stats::combine(scanned, Stats::of(it.key(), it.value()));
+				}
+			}
+		}, [&] {
+			for (int lo : from) {
+				auto sample = bench.SampleOp();
+				aggregated = Stats::combine(aggregated, augmented.aggregate(lo, lo + width - 1));
+			}
+		});
+		differences = differences || scanned.sum != aggregated.sum || scanned.count != aggregated.count
+			|| scanned.min != aggregated.min || scanned.max != aggregated.max;
+	}
+	if (differences) {
+		std::cout << "Aggregates resulted in differences.\n";
+	}
 }
 
-void add_items(LedaTree& leda, ImplTree& impl, int count) {
+// The tests of tree variants against the plain tree. They do not depend on the baseline, so they run once per
+// run instead of once per --baseline.
+void run_variant_tests() {
+	bench.SetBaseline("tree");
+#ifndef _DEBUG
+	int seed = 100;
+	composite_test(1000000, ++seed);
+	fingerprint_test(500000, ++seed);
+	hot_cache_test(1000000, 5000000, ++seed);
+	learned_test(1000000, ++seed);
+	counter_test(1000000, ++seed);
+	key_move_test(500000, ++seed);
+	multimap_test(2000000, 100000, ++seed);
+	aggregate_test(1000000, ++seed);
+#endif
+}
+
+template<typename Baseline>
+void add_items(Baseline& base, ImplTree& impl, int count) {
 	for (int i = 0; i < count; ++i) {
-		leda.insert(i, nullptr);
+		base.insert(i, nullptr);
 		impl.set(i, nullptr);
 	}
 }
 
-int main() {
-	LedaTree ledaDic(NodeSize / 2, NodeSize);
-	ImplTree implDic;
-	std::cout << "Memory size of Node: " << sizeof(ImplTree::TNode) << "\n";
+// Runs the operation stream on one of our trees, opValues[i] is the value written by ops[i].
+// Returns the checksum of everything read.
+template<typename TreeType>
+int apply_ops(TreeType& impl, const std::vector<wl::Operation>& ops, int* const* opValues, bool sample) {
+	int implR = 0;
+	for (size_t i = 0; i < ops.size(); ++i) {
+		auto opSample = sample ? bench.SampleOp() : Benchmark::OpSample(nullptr);
+		const wl::Operation& op = ops[i];
+		switch (op.type) {
+		case wl::OpType::Read: {
+			int* num;
+			if (impl.get(op.key, num)) {
+				implR ^= *num;
+			}
+			break;
+		}
+		case wl::OpType::Update:
+		case wl::OpType::Insert:
+			impl.set(op.key, opValues[i]);
+			break;
+		case wl::OpType::Scan: {
+			typename TreeType::Iterator it = impl.find(op.key);
+			if (!it.exists) {
+				break;
+			}
+			for (int n = 0; it.isValid() && n < op.scanLength; ++n, ++it) {
+				implR ^= it.key();
+			}
+			break;
+		}
+		case wl::OpType::ReadModifyWrite: {
+			int* num;
+			if (impl.get(op.key, num)) {
+				implR ^= *num;
+				impl.set(op.key, opValues[i]);
+			}
+			break;
+		}
+		}
+	}
+	return implR;
+}
 
-	rd::setMax(2 * 1000 * 1000);
+// Loads the records untimed, then runs the generated operation stream on both trees.
+template<typename Baseline>
+void run_workload(Baseline& base, ImplTree& impl, const wl::Workload& load, std::vector<int*>& outPtrs) {
+	const std::vector<int>& keys = load.loadKeys;
+	const std::vector<wl::Operation>& ops = load.ops;
+
+	// one value per loaded record and one per operation so no allocation happens in the timed loops
+	size_t firstLoadPtr = outPtrs.size();
+	for (int key : keys) {
+		outPtrs.push_back(new int(key));
+	}
+	size_t firstOpPtr = outPtrs.size();
+	for (const wl::Operation& op : ops) {
+		outPtrs.push_back(new int(op.key));
+	}
 
-	std::vector<int*> ptrs;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		base.insert(keys[i], outPtrs[firstLoadPtr + i]);
+		impl.set(keys[i], outPtrs[firstLoadPtr + i]);
+	}
 
+	int baseR = 0;
+	int implR = 0;
+
+	bench.StartTest();
+	for (size_t i = 0; i < ops.size(); ++i) {
+		auto sample = bench.SampleOp();
+		const wl::Operation& op = ops[i];
+		switch (op.type) {
+		case wl::OpType::Read: {
+			int* num;
+			if (base.lookup(op.key, num)) {
+				baseR ^= *num;
+			}
+			break;
+		}
+		case wl::OpType::Update:
+		case wl::OpType::Insert:
+			base.insert(op.key, outPtrs[firstOpPtr + i]);
+			break;
+		case wl::OpType::Scan:
+			base.scan(op.key, op.scanLength, [&](int key) {
+				baseR ^= key;
+			});
+			break;
+		case wl::OpType::ReadModifyWrite: {
+			int* num;
+			if (base.lookup(op.key, num)) {
+				baseR ^= *num;
+				base.insert(op.key, outPtrs[firstOpPtr + i]);
+			}
+			break;
+		}
+		}
+	}
+	bench.StopBaseline();
+
+	bench.StartTest();
+	implR = apply_ops(impl, ops, &outPtrs[firstOpPtr], true);
+	bench.StopImpl();
+	bench.PrintLast({ TestType::Workload, NodeSize, int(ops.size()) }, "YCSB " + load.spec.name + " " + std::to_string(ops.size() / 1000) + "k");
+	print_tree_stats(impl);
+
+	// unordered baselines scan in a different order
+	if (baseR != implR && (Baseline::Ordered || load.spec.mix.scan == 0)) {
+		std::cout << "workload resulted in differences.\n";
+	}
+}
+
+// The default add / get / delete sequence on fresh trees.
+template<typename Baseline>
+void run_default(std::vector<int*>& ptrs) {
+	Baseline baseDic;
+	ImplTree implDic;
+
+	rd::setMax(2 * 1000 * 1000);
 
 	int seed = 0;
 #ifndef _DEBUG
-	add_test	(ledaDic, implDic, 1000000, ++seed, ptrs);
-	get_test	(ledaDic, implDic, 1000000, ++seed);
-	delete_ex   (ledaDic, implDic,  500000, ++seed); 
-
-	add_test	(ledaDic, implDic, 1000000, ++seed, ptrs);
-	get_test	(ledaDic, implDic, 1000000, ++seed);
-	delete_test (ledaDic, implDic, 1000000, ++seed);
-	add_test	(ledaDic, implDic,  500000, ++seed, ptrs);
-	get_test	(ledaDic, implDic,  500000, ++seed);
-	delete_test (ledaDic, implDic,  500000, ++seed);
-
-	add_items   (ledaDic, implDic, 50 * 1000 * 1000);
-	iterate_all (ledaDic, implDic);
-	delete_ex   (ledaDic, implDic, 500000, ++seed);
+	add_test	(baseDic, implDic, 1000000, ++seed, ptrs);
+	get_test	(baseDic, implDic, 1000000, ++seed);
+	frozen_test (implDic, 1000000, seed);
+	delete_ex   (baseDic, implDic,  500000, ++seed); 
+
+	add_test	(baseDic, implDic, 1000000, ++seed, ptrs);
+	get_test	(baseDic, implDic, 1000000, ++seed);
+	delete_test (baseDic, implDic, 1000000, ++seed);
+	add_test	(baseDic, implDic,  500000, ++seed, ptrs);
+	get_test	(baseDic, implDic,  500000, ++seed);
+	delete_test (baseDic, implDic,  500000, ++seed);
+	compact_test(implDic, 64);
+
+	append_test<Baseline>(1000000, ptrs);
+	walk_test<Baseline>(1000000, 64, 1);
+	packed_test<Baseline>(1000000, ++seed);
+
+	add_items   (baseDic, implDic, 50 * 1000 * 1000);
+	std::cout << "#   leaf fill factor after add_items " << std::fixed << std::setprecision(3) << implDic.fillFactor() << "\n";
+	print_tree_stats(implDic);
+	iterate_all (baseDic, implDic);
+	delete_ex   (baseDic, implDic, 500000, ++seed);
 #else // in debug just run some basic stuff because all the tests take too much time
-	add_test(ledaDic, implDic, 2000000, 0, ptrs);
-	delete_test(ledaDic, implDic, 1000000, 11);
-	get_test(ledaDic, implDic, 2000000, 1);
+	add_test(baseDic, implDic, 2000000, 0, ptrs);
+	delete_test(baseDic, implDic, 1000000, 11);
+	get_test(baseDic, implDic, 2000000, 1);
 #endif
+}
+
+// Runs the workload (or the default sequence when there is none) against 1 baseline.
+template<typename Baseline>
+void run_with(const wl::Workload* load, std::vector<int*>& ptrs) {
+	bench.SetBaseline(Baseline::Name());
+	if (load) {
+		Baseline baseDic;
+		ImplTree implDic;
+		run_workload(baseDic, implDic, *load, ptrs);
+	}
+	else {
+		run_default<Baseline>(ptrs);
+	}
+}
+
+// Loads the records and runs the ops on a fresh tree, keeps the fastest of repeat runs.
+template<typename TreeType>
+void time_tree(TreeType& impl, const std::vector<int>& keys, const std::vector<wl::Operation>& ops,
+	const std::vector<int*>& values, long long& loadUs, long long& opsUs, int& checksum) {
+	auto start = ch::steady_clock::now();
+	for (size_t i = 0; i < keys.size(); ++i) {
+		impl.set(keys[i], values[i]);
+	}
+	auto loaded = ch::steady_clock::now();
+	checksum = apply_ops(impl, ops, &values[keys.size()], false);
+	auto done = ch::steady_clock::now();
+	loadUs = ch::duration_cast<ch::microseconds>(loaded - start).count();
+	opsUs = ch::duration_cast<ch::microseconds>(done - loaded).count();
+}
+
+// Sweeps the node capacity of DynTree over a sample of the workload (all records, the first sampleOps operations).
+// The compile time NodeSize tree is timed too, as the reference for what the runtime capacity costs.
+void autotune(const wl::Workload& load, const std::vector<int>& capacities, size_t sampleOps, int repeat) {
+	const std::vector<int>& keys = load.loadKeys;
+	std::vector<wl::Operation> ops(load.ops.begin(), load.ops.begin() + std::min(sampleOps, load.ops.size()));
 
-	for (auto p : ptrs) {
+	std::vector<int*> values;
+	for (int key : keys) {
+		values.push_back(new int(key));
+	}
+	for (const wl::Operation& op : ops) {
+		values.push_back(new int(op.key));
+	}
+
+	std::cout << "Autotune: " << keys.size() << " records, " << ops.size() << " ops, best of " << repeat << "\n";
+	std::cout << std::left << std::setw(16) << "capacity" << std::right << std::setw(12) << "node bytes"
+		<< std::setw(14) << "load us" << std::setw(14) << "ops us" << std::setw(12) << "ns/op" << "\n";
+
+	auto row = [&](const std::string& name, size_t nodeBytes, long long loadUs, long long opsUs) {
+		std::cout << std::left << std::setw(16) << name << std::right << std::setw(12) << nodeBytes
+			<< std::setw(14) << loadUs << std::setw(14) << opsUs
+			<< std::setw(12) << std::fixed << std::setprecision(1) << (ops.empty() ? 0.0 : opsUs * 1000.0 / ops.size()) << "\n";
+	};
+
+	int reference = 0;
+	int best = 0;
+	long long bestUs = -1;
+	for (int capacity : capacities) {
+		long long loadUs = -1, opsUs = -1;
+		size_t nodeBytes = 0;
+		for (int r = 0; r < repeat; ++r) {
+			DynTree<int, int> impl(capacity);
+			long long l, o;
+			int checksum;
+			time_tree(impl, keys, ops, values, l, o, checksum);
+			loadUs = loadUs < 0 ? l : std::min(loadUs, l);
+			opsUs = opsUs < 0 ? o : std::min(opsUs, o);
+			nodeBytes = impl.root->allocatedBytes();
+			if (capacity == capacities.front() && r == 0) {
+				reference = checksum;
+			}
+			else if (checksum != reference) {
+				std::cout << "autotune resulted in differences at capacity " << capacity << ".\n";
+			}
+		}
+		row(std::to_string(capacity), nodeBytes, loadUs, opsUs);
+		if (bestUs < 0 || loadUs + opsUs < bestUs) {
+			bestUs = loadUs + opsUs;
+			best = capacity;
+		}
+	}
+
+	long long loadUs = -1, opsUs = -1;
+	for (int r = 0; r < repeat; ++r) {
+		ImplTree impl;
+		long long l, o;
+		int checksum;
+		time_tree(impl, keys, ops, values, l, o, checksum);
+		loadUs = loadUs < 0 ? l : std::min(loadUs, l);
+		opsUs = opsUs < 0 ? o : std::min(opsUs, o);
+	}
+	row(std::to_string(NodeSize) + " (static)", sizeof(ImplTree::TNode), loadUs, opsUs);
+
+	std::cout << "Best capacity: " << best << " (load + ops " << bestUs << " us)\n";
+
+	for (int* p : values) {
 		delete p;
 	}
+}
+
+// Write throughput of ShardedTree against a single Tree behind one mutex, for every thread count.
+// Uniform keys start spread over 4 shards per thread. Narrow keys all fall in 1 of those shards and only scale
+// once the automatic rebalance split it.
+void thread_scaling(const std::vector<int>& threadCounts, size_t totalOps) {
+	const int maxThreads = *std::max_element(threadCounts.begin(), threadCounts.end());
+	const int initialShards = 4 * maxThreads;
+	std::vector<int> separators;
+	for (int i = 1; i < initialShards; ++i) {
+		separators.push_back(int((long long)INT32_MAX * i / initialShards));
+	}
+
+	std::cout << "Thread scaling: " << totalOps << " inserts, " << initialShards << " initial shards, "
+		<< std::thread::hardware_concurrency() << " hardware threads\n";
+	std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(16) << "mutex Mops/s"
+		<< std::setw(18) << "sharded Mops/s" << std::setw(24) << "sharded narrow Mops/s" << std::setw(16) << "shards after" << "\n";
+
+	// every thread inserts its own slice of keys
+	auto timeThreads = [&](int threads, auto insert) {
+		auto start = ch::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t] {
+				Benchmark::IgnoreBlocks = true;
+				std::mt19937 gen(t + 1);
+				std::uniform_int_distribution<int> dis(0, INT32_MAX - 1);
+				for (size_t i = t; i < totalOps; i += threads) {
+					insert(dis(gen));
+				}
+			});
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		const double seconds = ch::duration<double>(ch::steady_clock::now() - start).count();
+		return totalOps / seconds / 1e6;
+	};
+
+	for (int threads : threadCounts) {
+		ImplTree single;
+		std::mutex singleLock;
+		const double mutexRate = timeThreads(threads, [&](int key) {
+			std::lock_guard<std::mutex> guard(singleLock);
+			single.set(key, nullptr);
+		});
+
+		ShardedTree<int, int, NodeSize> sharded(separators);
+		const double shardedRate = timeThreads(threads, [&](int key) {
+			sharded.set(key, nullptr);
+		});
+
+		ShardedTree<int, int, NodeSize> narrow(separators);
+		narrow.setAutoRebalance(1 << 14);
+		const double narrowRate = timeThreads(threads, [&](int key) {
+			narrow.set(key / initialShards, nullptr);
+		});
+
+		std::cout << std::left << std::setw(10) << threads << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(16) << mutexRate << std::setw(18) << shardedRate << std::setw(24) << narrowRate
+			<< std::setw(16) << narrow.shardCount() << "\n";
+	}
+}
+
+// Write throughput of a Tree behind flat combining against the same Tree behind one mutex, for every thread count.
+// Every thread sets random keys of a 1m range and removes every 4th one again, so the tree stays the same size.
+void combining_scaling(const std::vector<int>& threadCounts, size_t totalOps) {
+	constexpr int KeyRange = 1000000;
+
+	std::cout << "Flat combining: " << totalOps << " sets / removes, " << std::thread::hardware_concurrency()
+		<< " hardware threads\n";
+	std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(16) << "mutex Mops/s"
+		<< std::setw(20) << "combining Mops/s" << std::setw(16) << "avg batch" << "\n";
+
+	auto timeThreads = [&](int threads, auto set, auto remove) {
+		auto start = ch::steady_clock::now();
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t] {
+				Benchmark::IgnoreBlocks = true;
+				std::mt19937 gen(t + 1);
+				std::uniform_int_distribution<int> dis(0, KeyRange - 1);
+				for (size_t i = t; i < totalOps; i += threads) {
+					const int key = dis(gen);
+					if (i % 4 == 3) {
+						remove(key);
+					}
+					else {
+						set(key);
+					}
+				}
+			});
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		const double seconds = ch::duration<double>(ch::steady_clock::now() - start).count();
+		return totalOps / seconds / 1e6;
+	};
+
+	for (int threads : threadCounts) {
+		ImplTree single;
+		std::mutex singleLock;
+		const double mutexRate = timeThreads(threads,
+			[&](int key) {
+				std::lock_guard<std::mutex> guard(singleLock);
+				single.set(key, nullptr);
+			},
+			[&](int key) {
+				std::lock_guard<std::mutex> guard(singleLock);
+				single.remove(key);
+			});
+
+		CombiningTree<int, int, NodeSize> combining;
+		const double combiningRate = timeThreads(threads,
+			[&](int key) { combining.set(key, nullptr); },
+			[&](int key) { combining.remove(key); });
+
+		std::cout << std::left << std::setw(10) << threads << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(16) << mutexRate << std::setw(20) << combiningRate
+			<< std::setw(16) << double(combining.combinedOps()) / std::max<uint64_t>(1, combining.batches()) << "\n";
+	}
+}
+
+// The add_test inserts on a DurableTree logging to directory, for every fdatasync interval (0 never syncs),
+// against the plain tree. Then the time open() takes to recover them from the log.
+void wal_scaling(const std::vector<int>& syncIntervals, size_t totalOps, const std::string& directory) {
+	rd::seed(1);
+	std::vector<int> numbers;
+	numbers.reserve(totalOps);
+	for (size_t i = 0; i < totalOps; ++i) {
+		numbers.push_back(rd::get());
+	}
+
+	auto timeSets = [&](auto& tree) {
+		auto start = ch::steady_clock::now();
+		for (int& number : numbers) {
+			tree.set(number, &number);
+		}
+		return ch::duration<double>(ch::steady_clock::now() - start).count();
+	};
+	auto removeFiles = [&] {
+		for (const char* name : { "/wal.log", "/checkpoint", "/checkpoint.tmp" }) {
+			unlink((directory + name).c_str());
+		}
+	};
+
+	ImplTree plain;
+	const double plainSeconds = timeSets(plain);
+	std::cout << "Write ahead log: " << totalOps << " sets in " << directory << ", plain tree "
+		<< std::fixed << std::setprecision(2) << totalOps / plainSeconds / 1e6 << " Mops/s\n";
+	std::cout << std::left << std::setw(16) << "sync interval" << std::right << std::setw(12) << "Mops/s"
+		<< std::setw(12) << "overhead" << std::setw(12) << "syncs" << std::setw(16) << "recovery ms" << "\n";
+
+	for (int interval : syncIntervals) {
+		removeFiles();
+		DurabilityOptions durability;
+		durability.syncInterval = uint(interval);
+		double seconds;
+		uint64_t syncs;
+		{
+			DurableTree<int, int, NodeSize> durable(durability);
+			if (!durable.open(directory)) {
+				std::cerr << "Could not open " << directory << ": " << durable.lastError() << "\n";
+				return;
+			}
+			seconds = timeSets(durable);
+			syncs = durable.syncCount();
+		}
+
+		auto start = ch::steady_clock::now();
+		DurableTree<int, int, NodeSize> recovered;
+		const bool opened = recovered.open(directory);
+		const double recoveryMs = ch::duration<double, std::milli>(ch::steady_clock::now() - start).count();
+		if (!opened || recovered.size() != plain.size()) {
+			std::cout << "write ahead log resulted in differences.\n";
+		}
+
+		std::cout << std::left << std::setw(16) << interval << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(12) << totalOps / seconds / 1e6 << std::setw(11) << (seconds / plainSeconds - 1) * 100 << "%"
+			<< std::setw(12) << syncs << std::setw(16) << recoveryMs << "\n";
+	}
+	removeFiles();
+	rmdir(directory.c_str());
+}
+
+// Returns false for unknown baseline names. With dryRun only the name is checked.
+bool run_baseline(const std::string& name, const wl::Workload* load, std::vector<int*>& ptrs, bool dryRun = false) {
+	void (*run)(const wl::Workload*, std::vector<int*>&) = nullptr;
+	if (name == "map")					run = run_with<MapBaseline>;
+	else if (name == "unordered_map")	run = run_with<UnorderedMapBaseline>;
+	else if (name == "vector")			run = run_with<SortedVectorBaseline>;
+#ifdef USE_LEDA
+	else if (name == "leda")			run = run_with<LedaBaseline<NodeSize>>;
+#endif
+	else return false;
+
+	if (!dryRun) {
+		run(load, ptrs);
+	}
+	return true;
+}
+
+// Options that control the harness itself, everything else is handed to the workload parser.
+struct RunOptions {
+	bool usePerf = true;
+	int repeat = 1;
+	std::string jsonPath;
+	std::string csvPath;
+	std::string comparePath;
+	double threshold = 0.05;
+	std::string ioSim;
+	std::vector<int> autotune;
+	size_t autotuneOps = 200000;
+	std::vector<int> threads;
+	std::vector<int> combining;
+	std::vector<int> walIntervals;
+	std::string walDir = "wal_bench";
+#ifdef USE_LEDA
+	std::vector<std::string> baselines = { "leda" };
+#else
+	std::vector<std::string> baselines = { "map" };
+#endif
+
+	bool apply(const std::string& arg) {
+		auto value = [&](const char* name, std::string& out) {
+			std::string prefix = std::string(name) + "=";
+			if (arg.compare(0, prefix.size(), prefix) != 0) {
+				return false;
+			}
+			out = arg.substr(prefix.size());
+			return true;
+		};
+		std::string v;
+		if (arg == "--no-perf")					usePerf = false;
+		else if (value("--repeat", v))			repeat = std::max(1, std::atoi(v.c_str()));
+		else if (value("--json", jsonPath))		{}
+		else if (value("--csv", csvPath))		{}
+		else if (value("--compare", comparePath)) {}
+		else if (value("--threshold", v))		threshold = std::atof(v.c_str()) / 100.0;
+		else if (value("--baseline", v))		setBaselines(v);
+		else if (value("--io-sim", ioSim))		{}
+		else if (arg == "--autotune")			autotune = { 8, 16, 32, 48, 64, 96, 128, 192, 256, 512 };
+		else if (value("--autotune", v))		setList(v, autotune);
+		else if (value("--autotune-ops", v))	autotuneOps = size_t(std::max(1LL, std::atoll(v.c_str())));
+		else if (arg == "--threads")			threads = { 1, 2, 4, 8 };
+		else if (value("--threads", v))			setList(v, threads);
+		else if (arg == "--combining")			combining = { 2, 4, 8, 16, 32, 64 };
+		else if (value("--combining", v))		setList(v, combining);
+		else if (arg == "--wal")				walIntervals = { 1, 16, 256, 4096, 0 };
+		else if (value("--wal", v))				setList(v, walIntervals);
+		else if (value("--wal-dir", walDir))	{}
+		else return false;
+		return true;
+	}
+
+	void setBaselines(const std::string& list) {
+		baselines.clear();
+		if (list == "all") {
+#ifdef USE_LEDA
+			baselines.push_back("leda");
+#endif
+			baselines.push_back("map");
+			baselines.push_back("unordered_map");
+			return;
+		}
+		std::stringstream ss(list);
+		std::string name;
+		while (std::getline(ss, name, ',')) {
+			baselines.push_back(name);
+		}
+	}
+
+	static void setList(const std::string& list, std::vector<int>& out) {
+		out.clear();
+		std::stringstream ss(list);
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			out.push_back(std::atoi(item.c_str()));
+		}
+	}
+
+	static void printUsage(std::ostream& out) {
+		out << "  --baseline=NAME[,NAME..]    leda (if built with LEDA), map, unordered_map, vector or all\n"
+			"                              (all skips vector, its inserts are O(n))\n"
+			"  --io-sim=lru:4096:1000[,clock:65536:100..]  simulate cache levels (policy:block bytes:blocks)\n"
+			"                              for the tree's block accesses and report misses per level\n"
+			"  --no-perf                   do not open hardware counters\n"
+			"  --repeat=N                  run everything N times, results are aggregated as min / median\n"
+			"  --json=FILE --csv=FILE      write every test to FILE\n"
+			"  --compare=FILE              compare against a CSV written by --csv, exits with 2 on regressions\n"
+			"  --threshold=5               median slowdown in % that counts as a regression\n"
+			"  --autotune[=16,32,..]       instead of the benchmark, time the tree with each node capacity\n"
+			"                              on the workload and report the fastest (best of --repeat)\n"
+			"  --autotune-ops=200000       operations of the workload used by --autotune\n"
+			"  --threads[=1,2,4,8]         instead of the benchmark, write throughput of ShardedTree per thread count\n"
+			"                              (--ops inserts in total)\n"
+			"  --combining[=2,4,..,64]     instead of the benchmark, write throughput of the flat combining tree\n"
+			"                              against a mutex per thread count (--ops operations in total)\n"
+			"  --wal[=1,16,..,4096,0]      instead of the benchmark, --ops inserts on the tree with a write ahead log\n"
+			"                              per fdatasync interval in records (0 never syncs) and the recovery time\n"
+			"  --wal-dir=wal_bench         directory of the log written by --wal, removed after the run\n";
+	}
+};
+
+int main(int argc, char** argv) {
+	wl::Spec spec;
+	RunOptions options;
+	bool useWorkload = false;
+	for (int i = 1; i < argc; ++i) {
+		if (options.apply(argv[i])) {
+			continue;
+		}
+		if (!wl::applyOption(spec, argv[i])) {
+			std::cerr << "Unknown option: " << argv[i] << "\n";
+			wl::printUsage(std::cerr);
+			RunOptions::printUsage(std::cerr);
+			return 1;
+		}
+		useWorkload = true;
+	}
+
+	if (!spec.mix.valid()) {
+		std::cerr << "Operation ratios must not all be 0\n";
+		return 1;
+	}
+	for (int capacity : options.autotune) {
+		if (capacity < 3) {
+			std::cerr << "Node capacity must be at least 3: " << capacity << "\n";
+			return 1;
+		}
+	}
+	for (const std::vector<int>* counts : { &options.threads, &options.combining }) {
+		for (int count : *counts) {
+			if (count < 1) {
+				std::cerr << "Thread count must be at least 1: " << count << "\n";
+				return 1;
+			}
+		}
+	}
+	for (int interval : options.walIntervals) {
+		if (interval < 0) {
+			std::cerr << "Sync interval must not be negative: " << interval << "\n";
+			return 1;
+		}
+	}
+	if (!options.threads.empty()) {
+		thread_scaling(options.threads, spec.operationCount);
+		return 0;
+	}
+	if (!options.combining.empty()) {
+		combining_scaling(options.combining, spec.operationCount);
+		return 0;
+	}
+	if (!options.walIntervals.empty()) {
+		wal_scaling(options.walIntervals, spec.operationCount, options.walDir);
+		return 0;
+	}
+	if (!options.autotune.empty()) {
+		wl::Workload load(spec);
+		load.generate();
+		wl::printSpec(std::cout, spec);
+		autotune(load, options.autotune, options.autotuneOps, options.repeat);
+		return 0;
+	}
+
+	std::vector<int*> unused;
+	for (const std::string& name : options.baselines) {
+		if (!run_baseline(name, nullptr, unused, true)) {
+			std::cerr << "Unknown baseline: " << name << "\n";
+			RunOptions::printUsage(std::cerr);
+			return 1;
+		}
+	}
+
+	std::vector<TestRecord> baseline;
+	if (!options.comparePath.empty()) {
+		std::ifstream in(options.comparePath);
+		if (!results::ReadCsv(in, baseline)) {
+			std::cerr << "Could not read baseline results from " << options.comparePath << "\n";
+			return 1;
+		}
+	}
+
+	if (!options.ioSim.empty()) {
+		std::unique_ptr<IoSimulator> sim = IoSimulator::Parse(options.ioSim);
+		if (!sim) {
+			std::cerr << "Malformed --io-sim: " << options.ioSim << "\n";
+			return 1;
+		}
+		bench.SetIoSimulator(std::move(sim));
+	}
+
+	std::cout << "Memory size of Node: " << sizeof(ImplTree::TNode) << "\n";
+
+	if (options.usePerf && !bench.EnableCounters()) {
+		std::cout << "Hardware counters disabled (" << bench.CountersError() << ")\n";
+	}
+
+	wl::Workload load(spec);
+	if (useWorkload) {
+		load.generate();
+		wl::printSpec(std::cout, spec);
+	}
+
+	for (int run = 0; run < options.repeat; ++run) {
+		if (run > 0) {
+			bench.NextRun();
+			std::cout << "\nRun " << run + 1 << "/" << options.repeat << "\n";
+		}
+
+		for (const std::string& name : options.baselines) {
+			std::vector<int*> ptrs;
+			run_baseline(name, useWorkload ? &load : nullptr, ptrs);
+
+			for (auto p : ptrs) {
+				delete p;
+			}
+		}
+		if (!useWorkload) {
+			run_variant_tests();
+		}
+	}
 
 	bench.Print();
 	timer.Print("Generic Timer");
 
+	std::vector<TestRecord> records = bench.Records();
+	std::vector<AggregatedTest> aggregated = results::Aggregate(records);
+	if (bench.RunCount() > 1) {
+		results::PrintAggregated(aggregated);
+	}
+
+	if (!options.jsonPath.empty()) {
+		std::ofstream out(options.jsonPath);
+		results::WriteJson(out, records);
+	}
+	if (!options.csvPath.empty()) {
+		std::ofstream out(options.csvPath);
+		results::WriteCsv(out, records);
+	}
+
+	if (!baseline.empty()) {
+		int regressions = results::Compare(results::Aggregate(baseline), aggregated, options.threshold);
+		if (regressions > 0) {
+			std::cout << regressions << " regression(s) found.\n";
+			return 2;
+		}
+	}
+
 	return 0;
 }
 #endif
\ No newline at end of file
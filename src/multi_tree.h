@@ -0,0 +1,316 @@
+#ifndef __MULTI_TREE_H_
+#define __MULTI_TREE_H_
+
+#include "tree.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+//
+// Values of one key of a MultiTree, in no particular order. The first InlineCount sit in the list itself
+// (the list is 1 cache line with the defaults), the rest in chunks of ChunkSize that are never moved, so growing
+// a long list copies nothing. Removing swaps the last value into the hole.
+//
+template<typename DataType, int InlineCount = 4, int ChunkSize = 64>
+struct PostingList {
+	uint count = 0;
+	DataType* inlineValues[InlineCount];
+	std::vector<std::unique_ptr<DataType*[]>> chunks;
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	DataType* operator[](size_t index) const {
+		if (index < InlineCount) {
+			return inlineValues[index];
+		}
+		index -= InlineCount;
+		return chunks[index / ChunkSize][index % ChunkSize];
+	}
+
+	// f(value) for every value, a plain loop per block.
+	template<typename F>
+	void forEach(F f) const {
+		const size_t inlined = std::min<size_t>(count, InlineCount);
+		for (size_t i = 0; i < inlined; ++i) {
+			f(inlineValues[i]);
+		}
+		for (size_t left = count - inlined, chunk = 0; left > 0; ++chunk) {
+			const size_t inChunk = std::min<size_t>(left, ChunkSize);
+			for (size_t i = 0; i < inChunk; ++i) {
+				f(chunks[chunk][i]);
+			}
+			left -= inChunk;
+		}
+	}
+
+	void push(DataType* value) {
+		const size_t index = count;
+		if (index >= InlineCount && (index - InlineCount) % ChunkSize == 0) {
+			chunks.emplace_back(new DataType*[ChunkSize]);
+		}
+		at(index) = value;
+		count++;
+	}
+
+	// Removes 1 occurrence of value, returns false if there is none.
+	bool remove(DataType* value) {
+		for (size_t i = 0; i < count; ++i) {
+			if (at(i) == value) {
+				at(i) = at(count - 1);
+				count--;
+				if (count >= InlineCount && (count - InlineCount) % ChunkSize == 0) {
+					chunks.pop_back();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t allocatedBytes() const {
+		return sizeof(PostingList) + chunks.capacity() * sizeof(chunks[0]) + chunks.size() * ChunkSize * sizeof(DataType*);
+	}
+
+private:
+	DataType*& at(size_t index) {
+		if (index < InlineCount) {
+			return inlineValues[index];
+		}
+		index -= InlineCount;
+		return chunks[index / ChunkSize][index % ChunkSize];
+	}
+};
+
+//
+// Multimap on top of Tree for secondary indexes: every key is stored once in the tree and its leaf entry points
+// to the PostingList of all its values, instead of 1 (key, value) entry per value that repeats the key.
+// A key with a single value (most keys of a selective index) has no list, the value sits in the leaf entry
+// itself, tagged in its lowest bit (so DataType needs an alignment of at least 2).
+// Inserting finds the key and appends in 1 descent (Tree::upsert), erasing a value in 1 descent (Tree::modify)
+// plus 1 to remove the key with its last value. The same (key, value) pair can be inserted more than once,
+// erase removes 1 occurrence.
+//
+template<typename KeyType, typename DataType, uint N = 10>
+struct MultiTree {
+	static_assert(alignof(DataType) >= 2, "single values are tagged in the lowest bit of the pointer");
+
+	typedef PostingList<DataType> List;
+	typedef Tree<KeyType, List, N> TTree;
+
+	// The values of 1 key, valid until the next modification of that key.
+	struct Range {
+		const List* list;
+		DataType* single;
+		size_t count;
+
+		struct Iterator {
+			const Range* range;
+			size_t index;
+
+			DataType* operator*() const {
+				return (*range)[index];
+			}
+
+			void operator++() {
+				++index;
+			}
+
+			bool operator!=(const Iterator& other) const {
+				return index != other.index;
+			}
+		};
+
+		size_t size() const {
+			return count;
+		}
+
+		bool empty() const {
+			return count == 0;
+		}
+
+		DataType* operator[](size_t index) const {
+			return list ? (*list)[index] : single;
+		}
+
+		Iterator begin() const {
+			return Iterator{ this, 0 };
+		}
+
+		Iterator end() const {
+			return Iterator{ this, count };
+		}
+	};
+
+	explicit MultiTree(uint capacity = N != DynamicSize ? N : 10)
+		: impl(capacity) {}
+
+	~MultiTree() {
+		clear();
+	}
+
+	MultiTree(const MultiTree&) = delete;
+	MultiTree& operator=(const MultiTree&) = delete;
+
+	// Return if the key is new.
+	bool insert(const KeyType& key, DataType* value) {
+		valueCount++;
+		return impl.upsert(key, [&](List*& entry, bool exists) {
+			if (!exists) {
+				entry = tag(value);
+				return;
+			}
+			if (isSingle(entry)) {
+				List* list = new List();
+				list->push(untag(entry));
+				entry = list;
+			}
+			entry->push(value);
+		});
+	}
+
+	Range equalRange(const KeyType& key) const {
+		List* entry = nullptr;
+		if (!impl.get(key, entry)) {
+			return Range{ nullptr, nullptr, 0 };
+		}
+		if (isSingle(entry)) {
+			return Range{ nullptr, untag(entry), 1 };
+		}
+		return Range{ entry, nullptr, entry->size() };
+	}
+
+	size_t count(const KeyType& key) const {
+		return equalRange(key).size();
+	}
+
+	// f(value) for every value of key, faster than iterating equalRange over long lists.
+	template<typename F>
+	void forEachValue(const KeyType& key, F f) const {
+		List* entry = nullptr;
+		if (!impl.get(key, entry)) {
+			return;
+		}
+		if (isSingle(entry)) {
+			f(untag(entry));
+			return;
+		}
+		entry->forEach(f);
+	}
+
+	// Removes 1 occurrence of the pair, the key goes with its last value. Returns false if the pair is missing.
+	bool erase(const KeyType& key, DataType* value) {
+		bool removed = false;
+		bool last = false;
+		impl.modify(key, [&](List*& entry) {
+			if (isSingle(entry)) {
+				removed = last = untag(entry) == value;
+				return;
+			}
+			removed = entry->remove(value);
+			if (entry->size() == 1) {
+				// back to a single value
+				DataType* remaining = (*entry)[0];
+				delete entry;
+				entry = tag(remaining);
+			}
+		});
+		if (!removed) {
+			return false;
+		}
+		valueCount--;
+		if (last) {
+			impl.remove(key);
+		}
+		return true;
+	}
+
+	// Removes the key with all its values, returns how many there were.
+	size_t eraseKey(const KeyType& key) {
+		List* entry = nullptr;
+		if (!impl.removePop(key, entry)) {
+			return 0;
+		}
+		size_t removed = 1;
+		if (!isSingle(entry)) {
+			removed = entry->size();
+			delete entry;
+		}
+		valueCount -= removed;
+		return removed;
+	}
+
+	// f(key, value) for every pair, keys in order.
+	template<typename F>
+	void forEach(F f) const {
+		for (auto it = impl.first(); it.isValid(); it.next()) {
+			const List* entry = it.value();
+			if (isSingle(entry)) {
+				f(it.key(), untag(entry));
+				continue;
+			}
+			entry->forEach([&](DataType* value) { f(it.key(), value); });
+		}
+	}
+
+	// Values over all keys.
+	size_t size() const {
+		return valueCount;
+	}
+
+	uint keyCount() const {
+		return impl.size();
+	}
+
+	bool empty() const {
+		return valueCount == 0;
+	}
+
+	void clear() {
+		impl.clearDestructor([](List* entry) {
+			if (!isSingle(entry)) {
+				delete entry;
+			}
+		});
+		valueCount = 0;
+	}
+
+	const TTree& tree() const {
+		return impl;
+	}
+
+	// Tree nodes and posting lists (without the allocator's own overhead).
+	size_t allocatedBytes() const {
+		size_t bytes = impl.stats().nodeBytes;
+		for (auto it = impl.first(); it.isValid(); it.next()) {
+			if (!isSingle(it.value())) {
+				bytes += it.value()->allocatedBytes();
+			}
+		}
+		return bytes;
+	}
+
+private:
+	TTree impl;
+	size_t valueCount = 0;
+
+	static bool isSingle(const List* entry) {
+		return reinterpret_cast<uintptr_t>(entry) & 1;
+	}
+
+	static List* tag(DataType* value) {
+		return reinterpret_cast<List*>(reinterpret_cast<uintptr_t>(value) | 1);
+	}
+
+	static DataType* untag(const List* entry) {
+		return reinterpret_cast<DataType*>(reinterpret_cast<uintptr_t>(entry) & ~uintptr_t(1));
+	}
+};
+
+#endif // __MULTI_TREE_H_
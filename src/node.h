@@ -3,16 +3,35 @@
 
 #define NDEBUG
 #include <array>
+#include <algorithm>
 #include <utility>
 #include <cassert>
 #include <string>
 #include <iostream>
 #include <functional>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include "augment.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+// Called with every node that counts as a block transfer.
 #ifndef INCR_BLOCKS
-#define INCR_BLOCKS() do{ }while(0)
+#define INCR_BLOCKS(node) do{ }while(0)
+#endif
+
+// Build with -DNO_PREFETCH to compare against plain traversal.
+#if defined(__GNUC__) && !defined(NO_PREFETCH)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) do{ }while(0)
 #endif
 
+constexpr size_t CacheLineSize = 64;
+
 typedef unsigned int uint;
 
 //
@@ -23,27 +42,28 @@ typedef unsigned int uint;
 
 #define MoveVal(expression) std::move(expression)
 
-template<typename ArrayType, std::size_t ArraySize>
-void insertAtArray(std::array<ArrayType, ArraySize>& arr, int lastIndex, int location, const ArrayType& elem) {
-	assert(lastIndex < ArraySize);
+// Arrays are std::array or FlexArray (see below). An rvalue elem is moved in.
+template<typename Array, typename ArrayType>
+void insertAtArray(Array& arr, int lastIndex, int location, ArrayType&& elem) {
+	assert(lastIndex < int(arr.size()));
 	assert(location <= lastIndex);
 	for (int i = lastIndex; i > location; --i) {
 		arr[i] = MoveVal(arr[i - 1]);
 	}
-	arr[location] = elem;
+	arr[location] = std::forward<ArrayType>(elem);
 }
 
-template<typename ArrayType, std::size_t ArraySize>
-void deleteFromArrayAt(std::array<ArrayType, ArraySize>& arr, int arrSize, int at) {
-	assert(arrSize <= ArraySize);
+template<typename Array>
+void deleteFromArrayAt(Array& arr, int arrSize, int at) {
+	assert(arrSize <= int(arr.size()));
 	for (int i = at; i < arrSize - 1; ++i) {
 		arr[i] = MoveVal(arr[i + 1]);
 	}
 }
 
-template<typename ArrayType, std::size_t ArraySize>
-int deleteFromArray(std::array<ArrayType, ArraySize>& arr, int arrSize, const ArrayType& elem) {
-	assert(arrSize <= ArraySize);
+template<typename Array, typename ArrayType>
+int deleteFromArray(Array& arr, int arrSize, const ArrayType& elem) {
+	assert(arrSize <= int(arr.size()));
 
 	int foundIndex = 0;
 	for (int i = 0; i < arrSize; ++i) {
@@ -57,7 +77,82 @@ int deleteFromArray(std::array<ArrayType, ArraySize>& arr, int arrSize, const Ar
 	return foundIndex;
 }
 
-template<typename KeyType, typename DataType, uint N>
+// Pass as N to choose the node capacity at runtime, see Tree(uint capacity).
+constexpr uint DynamicSize = 0;
+
+// Fixed size array living in memory allocated right after its node (N == DynamicSize).
+template<typename T>
+struct FlexArray {
+	T* data;
+	int count;
+
+	T& operator[](int i) {
+		return data[i];
+	}
+	const T& operator[](int i) const {
+		return data[i];
+	}
+	size_t size() const {
+		return count;
+	}
+};
+
+template<typename T, std::size_t Size, bool Dynamic>
+struct NodeArray {
+	typedef std::array<T, Size> type;
+};
+
+template<typename T, std::size_t Size>
+struct NodeArray<T, Size, true> {
+	typedef FlexArray<T> type;
+};
+
+// One byte hash of a key for the leaf fingerprints (Tree<..., Fingerprints = true>).
+// Specialize it for key types without std::hash.
+template<typename KeyType>
+struct KeyFingerprint {
+	static uint8_t of(const KeyType& key) {
+		// the top byte of a multiplicative hash, std::hash of integers is the identity
+		return uint8_t((uint64_t(std::hash<KeyType>()(key)) * 0x9E3779B97F4A7C15ull) >> 56);
+	}
+};
+
+// Fingerprints are scanned a vector of 16 at a time, the array is padded to whole vectors.
+template<uint N, bool Enabled>
+struct FingerprintArray {
+	struct type {};
+};
+
+template<uint N>
+struct FingerprintArray<N, true> {
+	typedef std::array<uint8_t, (N + 15) / 16 * 16> type;
+};
+
+// Per child aggregates of an augmented tree (see augment.h), 1 more than keys like ptrs. A separate allocation
+// only inner nodes get (Node::allocateAggregates), leaves are most of the nodes and keep just the null pointer.
+template<typename Augment, uint N>
+struct AggregateArray {
+	struct type {
+		std::unique_ptr<typename Augment::type[]> data;
+
+		typename Augment::type& operator[](int i) {
+			return data[i];
+		}
+		const typename Augment::type& operator[](int i) const {
+			return data[i];
+		}
+		size_t size() const {
+			return N + 1;
+		}
+	};
+};
+
+template<uint N>
+struct AggregateArray<NoAugment, N> {
+	struct type {};
+};
+
+template<typename KeyType, typename DataType, uint N, bool Fingerprints = false, typename Augment = NoAugment>
 struct Node {
 	typedef std::pair<int, bool> ElemIndex;
 
@@ -66,24 +161,92 @@ struct Node {
 	bool isLeaf;
 	Node* parent;
 	Node* next;
+	static constexpr bool IsDynamic = N == DynamicSize;
+	static_assert(!(IsDynamic && Fingerprints), "leaf fingerprints need a compile time capacity");
+	static constexpr bool Augmented = !std::is_same<Augment, NoAugment>::value;
+	static_assert(!(IsDynamic && Augmented), "aggregates need a compile time capacity");
 	// 2 seperate arrays for better cache management, since iterating only keys is frequent.
-	std::array<KeyType, N> keys;
-	std::array<Node*, N + 1> ptrs;
+	typename NodeArray<KeyType, N, IsDynamic>::type keys;
+	typename NodeArray<Node*, N + 1, IsDynamic>::type ptrs;
+	// leaves only, KeyFingerprint of every key, checked before the keys themselves in findByFingerprint.
+	// Without fingerprints the empty member sits in the padding before uid.
+	typename FingerprintArray<N, Fingerprints>::type fingerprints;
+	// inner nodes only, aggregates[i] is the aggregate of the subtree under ptrs[i]. Moved together with the
+	// pointers, filled in by the tree when a subtree changes. Without an augment it is an empty member.
+	typename AggregateArray<Augment, N>::type aggregates;
 
 	int uid;
-	// this does not resolve to actual struct wide static 
-	// but static for this specific template instantiation
-	static const int Parity = N % 2;
-	static const int HN = N / 2 + Parity;
 
 	Node()
 		: isLeaf(false)
 		, childrenCount(0)
 		, parent(nullptr) {
-		static uint total_uids = 0;
-		uid = total_uids++;
-		setNextLeaf(nullptr);
-		INCR_BLOCKS();
+		init();
+	}
+
+	// Allocates a node, capacity is only used with DynamicSize. Release with destroy().
+	static Node* create(int capacity) {
+		if constexpr (IsDynamic) {
+			const size_t keysOffset = alignUp(sizeof(Node), alignof(KeyType));
+			const size_t ptrsOffset = alignUp(keysOffset + capacity * sizeof(KeyType), alignof(Node*));
+			char* memory = static_cast<char*>(::operator new(ptrsOffset + (capacity + 1) * sizeof(Node*)));
+			KeyType* keyData = reinterpret_cast<KeyType*>(memory + keysOffset);
+			for (int i = 0; i < capacity; ++i) {
+				new (keyData + i) KeyType();
+			}
+			return new (memory) Node(keyData, reinterpret_cast<Node**>(memory + ptrsOffset), capacity);
+		}
+		else {
+			return new Node();
+		}
+	}
+
+	static void destroy(Node* node) {
+		if constexpr (IsDynamic) {
+			for (int i = 0; i < node->capacity(); ++i) {
+				node->keys[i].~KeyType();
+			}
+			node->~Node();
+			::operator delete(node);
+		}
+		else {
+			delete node;
+		}
+	}
+
+	// Max keys in the node. Compile time constant unless DynamicSize.
+	int capacity() const {
+		return int(keys.size());
+	}
+
+	int half() const {
+		return capacity() / 2 + capacity() % 2;
+	}
+
+	int parity() const {
+		return capacity() % 2;
+	}
+
+	// Bytes of the whole allocation, including the arrays of a dynamic node.
+	size_t allocatedBytes() const {
+		if constexpr (IsDynamic) {
+			return reinterpret_cast<const char*>(&ptrs[capacity()] + 1) - reinterpret_cast<const char*>(this);
+		}
+		else if constexpr (Augmented) {
+			return sizeof(Node) + (aggregates.data ? aggregates.size() * sizeof(aggregates[0]) : 0);
+		}
+		else {
+			return sizeof(Node);
+		}
+	}
+
+	// Called on every new inner node, a no-op without an augment.
+	void allocateAggregates() {
+		if constexpr (Augmented) {
+			if (!aggregates.data) {
+				aggregates.data.reset(new typename Augment::type[aggregates.size()]);
+			}
+		}
 	}
 
 	bool isRoot() const {
@@ -187,6 +350,75 @@ struct Node {
 		return left + 1;
 	}
 
+	// Starts loading the key lines of the first 2 binary search steps together instead of one after another.
+	// Only worth it when the keys span more than a few lines.
+	void prefetchSearch() const {
+		if (childrenCount * sizeof(KeyType) <= 4 * CacheLineSize) {
+			return;
+		}
+		PREFETCH(&keys[childrenCount / 2]);
+		PREFETCH(&keys[childrenCount / 4]);
+		PREFETCH(&keys[childrenCount / 2 + childrenCount / 4]);
+	}
+
+	// Whole node, used for leaves that are about to be iterated.
+	void prefetch() const {
+		const char* begin = reinterpret_cast<const char*>(this);
+		for (size_t offset = 0; offset < allocatedBytes(); offset += CacheLineSize) {
+			PREFETCH(begin + offset);
+		}
+	}
+
+	// Leaf lookup with the fingerprints: only keys with the same fingerprint byte get compared, all of them
+	// found with 1 vector compare per 16 keys. Returns the index of key or -1 if it is not in the leaf.
+	int findByFingerprint(const KeyType& key) const {
+		static_assert(Fingerprints, "the node has no fingerprints");
+		assert(isLeaf);
+		const uint8_t fingerprint = KeyFingerprint<KeyType>::of(key);
+		for (int from = 0; from < childrenCount; from += 16) {
+#if defined(__SSE2__)
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&fingerprints[from]));
+			uint matches = uint(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(char(fingerprint)))));
+			if (childrenCount - from < 16) {
+				matches &= (1u << (childrenCount - from)) - 1;
+			}
+			for (; matches; matches &= matches - 1) {
+				const int index = from + __builtin_ctz(matches);
+				if (keys[index] == key) {
+					return index;
+				}
+			}
+#else
+			for (int index = from; index < std::min(childrenCount, from + 16); ++index) {
+				if (fingerprints[index] == fingerprint && keys[index] == key) {
+					return index;
+				}
+			}
+#endif
+		}
+		return -1;
+	}
+
+	void setFingerprint(int index, const KeyType& key) {
+		if constexpr (Fingerprints) {
+			fingerprints[index] = KeyFingerprint<KeyType>::of(key);
+		}
+	}
+
+	// Goes with every copy of a leaf entry (keys[index] = from->keys[fromIndex]).
+	void copyFingerprint(int index, const Node* from, int fromIndex) {
+		if constexpr (Fingerprints) {
+			fingerprints[index] = from->fingerprints[fromIndex];
+		}
+	}
+
+	// Goes with every copy of an inner pointer (ptrs[index] = from->ptrs[fromIndex]).
+	void copyAggregate(int index, const Node* from, int fromIndex) {
+		if constexpr (Augmented) {
+			aggregates[index] = from->aggregates[fromIndex];
+		}
+	}
+
 	bool isLeftMost(const KeyType& key) const {
 		return key < keys[0];
 	}
@@ -195,113 +427,137 @@ struct Node {
 		return key >= keys[childrenCount - 1];
 	}
 
-	void insertAtLeaf(int index, const KeyType& key, DataType* data) {
-		assert(isRoot() || childrenCount + 1 >= N / 2);
+	// The insert functions take K = KeyType (copied) or KeyType&& (moved all the way into the node).
+	template<typename K>
+	void insertAtLeaf(int index, K&& key, DataType* data) {
+		assert(isRoot() || childrenCount + 1 >= capacity() / 2);
 		assert(isLeaf);
 
-		insertAtArray(keys, childrenCount, index, key);
+		if constexpr (Fingerprints) {
+			insertAtArray(fingerprints, childrenCount, index, KeyFingerprint<KeyType>::of(key));
+		}
+		insertAtArray(keys, childrenCount, index, std::forward<K>(key));
 		insertAtArray(ptrs, childrenCount, index, reinterpret_cast<Node*>(data));
 		childrenCount++;
 	}
 
-	void insertAtInternal(int index, const KeyType& key, Node* node) {
+	template<typename K>
+	void insertAtInternal(int index, K&& key, Node* node) {
 		assert(!isLeaf);
 
-		insertAtArray(keys, childrenCount, index, key);
+		insertAtArray(keys, childrenCount, index, std::forward<K>(key));
 		insertAtArray(ptrs, childrenCount + 1, index + 1, node);
+		if constexpr (Augmented) {
+			// the new child's aggregate is filled in by the tree
+			insertAtArray(aggregates, childrenCount + 1, index + 1, Augment::identity());
+		}
 		childrenCount++;
 	}
 
-	static Node* splitAndInsertLeaf(Node* initialNode, int insertIndex, const KeyType& key, DataType* data) {
-		assert(initialNode->childrenCount == N);
-		
+	template<typename K>
+	static Node* splitAndInsertLeaf(Node* initialNode, int insertIndex, K&& key, DataType* data) {
+		const int Cap = initialNode->capacity(), Half = initialNode->half(), Odd = initialNode->parity();
+		assert(initialNode->childrenCount == Cap);
 
-		Node* rightNode = new Node();
+		Node* rightNode = create(Cap);
 		rightNode->isLeaf = true;
 		rightNode->setNextLeaf(initialNode->getNextLeaf());
 		initialNode->setNextLeaf(rightNode);
 
-		if (insertIndex < HN) {
+		if (insertIndex < Half) {
 			// Our element is in the left node
 
-			for (int i = N - 1; i >= HN - Parity; --i) {
-				rightNode->keys[i - HN + Parity] = MoveVal(initialNode->keys[i]);
-				rightNode->ptrs[i - HN + Parity] = initialNode->ptrs[i];
+			for (int i = Cap - 1; i >= Half - Odd; --i) {
+				rightNode->keys[i - Half + Odd] = MoveVal(initialNode->keys[i]);
+				rightNode->ptrs[i - Half + Odd] = initialNode->ptrs[i];
+				rightNode->copyFingerprint(i - Half + Odd, initialNode, i);
 			}
-			rightNode->childrenCount = HN;
-			initialNode->childrenCount = HN - Parity;
-			initialNode->insertAtLeaf(insertIndex, key, data);
+			rightNode->childrenCount = Half;
+			initialNode->childrenCount = Half - Odd;
+			initialNode->insertAtLeaf(insertIndex, std::forward<K>(key), data);
 		}
 		else {
 			int i;
-			for (i = N - 1; i >= insertIndex; --i) {
-				rightNode->keys[i - HN + 1] = MoveVal(initialNode->keys[i]);
-				rightNode->ptrs[i - HN + 1] = initialNode->ptrs[i];
+			for (i = Cap - 1; i >= insertIndex; --i) {
+				rightNode->keys[i - Half + 1] = MoveVal(initialNode->keys[i]);
+				rightNode->ptrs[i - Half + 1] = initialNode->ptrs[i];
+				rightNode->copyFingerprint(i - Half + 1, initialNode, i);
 			}
-			rightNode->keys[i - HN + 1] = MoveVal(key);
-			rightNode->ptrs[i - HN + 1] = reinterpret_cast<Node*>(data);
-
-			for (; i >= HN; --i) {
-				rightNode->keys[i - HN] = MoveVal(initialNode->keys[i]);
-				rightNode->ptrs[i - HN] = initialNode->ptrs[i];
+			rightNode->setFingerprint(i - Half + 1, key);
+			rightNode->keys[i - Half + 1] = std::forward<K>(key);
+			rightNode->ptrs[i - Half + 1] = reinterpret_cast<Node*>(data);
+
+			for (; i >= Half; --i) {
+				rightNode->keys[i - Half] = MoveVal(initialNode->keys[i]);
+				rightNode->ptrs[i - Half] = initialNode->ptrs[i];
+				rightNode->copyFingerprint(i - Half, initialNode, i);
 			}
-			rightNode->childrenCount = HN - Parity + 1;
-			initialNode->childrenCount = HN;
+			rightNode->childrenCount = Half - Odd + 1;
+			initialNode->childrenCount = Half;
 		}
 
 		return rightNode;
 	}
 
-	// return "popped" key, the one that gets lost from the split
-	static KeyType splitAndInsertInternal(Node* initialNode, Node*& outNewNode, int insertIndex, const KeyType& key, Node* ptrInsert) {
-		assert(initialNode->childrenCount == N);
+	// return "popped" key, the one that gets lost from the split. It is moved out of its slot, which is past
+	// childrenCount afterwards.
+	template<typename K>
+	static KeyType splitAndInsertInternal(Node* initialNode, Node*& outNewNode, int insertIndex, K&& key, Node* ptrInsert) {
+		const int Cap = initialNode->capacity(), Half = initialNode->half(), Odd = initialNode->parity();
+		assert(initialNode->childrenCount == Cap);
 		assert(ptrInsert);
 
 		KeyType poppedKey;
-		outNewNode = new Node();
+		outNewNode = create(Cap);
+		outNewNode->allocateAggregates();
 
-		if (insertIndex < HN) {
+		if (insertIndex < Half) {
 
 			// Our element is in the left node
-			for (int i = N; i > HN; --i) {
-				outNewNode->ptrs[i - HN] = initialNode->ptrs[i];
-				outNewNode->keys[i - HN - 1] = MoveVal(initialNode->keys[i - 1]);
+			for (int i = Cap; i > Half; --i) {
+				outNewNode->ptrs[i - Half] = initialNode->ptrs[i];
+				outNewNode->copyAggregate(i - Half, initialNode, i);
+				outNewNode->keys[i - Half - 1] = MoveVal(initialNode->keys[i - 1]);
 			}
-			outNewNode->ptrs[0] = initialNode->ptrs[HN];
-			poppedKey = initialNode->keys[HN - 1];
+			outNewNode->ptrs[0] = initialNode->ptrs[Half];
+			outNewNode->copyAggregate(0, initialNode, Half);
+			poppedKey = MoveVal(initialNode->keys[Half - 1]);
 
-			outNewNode->childrenCount = HN - Parity;
-			initialNode->childrenCount = HN - 1;
+			outNewNode->childrenCount = Half - Odd;
+			initialNode->childrenCount = Half - 1;
 
-			initialNode->insertAtInternal(insertIndex, key, ptrInsert);
+			initialNode->insertAtInternal(insertIndex, std::forward<K>(key), ptrInsert);
 
 			ptrInsert->parent = initialNode;
 		}
-		else if (insertIndex == HN) {
-			for (int i = N; i > HN; --i) {
-				outNewNode->ptrs[i - HN] = initialNode->ptrs[i];
-				outNewNode->keys[i - HN - 1] = MoveVal(initialNode->keys[i - 1]);
+		else if (insertIndex == Half) {
+			for (int i = Cap; i > Half; --i) {
+				outNewNode->ptrs[i - Half] = initialNode->ptrs[i];
+				outNewNode->copyAggregate(i - Half, initialNode, i);
+				outNewNode->keys[i - Half - 1] = MoveVal(initialNode->keys[i - 1]);
 			}
 			outNewNode->ptrs[0] = ptrInsert;
-			poppedKey = key;
+			poppedKey = std::forward<K>(key);
 
-			outNewNode->childrenCount = HN - Parity;
-			initialNode->childrenCount = HN;
+			outNewNode->childrenCount = Half - Odd;
+			initialNode->childrenCount = Half;
 		}
 		else {
-			for (int i = N; i - 1 > HN; --i) {
-				outNewNode->ptrs[i - 1 - HN] = initialNode->ptrs[i];
-				outNewNode->keys[i - 1 - HN - 1] = MoveVal(initialNode->keys[i - 1]);
+			for (int i = Cap; i - 1 > Half; --i) {
+				outNewNode->ptrs[i - 1 - Half] = initialNode->ptrs[i];
+				outNewNode->copyAggregate(i - 1 - Half, initialNode, i);
+				outNewNode->keys[i - 1 - Half - 1] = MoveVal(initialNode->keys[i - 1]);
 			}
-			outNewNode->ptrs[0] = initialNode->ptrs[HN + 1];
-			poppedKey = initialNode->keys[HN];
+			outNewNode->ptrs[0] = initialNode->ptrs[Half + 1];
+			outNewNode->copyAggregate(0, initialNode, Half + 1);
+			poppedKey = MoveVal(initialNode->keys[Half]);
 
-			outNewNode->childrenCount = HN - 1 - Parity;
-			initialNode->childrenCount = HN;
+			outNewNode->childrenCount = Half - 1 - Odd;
+			initialNode->childrenCount = Half;
 
-			outNewNode->insertAtInternal(insertIndex - HN - 1, key, ptrInsert);
+			outNewNode->insertAtInternal(insertIndex - Half - 1, std::forward<K>(key), ptrInsert);
 		}
-		assert(outNewNode->childrenCount >= N / 2);
+		assert(outNewNode->childrenCount >= Cap / 2);
 		for (int i = 0; i < outNewNode->childrenCount + 1; ++i) {
 			outNewNode->ptrs[i]->parent = outNewNode;
 		}
@@ -309,6 +565,45 @@ struct Node {
 		return MoveVal(poppedKey);
 	}
 	
+	// 100/0 split for appends at the right edge of the tree: initialNode stays full and the new right leaf
+	// only gets the appended key. Sequential inserts then fill every leaf instead of leaving them half empty.
+	template<typename K>
+	static Node* splitAppendLeaf(Node* initialNode, K&& key, DataType* data) {
+		assert(initialNode->childrenCount == initialNode->capacity());
+
+		Node* rightNode = create(initialNode->capacity());
+		rightNode->isLeaf = true;
+		rightNode->setNextLeaf(initialNode->getNextLeaf());
+		initialNode->setNextLeaf(rightNode);
+		rightNode->setFingerprint(0, key);
+		rightNode->keys[0] = std::forward<K>(key);
+		rightNode->ptrs[0] = reinterpret_cast<Node*>(data);
+		rightNode->childrenCount = 1;
+		return rightNode;
+	}
+
+	// Same for internal nodes, except the new node takes the last child of initialNode too,
+	// an internal node needs 2 children so its leaves have a sibling to merge with. Returns the key for the parent.
+	template<typename K>
+	static KeyType splitAppendInternal(Node* initialNode, Node*& outNewNode, K&& key, Node* ptrInsert) {
+		const int Cap = initialNode->capacity();
+		assert(initialNode->childrenCount == Cap);
+		assert(ptrInsert);
+
+		outNewNode = create(Cap);
+		outNewNode->allocateAggregates();
+		outNewNode->ptrs[0] = initialNode->ptrs[Cap];
+		outNewNode->copyAggregate(0, initialNode, Cap);
+		outNewNode->ptrs[1] = ptrInsert;
+		outNewNode->keys[0] = std::forward<K>(key);
+		outNewNode->childrenCount = 1;
+		outNewNode->ptrs[0]->parent = outNewNode;
+		ptrInsert->parent = outNewNode;
+
+		initialNode->childrenCount = Cap - 1;
+		return MoveVal(initialNode->keys[Cap - 1]);
+	}
+
 	// Returns key index that was deleted
 	int deleteKeyAndPtr(const KeyType& key, Node* ptr) {
 		assert(!isLeaf);
@@ -316,17 +611,47 @@ struct Node {
 		deleteFromArrayAt(keys, childrenCount, pos);
 		// linear search here can be optimised but there would be no real advantages
 		// because this code runs too few times.
-		deleteFromArray(ptrs, childrenCount + 1, ptr);
+		const int ptrPos = deleteFromArray(ptrs, childrenCount + 1, ptr);
+		if constexpr (Augmented) {
+			deleteFromArrayAt(aggregates, childrenCount + 1, ptrPos);
+		}
 		childrenCount--;
 		return pos;
 	}
 
 	void deleteKeyValAt(int pos) {
 		assert(isLeaf);
+		if constexpr (Fingerprints) {
+			deleteFromArrayAt(fingerprints, childrenCount, pos);
+		}
 		deleteFromArrayAt(keys, childrenCount, pos);
 		deleteFromArrayAt(ptrs, childrenCount, pos);
 		childrenCount--;
 	}
+
+private:
+	Node(KeyType* keyData, Node** ptrData, int capacity)
+		: isLeaf(false)
+		, childrenCount(0)
+		, parent(nullptr) {
+		keys.data = keyData;
+		keys.count = capacity;
+		ptrs.data = ptrData;
+		ptrs.count = capacity + 1;
+		init();
+	}
+
+	void init() {
+		// atomic since independent trees can allocate from several threads (ShardedTree)
+		static std::atomic<uint> total_uids{ 0 };
+		uid = total_uids.fetch_add(1, std::memory_order_relaxed);
+		setNextLeaf(nullptr);
+		INCR_BLOCKS(this);
+	}
+
+	static constexpr size_t alignUp(size_t offset, size_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
 };
 
 #endif // __NODE_H_
\ No newline at end of file
@@ -0,0 +1,370 @@
+#ifndef __PACKED_TREE_H_
+#define __PACKED_TREE_H_
+
+#include "node.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//
+// Ordered map for integer keys with frame of reference compressed leaves, for indexes where the leaves are
+// most of the memory. A leaf stores its smallest key (base) and every key as the delta to it in the fewest
+// bytes (1, 2, 4 or 8) that fit the largest delta, so a leaf of close keys takes 1 or 2 bytes per key.
+// Deltas are kept byte aligned instead of bit packed so lookups compare them with SSE2 directly:
+// a binary search narrows to one 16 byte vector of deltas and a single compare finishes it.
+//
+// Lookups and value updates work on the compressed leaf, inserts and removes decode it, change it and encode
+// it again (the price for the memory). Above the leaves is a sorted array of separator keys (there are
+// LeafCapacity times fewer of them), same as the shard routing of ShardedTree.
+//
+
+template<typename KeyType, typename DataType, uint LeafCapacity = 256>
+struct PackedTree {
+	static_assert(std::is_integral<KeyType>::value, "PackedTree needs integer keys");
+	static_assert(LeafCapacity >= 4, "LeafCapacity must be at least 4");
+
+	typedef typename std::make_unsigned<KeyType>::type UKey;
+
+	PackedTree() {
+		leaves.push_back(new Leaf());
+	}
+
+	PackedTree(const PackedTree&) = delete;
+	PackedTree& operator=(const PackedTree&) = delete;
+
+	~PackedTree() {
+		for (Leaf* leaf : leaves) {
+			delete leaf;
+		}
+	}
+
+	// Return if an insert was actually made, existing keys get the new data.
+	bool set(const KeyType& key, DataType* data) {
+		return insertKeyVal(key, data, true);
+	}
+
+	bool maybe_add(const KeyType& key, DataType* data) {
+		return insertKeyVal(key, data, false);
+	}
+
+	bool get(const KeyType& key, DataType*& outData) const {
+		const Leaf* leaf = leaves[route(key)];
+		bool found = false;
+		const int index = leaf->find(key, found);
+		if (!found) {
+			return false;
+		}
+		outData = leaf->values()[index];
+		return true;
+	}
+
+	bool remove(const KeyType& key) {
+		DataType* popped;
+		return removePop(key, popped);
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped) {
+		const size_t at = route(key);
+		Leaf* leaf = leaves[at];
+		bool found = false;
+		const int index = leaf->find(key, found);
+		if (!found) {
+			return false;
+		}
+		popped = leaf->values()[index];
+		decode(*leaf);
+		scratchKeys.erase(scratchKeys.begin() + index);
+		scratchValues.erase(scratchValues.begin() + index);
+		leaf->encode(scratchKeys.data(), scratchValues.data(), int(scratchKeys.size()));
+		elementCount--;
+		mergeIfSmall(at);
+		return true;
+	}
+
+	size_t size() const {
+		return elementCount;
+	}
+
+	bool empty() const {
+		return elementCount == 0;
+	}
+
+	size_t leafCount() const {
+		return leaves.size();
+	}
+
+	// f(key, data) for every element in order.
+	template<typename F>
+	void forEach(F f) const {
+		for (const Leaf* leaf : leaves) {
+			for (int i = 0; i < leaf->count; ++i) {
+				f(leaf->key(i), leaf->values()[i]);
+			}
+		}
+	}
+
+	void clear() {
+		for (Leaf* leaf : leaves) {
+			delete leaf;
+		}
+		leaves.assign(1, new Leaf());
+		separators.clear();
+		elementCount = 0;
+	}
+
+	// Heap bytes of leaves and the separator array (without the allocator's own overhead).
+	size_t allocatedBytes() const {
+		size_t bytes = leaves.capacity() * sizeof(Leaf*) + separators.capacity() * sizeof(KeyType);
+		for (const Leaf* leaf : leaves) {
+			bytes += sizeof(Leaf) + leaf->allocatedBytes();
+		}
+		return bytes;
+	}
+
+	// Bytes per delta of every leaf, in leaf order.
+	std::vector<int> deltaWidths() const {
+		std::vector<int> widths;
+		for (const Leaf* leaf : leaves) {
+			widths.push_back(leaf->width);
+		}
+		return widths;
+	}
+
+private:
+	// Deltas are read a full vector at a time, the allocation is padded so the last read stays inside it.
+	static constexpr int SimdBytes = 16;
+
+	struct Leaf {
+		KeyType base = 0;
+		int count = 0;
+		int width = 1;
+		// count values followed by count deltas of width bytes
+		std::unique_ptr<char[]> memory;
+
+		DataType** values() const {
+			return reinterpret_cast<DataType**>(memory.get());
+		}
+
+		const char* deltas() const {
+			return memory.get() + count * sizeof(DataType*);
+		}
+
+		size_t allocatedBytes() const {
+			return memory ? count * (sizeof(DataType*) + width) + SimdBytes : 0;
+		}
+
+		KeyType key(int i) const {
+			return KeyType(UKey(base) + UKey(delta(i)));
+		}
+
+		uint64_t delta(int i) const {
+			switch (width) {
+			case 1: return load<uint8_t>(i);
+			case 2: return load<uint16_t>(i);
+			case 4: return load<uint32_t>(i);
+			default: return load<uint64_t>(i);
+			}
+		}
+
+		// Index of the first key >= key, found is set if it is equal.
+		int find(const KeyType& key, bool& found) const {
+			if (count == 0 || key < base) {
+				return 0;
+			}
+			const uint64_t target = uint64_t(UKey(key) - UKey(base));
+			int index;
+			switch (width) {
+			case 1: index = lowerBound<uint8_t>(target); break;
+			case 2: index = lowerBound<uint16_t>(target); break;
+			case 4: index = lowerBound<uint32_t>(target); break;
+			default: index = lowerBound<uint64_t>(target); break;
+			}
+			found = index < count && delta(index) == target;
+			return index;
+		}
+
+		// Replaces the contents with count sorted keys.
+		void encode(const KeyType* keys, DataType* const* data, int newCount) {
+			count = newCount;
+			if (count == 0) {
+				memory.reset();
+				width = 1;
+				return;
+			}
+			base = keys[0];
+			const uint64_t span = uint64_t(UKey(keys[count - 1]) - UKey(base));
+			width = span <= UINT8_MAX ? 1 : span <= UINT16_MAX ? 2 : span <= UINT32_MAX ? 4 : 8;
+			memory.reset(new char[count * (sizeof(DataType*) + width) + SimdBytes]);
+			std::copy(data, data + count, values());
+			switch (width) {
+			case 1: store<uint8_t>(keys); break;
+			case 2: store<uint16_t>(keys); break;
+			case 4: store<uint32_t>(keys); break;
+			default: store<uint64_t>(keys); break;
+			}
+		}
+
+	private:
+		template<typename U>
+		U load(int i) const {
+			U value;
+			std::memcpy(&value, deltas() + i * sizeof(U), sizeof(U));
+			return value;
+		}
+
+		template<typename U>
+		void store(const KeyType* keys) {
+			char* out = memory.get() + count * sizeof(DataType*);
+			for (int i = 0; i < count; ++i) {
+				const U value = U(UKey(keys[i]) - UKey(base));
+				std::memcpy(out + i * sizeof(U), &value, sizeof(U));
+			}
+		}
+
+		template<typename U>
+		int lowerBound(uint64_t target) const {
+			if (target > uint64_t(U(-1))) {
+				return count;
+			}
+			// binary search down to one vector, answer in [left, left + len]
+			constexpr int Lanes = SimdBytes / sizeof(U);
+			int left = 0;
+			int len = count;
+			while (len > Lanes) {
+				const int half = len / 2;
+				if (load<U>(left + half - 1) < target) {
+					left += half;
+					len -= half;
+				}
+				else {
+					len = half;
+				}
+			}
+			return left + countLess<U>(left, len, U(target));
+		}
+
+		// Deltas in [from, from + len) below target, len <= Lanes.
+		template<typename U>
+		int countLess(int from, int len, U target) const {
+#if defined(__SSE2__)
+			if constexpr (sizeof(U) < 8) {
+				// SSE2 only compares signed, flipping the sign bit of both sides keeps the unsigned order
+				const __m128i vector = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas() + from * sizeof(U)));
+				__m128i less;
+				if constexpr (sizeof(U) == 1) {
+					const __m128i sign = _mm_set1_epi8(char(0x80));
+					less = _mm_cmplt_epi8(_mm_xor_si128(vector, sign), _mm_xor_si128(_mm_set1_epi8(char(target)), sign));
+				}
+				else if constexpr (sizeof(U) == 2) {
+					const __m128i sign = _mm_set1_epi16(short(0x8000));
+					less = _mm_cmplt_epi16(_mm_xor_si128(vector, sign), _mm_xor_si128(_mm_set1_epi16(short(target)), sign));
+				}
+				else {
+					const __m128i sign = _mm_set1_epi32(int(0x80000000u));
+					less = _mm_cmplt_epi32(_mm_xor_si128(vector, sign), _mm_xor_si128(_mm_set1_epi32(int(target)), sign));
+				}
+				const uint mask = uint(_mm_movemask_epi8(less)) & ((1u << (len * sizeof(U))) - 1);
+				return __builtin_popcount(mask) / int(sizeof(U));
+			}
+#endif
+			int less = 0;
+			for (int i = from; i < from + len; ++i) {
+				less += load<U>(i) < target;
+			}
+			return less;
+		}
+	};
+
+	// leaves[i] holds keys in [separators[i - 1], separators[i])
+	std::vector<KeyType> separators;
+	std::vector<Leaf*> leaves;
+	size_t elementCount = 0;
+	// decoded leaf while it is modified
+	std::vector<KeyType> scratchKeys;
+	std::vector<DataType*> scratchValues;
+
+	size_t route(const KeyType& key) const {
+		return std::upper_bound(separators.begin(), separators.end(), key) - separators.begin();
+	}
+
+	void decode(const Leaf& leaf) {
+		scratchKeys.resize(leaf.count);
+		scratchValues.assign(leaf.values(), leaf.values() + leaf.count);
+		for (int i = 0; i < leaf.count; ++i) {
+			scratchKeys[i] = leaf.key(i);
+		}
+	}
+
+	bool insertKeyVal(const KeyType& key, DataType* data, bool overwrite) {
+		const size_t at = route(key);
+		Leaf* leaf = leaves[at];
+		bool found = false;
+		const int index = leaf->find(key, found);
+		if (found) {
+			// in place, the keys do not change
+			if (overwrite) {
+				leaf->values()[index] = data;
+			}
+			return false;
+		}
+
+		decode(*leaf);
+		scratchKeys.insert(scratchKeys.begin() + index, key);
+		scratchValues.insert(scratchValues.begin() + index, data);
+		const int total = int(scratchKeys.size());
+		if (total <= int(LeafCapacity)) {
+			leaf->encode(scratchKeys.data(), scratchValues.data(), total);
+		}
+		else {
+			// halves, each of them usually needs fewer bytes per delta than the whole
+			const int half = total / 2;
+			Leaf* right = new Leaf();
+			right->encode(scratchKeys.data() + half, scratchValues.data() + half, total - half);
+			leaf->encode(scratchKeys.data(), scratchValues.data(), half);
+			leaves.insert(leaves.begin() + at + 1, right);
+			separators.insert(separators.begin() + at, scratchKeys[half]);
+		}
+		elementCount++;
+		return true;
+	}
+
+	// Merges leaves[at] with its right neighbor (or drops it if empty) once both fit in 3/4 of a leaf,
+	// so deletes do not leave long chains of nearly empty leaves.
+	void mergeIfSmall(size_t at) {
+		Leaf* leaf = leaves[at];
+		if (leaves.size() == 1 || leaf->count >= int(LeafCapacity) / 4) {
+			return;
+		}
+		if (leaf->count == 0) {
+			// its range goes to the left neighbor, or to the right one for the first leaf
+			delete leaf;
+			leaves.erase(leaves.begin() + at);
+			separators.erase(separators.begin() + (at > 0 ? at - 1 : 0));
+			return;
+		}
+		if (at + 1 == leaves.size()) {
+			return;
+		}
+		Leaf* right = leaves[at + 1];
+		if (leaf->count + right->count > int(LeafCapacity) * 3 / 4) {
+			return;
+		}
+		decode(*leaf);
+		for (int i = 0; i < right->count; ++i) {
+			scratchKeys.push_back(right->key(i));
+			scratchValues.push_back(right->values()[i]);
+		}
+		leaf->encode(scratchKeys.data(), scratchValues.data(), int(scratchKeys.size()));
+		delete right;
+		leaves.erase(leaves.begin() + at + 1);
+		separators.erase(separators.begin() + at);
+	}
+};
+
+#endif // __PACKED_TREE_H_
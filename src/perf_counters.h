@@ -0,0 +1,198 @@
+#ifndef __PERF_COUNTERS_H_
+#define __PERF_COUNTERS_H_
+
+#include <array>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+//
+// Hardware counters through perf_event_open.
+// Every counter is opened on its own so the kernel can multiplex them when the PMU does not have
+// enough registers for all of them at once, values are scaled by time_enabled / time_running.
+// Counters that can not be opened (no permission, virtualized PMU, unsupported event) stay invalid
+// and everything else keeps working.
+//
+
+enum class PerfEvent : int {
+	Cycles = 0,
+	Instructions,
+	L1DMisses,
+	LLCMisses,
+	BranchMisses,
+	DTLBMisses,
+	E_LAST
+};
+
+constexpr size_t PerfEventN = static_cast<size_t>(PerfEvent::E_LAST);
+
+inline const char* PerfEventName(size_t Index) {
+	static const char* Names[PerfEventN] = { "cycles", "instr", "L1D-miss", "LLC-miss", "br-miss", "dTLB-miss" };
+	return Names[Index];
+}
+
+// Counter values for 1 measured phase.
+struct PerfSample {
+	std::array<uint64_t, PerfEventN> Values;
+	std::array<bool, PerfEventN> Valid;
+
+	PerfSample() {
+		Values.fill(0);
+		Valid.fill(false);
+	}
+
+	bool Any() const {
+		for (bool V : Valid) {
+			if (V) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+inline void operator+=(PerfSample& rhs, const PerfSample& lhs) {
+	for (size_t i = 0; i < PerfEventN; ++i) {
+		rhs.Values[i] += lhs.Values[i];
+		rhs.Valid[i] = rhs.Valid[i] || lhs.Valid[i];
+	}
+}
+
+struct PerfCounters {
+private:
+	std::array<int, PerfEventN> Fds;
+	bool Opened;
+	std::string Error;
+
+#ifdef __linux__
+	static int OpenEvent(uint32_t Type, uint64_t Config) {
+		perf_event_attr Attr;
+		std::memset(&Attr, 0, sizeof(Attr));
+		Attr.size = sizeof(Attr);
+		Attr.type = Type;
+		Attr.config = Config;
+		Attr.disabled = 1;
+		Attr.exclude_kernel = 1;
+		Attr.exclude_hv = 1;
+		Attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return static_cast<int>(syscall(__NR_perf_event_open, &Attr, 0, -1, -1, 0));
+	}
+
+	static uint64_t CacheConfig(uint64_t Cache, uint64_t Op, uint64_t Result) {
+		return Cache | (Op << 8) | (Result << 16);
+	}
+#endif
+
+public:
+	PerfCounters()
+		: Opened(false) {
+		Fds.fill(-1);
+	}
+
+	~PerfCounters() {
+		Close();
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// Returns true if at least one counter could be opened, otherwise LastError() has the reason.
+	bool Open() {
+#ifdef __linux__
+		Close();
+		Fds[to_index(PerfEvent::Cycles)] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		Fds[to_index(PerfEvent::Instructions)] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		Fds[to_index(PerfEvent::L1DMisses)] = OpenEvent(PERF_TYPE_HW_CACHE,
+			CacheConfig(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+		Fds[to_index(PerfEvent::LLCMisses)] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		Fds[to_index(PerfEvent::BranchMisses)] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		Fds[to_index(PerfEvent::DTLBMisses)] = OpenEvent(PERF_TYPE_HW_CACHE,
+			CacheConfig(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+
+		for (int Fd : Fds) {
+			Opened = Opened || Fd >= 0;
+		}
+		if (!Opened) {
+			Error = std::string("perf_event_open failed: ") + std::strerror(errno);
+		}
+#else
+		Error = "perf_event_open is only available on linux";
+#endif
+		return Opened;
+	}
+
+	void Close() {
+#ifdef __linux__
+		for (int& Fd : Fds) {
+			if (Fd >= 0) {
+				close(Fd);
+			}
+			Fd = -1;
+		}
+#endif
+		Opened = false;
+	}
+
+	bool IsOpen() const {
+		return Opened;
+	}
+
+	const std::string& LastError() const {
+		return Error;
+	}
+
+	void Start() {
+#ifdef __linux__
+		if (!Opened) {
+			return;
+		}
+		for (int Fd : Fds) {
+			if (Fd >= 0) {
+				ioctl(Fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(Fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	PerfSample Stop() {
+		PerfSample Result;
+#ifdef __linux__
+		if (!Opened) {
+			return Result;
+		}
+		for (int Fd : Fds) {
+			if (Fd >= 0) {
+				ioctl(Fd, PERF_EVENT_IOC_DISABLE, 0);
+			}
+		}
+		for (size_t i = 0; i < PerfEventN; ++i) {
+			if (Fds[i] < 0) {
+				continue;
+			}
+			uint64_t Data[3]; // value, time_enabled, time_running
+			if (read(Fds[i], Data, sizeof(Data)) != sizeof(Data) || Data[2] == 0) {
+				continue;
+			}
+			Result.Values[i] = Data[2] < Data[1] ? uint64_t(double(Data[0]) * Data[1] / Data[2]) : Data[0];
+			Result.Valid[i] = true;
+		}
+#endif
+		return Result;
+	}
+
+private:
+	static size_t to_index(PerfEvent Event) {
+		return static_cast<size_t>(Event);
+	}
+};
+
+#endif //__PERF_COUNTERS_H_
@@ -0,0 +1,324 @@
+#ifndef __RESULTS_H_
+#define __RESULTS_H_
+
+#include "testbench.h"
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+//
+// Machine readable export of the benchmark results and comparison against a previous run.
+//
+// Every TestRecord is written as-is (1 CSV row / JSON object per test per run).
+// Repeated runs of the same test are aggregated by title and by how many times the title
+// already appeared in that run (the default benchmark runs "Add 1000k" twice per run).
+//
+// A CSV written by one build can be loaded by another build with --compare.
+// A test counts as a regression when its median got slower by more than the threshold
+// and the difference is significant: a one sided Mann-Whitney U test (p < 0.05) when both sides
+// have at least 4 runs, otherwise the fastest new run must be slower than the slowest old run.
+//
+
+struct AggregatedTest {
+	std::string Key;
+	std::string Baseline;
+	TestType Type;
+	int Size;
+	int NodeSize;
+	std::vector<long long> ImplSamples;
+	std::vector<long long> BaseSamples;
+	TestData ImplMin;
+	TestData ImplMedian;
+	TestData BaseMin;
+	TestData BaseMedian;
+};
+
+namespace results {
+
+inline std::string CounterColumn(const char* Side, size_t Index) {
+	std::string Name = std::string(Side) + "_" + PerfEventName(Index);
+	std::replace(Name.begin(), Name.end(), '-', '_');
+	return Name;
+}
+
+inline void WriteCsv(std::ostream& out, const std::vector<TestRecord>& records) {
+	out << "run,title,baseline,type,size,node_size,impl_us,base_us,blocks,ops,impl_p50_ns,impl_p99_ns,impl_p999_ns,sim_misses,impl_peak_rss_kb,base_peak_rss_kb";
+	for (size_t i = 0; i < PerfEventN; ++i) {
+		out << "," << CounterColumn("impl", i);
+	}
+	for (size_t i = 0; i < PerfEventN; ++i) {
+		out << "," << CounterColumn("base", i);
+	}
+	out << "\n";
+
+	for (const TestRecord& r : records) {
+		out << r.Run << ",\"" << r.Title << "\",\"" << r.Baseline << "\"," << TestTypeName(r.Type) << "," << r.Size << "," << r.NodeSize << ","
+			<< r.ImplTime << "," << r.BaseTime << "," << r.Blocks << "," << r.Ops << ","
+			<< r.ImplP50 << "," << r.ImplP99 << "," << r.ImplP999 << "," << r.SimMisses << ","
+			<< r.ImplPeakRss << "," << r.BasePeakRss;
+		// invalid counters are left empty
+		for (size_t i = 0; i < PerfEventN; ++i) {
+			out << ",";
+			if (r.ImplCounters.Valid[i]) {
+				out << r.ImplCounters.Values[i];
+			}
+		}
+		for (size_t i = 0; i < PerfEventN; ++i) {
+			out << ",";
+			if (r.BaseCounters.Valid[i]) {
+				out << r.BaseCounters.Values[i];
+			}
+		}
+		out << "\n";
+	}
+}
+
+inline std::vector<std::string> SplitCsvLine(const std::string& line) {
+	std::vector<std::string> fields;
+	std::string current;
+	bool quoted = false;
+	for (char c : line) {
+		if (c == '"') {
+			quoted = !quoted;
+		}
+		else if (c == ',' && !quoted) {
+			fields.push_back(current);
+			current.clear();
+		}
+		else if (c != '\r') {
+			current += c;
+		}
+	}
+	fields.push_back(current);
+	return fields;
+}
+
+// Returns false if the file could not be read or is not in the format of WriteCsv.
+inline bool ReadCsv(std::istream& in, std::vector<TestRecord>& outRecords) {
+	std::string line;
+	if (!std::getline(in, line)) {
+		return false;
+	}
+	// files written before the peak RSS columns are still accepted
+	const size_t Columns = SplitCsvLine(line).size();
+	size_t Fixed;
+	if (Columns == 16 + 2 * PerfEventN) {
+		Fixed = 16;
+	}
+	else if (Columns == 14 + 2 * PerfEventN) {
+		Fixed = 14;
+	}
+	else {
+		return false;
+	}
+
+	while (std::getline(in, line)) {
+		if (line.empty()) {
+			continue;
+		}
+		std::vector<std::string> f = SplitCsvLine(line);
+		if (f.size() != Columns) {
+			return false;
+		}
+		TestRecord r;
+		// std::sto* throw on a malformed field, the file is then rejected like one with missing columns
+		try {
+			r.Run = std::stoi(f[0]);
+			r.Title = f[1];
+			r.Baseline = f[2];
+			if (!TestTypeFromName(f[3], r.Type)) {
+				return false;
+			}
+			r.Size = std::stoi(f[4]);
+			r.NodeSize = std::stoi(f[5]);
+			r.ImplTime = std::stoll(f[6]);
+			r.BaseTime = std::stoll(f[7]);
+			r.Blocks = std::stoll(f[8]);
+			r.Ops = uint32_t(std::stoul(f[9]));
+			r.ImplP50 = std::stoull(f[10]);
+			r.ImplP99 = std::stoull(f[11]);
+			r.ImplP999 = std::stoull(f[12]);
+			r.SimMisses = std::stoull(f[13]);
+			r.ImplPeakRss = Fixed > 14 ? std::stoll(f[14]) : -1;
+			r.BasePeakRss = Fixed > 14 ? std::stoll(f[15]) : -1;
+			for (size_t i = 0; i < PerfEventN; ++i) {
+				const std::string& impl = f[Fixed + i];
+				const std::string& base = f[Fixed + PerfEventN + i];
+				r.ImplCounters.Valid[i] = !impl.empty();
+				r.ImplCounters.Values[i] = impl.empty() ? 0 : std::stoull(impl);
+				r.BaseCounters.Valid[i] = !base.empty();
+				r.BaseCounters.Values[i] = base.empty() ? 0 : std::stoull(base);
+			}
+		}
+		catch (const std::logic_error&) {
+			return false;
+		}
+		outRecords.push_back(r);
+	}
+	return true;
+}
+
+inline long long Median(std::vector<long long> samples) {
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+	if (n == 0) {
+		return 0;
+	}
+	return n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+inline std::vector<AggregatedTest> Aggregate(const std::vector<TestRecord>& records) {
+	std::vector<AggregatedTest> result;
+	std::map<std::string, size_t> indexOfKey;
+	std::map<std::pair<int, std::string>, int> seenInRun;
+
+	for (const TestRecord& r : records) {
+		std::string title = r.Title + " (" + r.Baseline + ")";
+		int occurrence = ++seenInRun[{ r.Run, title }];
+		std::string key = occurrence == 1 ? title : title + " #" + std::to_string(occurrence);
+
+		auto found = indexOfKey.find(key);
+		if (found == indexOfKey.end()) {
+			found = indexOfKey.insert({ key, result.size() }).first;
+			AggregatedTest test;
+			test.Key = key;
+			test.Baseline = r.Baseline;
+			test.Type = r.Type;
+			test.Size = r.Size;
+			test.NodeSize = r.NodeSize;
+			result.push_back(test);
+		}
+		AggregatedTest& test = result[found->second];
+		test.ImplSamples.push_back(r.ImplTime);
+		test.BaseSamples.push_back(r.BaseTime);
+	}
+
+	for (AggregatedTest& test : result) {
+		const int runs = int(test.ImplSamples.size());
+		test.ImplMin = TestData(*std::min_element(test.ImplSamples.begin(), test.ImplSamples.end()));
+		test.ImplMedian = TestData(Median(test.ImplSamples));
+		test.BaseMin = TestData(*std::min_element(test.BaseSamples.begin(), test.BaseSamples.end()));
+		test.BaseMedian = TestData(Median(test.BaseSamples));
+		test.ImplMin.testsIncluded = test.ImplMedian.testsIncluded = runs;
+		test.BaseMin.testsIncluded = test.BaseMedian.testsIncluded = runs;
+	}
+	return result;
+}
+
+inline std::string JsonEscape(const std::string& str) {
+	std::string result;
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+		}
+		result += c;
+	}
+	return result;
+}
+
+inline void WriteJson(std::ostream& out, const std::vector<TestRecord>& records) {
+	out << "{\n  \"tests\": [\n";
+	for (size_t t = 0; t < records.size(); ++t) {
+		const TestRecord& r = records[t];
+		out << "    { \"run\": " << r.Run << ", \"title\": \"" << JsonEscape(r.Title) << "\", \"baseline\": \"" << JsonEscape(r.Baseline) << "\", \"type\": \"" << TestTypeName(r.Type)
+			<< "\", \"size\": " << r.Size << ", \"node_size\": " << r.NodeSize
+			<< ", \"impl_us\": " << r.ImplTime << ", \"base_us\": " << r.BaseTime << ", \"blocks\": " << r.Blocks
+			<< ", \"ops\": " << r.Ops << ", \"impl_p50_ns\": " << r.ImplP50 << ", \"impl_p99_ns\": " << r.ImplP99
+			<< ", \"impl_p999_ns\": " << r.ImplP999 << ", \"sim_misses\": " << r.SimMisses
+			<< ", \"impl_peak_rss_kb\": " << r.ImplPeakRss << ", \"base_peak_rss_kb\": " << r.BasePeakRss;
+		for (size_t i = 0; i < PerfEventN; ++i) {
+			if (r.ImplCounters.Valid[i]) {
+				out << ", \"" << CounterColumn("impl", i) << "\": " << r.ImplCounters.Values[i];
+			}
+			if (r.BaseCounters.Valid[i]) {
+				out << ", \"" << CounterColumn("base", i) << "\": " << r.BaseCounters.Values[i];
+			}
+		}
+		out << " }" << (t + 1 < records.size() ? "," : "") << "\n";
+	}
+	out << "  ],\n  \"aggregated\": [\n";
+
+	std::vector<AggregatedTest> aggregated = Aggregate(records);
+	for (size_t t = 0; t < aggregated.size(); ++t) {
+		const AggregatedTest& a = aggregated[t];
+		out << "    { \"key\": \"" << JsonEscape(a.Key) << "\", \"baseline\": \"" << JsonEscape(a.Baseline) << "\", \"type\": \"" << TestTypeName(a.Type)
+			<< "\", \"size\": " << a.Size << ", \"node_size\": " << a.NodeSize << ", \"runs\": " << a.ImplMin.testsIncluded
+			<< ", \"impl_min_us\": " << a.ImplMin.Time << ", \"impl_median_us\": " << a.ImplMedian.Time
+			<< ", \"base_min_us\": " << a.BaseMin.Time << ", \"base_median_us\": " << a.BaseMedian.Time << " }"
+			<< (t + 1 < aggregated.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+// One sided p-value for "current is slower than baseline", normal approximation of the U statistic.
+inline double MannWhitneySlowerP(const std::vector<long long>& current, const std::vector<long long>& baseline) {
+	double u = 0;
+	for (long long c : current) {
+		for (long long b : baseline) {
+			u += c > b ? 1.0 : (c == b ? 0.5 : 0.0);
+		}
+	}
+	const double n1 = double(current.size());
+	const double n2 = double(baseline.size());
+	const double mean = n1 * n2 / 2.0;
+	const double sd = std::sqrt(n1 * n2 * (n1 + n2 + 1.0) / 12.0);
+	if (sd == 0) {
+		return 1.0;
+	}
+	const double z = (u - mean) / sd;
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+// Prints a line per test present in both and returns how many regressed.
+inline int Compare(const std::vector<AggregatedTest>& baseline, const std::vector<AggregatedTest>& current, double threshold) {
+	std::map<std::string, const AggregatedTest*> byKey;
+	for (const AggregatedTest& b : baseline) {
+		byKey[b.Key] = &b;
+	}
+
+	int regressions = 0;
+	std::cout << "\nComparison against baseline (threshold " << threshold * 100 << "%):\n";
+	for (const AggregatedTest& c : current) {
+		auto found = byKey.find(c.Key);
+		if (found == byKey.end()) {
+			continue;
+		}
+		const AggregatedTest& b = *found->second;
+		const double change = b.ImplMedian.Time > 0 ? double(c.ImplMedian.Time - b.ImplMedian.Time) / b.ImplMedian.Time : 0.0;
+
+		bool significant;
+		if (c.ImplSamples.size() >= 4 && b.ImplSamples.size() >= 4) {
+			significant = MannWhitneySlowerP(c.ImplSamples, b.ImplSamples) < 0.05;
+		}
+		else {
+			significant = c.ImplMin.Time > *std::max_element(b.ImplSamples.begin(), b.ImplSamples.end());
+		}
+
+		const bool regressed = significant && change > threshold;
+		regressions += regressed ? 1 : 0;
+
+		std::cout << "# " << std::setw(34) << std::left << c.Key << std::right
+			<< " median: " << std::setw(9) << b.ImplMedian.Time << " -> " << std::setw(9) << c.ImplMedian.Time << " us"
+			<< " (" << std::showpos << std::fixed << std::setprecision(1) << change * 100 << "%)" << std::noshowpos
+			<< " min: " << std::setw(9) << c.ImplMin.Time << " us, runs " << c.ImplMin.testsIncluded << "/" << b.ImplMin.testsIncluded
+			<< (regressed ? "  REGRESSION" : "") << "\n";
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+	return regressions;
+}
+
+// Summary of min / median per test, only useful with more than 1 run.
+inline void PrintAggregated(const std::vector<AggregatedTest>& aggregated) {
+	std::cout << "\nAggregated over runs (min / median):\n";
+	for (const AggregatedTest& a : aggregated) {
+		std::cout << "# " << std::setw(34) << std::left << a.Key << std::right
+			<< " Impl: " << std::setw(9) << a.ImplMin.Time << " / " << std::setw(9) << a.ImplMedian.Time << " us"
+			<< " | Base: " << std::setw(9) << a.BaseMin.Time << " / " << std::setw(9) << a.BaseMedian.Time << " us"
+			<< " (" << a.ImplMin.testsIncluded << " runs)\n";
+	}
+}
+
+}
+
+#endif //__RESULTS_H_
@@ -0,0 +1,306 @@
+#ifndef __SHARDED_TREE_H_
+#define __SHARDED_TREE_H_
+
+#include "tree.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+//
+// Range partitioned tree for concurrent writers: the key space is split over independent Trees (shards),
+// every shard has its own spin lock and allocates its own nodes, so writers on different ranges never touch
+// the same memory.
+//
+// Point operations route with a binary search over the separator keys of the current Layout.
+// Layouts are immutable, a split publishes a new one. An operation that routed with an old layout notices it
+// under the shard lock (the key is outside the range of the shard) and routes again.
+// Shards are only ever split, never freed, so a shard pointer read from any layout stays valid.
+//
+// Hot shards are split at their median key by rebalance(), either called directly or every
+// rebalanceEvery operations of a shard (setAutoRebalance).
+//
+
+// Test and test-and-set, spins on a plain load so waiting threads do not bounce the cache line.
+struct SpinLock {
+	std::atomic<bool> locked{ false };
+
+	void lock() {
+		for (int spins = 0; locked.exchange(true, std::memory_order_acquire); ++spins) {
+			while (locked.load(std::memory_order_relaxed)) {
+				if (++spins > 64) {
+					std::this_thread::yield();
+				}
+			}
+		}
+	}
+
+	void unlock() {
+		locked.store(false, std::memory_order_release);
+	}
+};
+
+template<typename KeyType, typename DataType, uint N = 10>
+struct ShardedTree {
+	typedef Tree<KeyType, DataType, N> TTree;
+
+	// Shards smaller than this are not split even when hot.
+	static constexpr uint MinSplitSize = 1024;
+
+	explicit ShardedTree(const std::vector<KeyType>& separators = std::vector<KeyType>(), uint maxShards = 256)
+		: maxShards(maxShards)
+		, rebalanceEvery(0) {
+		Layout* initial = new Layout();
+		initial->separators = separators;
+		std::sort(initial->separators.begin(), initial->separators.end());
+		for (size_t i = 0; i <= initial->separators.size(); ++i) {
+			Shard* shard = newShard();
+			shard->hasLow = i > 0;
+			shard->hasHigh = i < initial->separators.size();
+			if (shard->hasLow) {
+				shard->low = initial->separators[i - 1];
+			}
+			if (shard->hasHigh) {
+				shard->high = initial->separators[i];
+			}
+			initial->shards.push_back(shard);
+		}
+		layouts.emplace_back(initial);
+		layout.store(initial, std::memory_order_release);
+	}
+
+	ShardedTree(const ShardedTree&) = delete;
+	ShardedTree& operator=(const ShardedTree&) = delete;
+
+	// Every shard with more than 2x the average operations since the last rebalance gets split,
+	// checked by the thread that completes the everyOps-th operation of a shard. 0 turns it off.
+	void setAutoRebalance(uint64_t everyOps) {
+		rebalanceEvery = everyOps;
+	}
+
+	bool set(const KeyType& key, DataType* data) {
+		return withShard(key, [&](TTree& tree) { return tree.set(key, data); });
+	}
+
+	bool maybe_add(const KeyType& key, DataType* data) {
+		return withShard(key, [&](TTree& tree) { return tree.maybe_add(key, data); });
+	}
+
+	bool get(const KeyType& key, DataType*& outData) {
+		return withShard(key, [&](TTree& tree) { return tree.get(key, outData); });
+	}
+
+	bool remove(const KeyType& key) {
+		return withShard(key, [&](TTree& tree) { return tree.remove(key); });
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped) {
+		return withShard(key, [&](TTree& tree) { return tree.removePop(key, popped); });
+	}
+
+	// Not a snapshot while other threads write.
+	size_t size() const {
+		size_t total = 0;
+		for (Shard* shard : layout.load(std::memory_order_acquire)->shards) {
+			std::lock_guard<SpinLock> guard(shard->lock);
+			total += shard->tree->size();
+		}
+		return total;
+	}
+
+	uint shardCount() const {
+		return uint(layout.load(std::memory_order_acquire)->shards.size());
+	}
+
+	// Ordered scan: f(key, data) for up to count elements with keys >= key. Shards are disjoint and ordered,
+	// so merging their iterators is walking them one after the other, each under its own lock.
+	// The next shard is looked up by the upper bound of the last one, which also covers splits during the scan.
+	template<typename F>
+	void scan(const KeyType& key, size_t count, F f) {
+		KeyType from = key;
+		while (count > 0) {
+			Shard* shard = lockShard(from);
+			auto it = shard->tree->find(from);
+			if (!it.exists) {
+				// find stops at the largest smaller key
+				++it;
+			}
+			for (; it.isValid() && count > 0; ++it) {
+				f(it.key(), it.value());
+				--count;
+			}
+			const bool last = !shard->hasHigh;
+			if (!last) {
+				from = shard->high;
+			}
+			shard->lock.unlock();
+			if (last) {
+				break;
+			}
+		}
+	}
+
+	// f(key, data) for every element in order.
+	template<typename F>
+	void forEach(F f) {
+		Shard* shard = layout.load(std::memory_order_acquire)->shards.front();
+		shard->lock.lock();
+		while (true) {
+			for (auto it = shard->tree->first(); it.isValid(); ++it) {
+				f(it.key(), it.value());
+			}
+			if (!shard->hasHigh) {
+				shard->lock.unlock();
+				return;
+			}
+			KeyType from = shard->high;
+			shard->lock.unlock();
+			shard = lockShard(from);
+		}
+	}
+
+	// Splits the shards that got more than 2x the average operations since the last call (or more than half of
+	// all operations) at their median key.
+	// Returns the number of splits. Concurrent calls return 0 right away.
+	uint rebalance() {
+		std::unique_lock<std::mutex> guard(rebalanceMutex, std::try_to_lock);
+		if (!guard.owns_lock()) {
+			return 0;
+		}
+		const Layout* current = layout.load(std::memory_order_acquire);
+		uint64_t totalOps = 0;
+		std::vector<uint64_t> ops;
+		for (Shard* shard : current->shards) {
+			ops.push_back(shard->ops.exchange(0, std::memory_order_relaxed));
+			totalOps += ops.back();
+		}
+		const double average = double(totalOps) / current->shards.size();
+
+		uint splits = 0;
+		for (size_t i = 0; i < ops.size(); ++i) {
+			if (current->shards.size() + splits >= maxShards) {
+				break;
+			}
+			const bool hot = ops[i] > 2 * average || 2 * ops[i] > totalOps;
+			if (hot && split(current->shards[i])) {
+				++splits;
+			}
+		}
+		return splits;
+	}
+
+	~ShardedTree() {
+		for (Shard* shard : allShards) {
+			delete shard;
+		}
+	}
+
+private:
+	struct alignas(64) Shard {
+		SpinLock lock;
+		std::unique_ptr<TTree> tree;
+		std::atomic<uint64_t> ops{ 0 };
+		// keys in [low, high), missing bounds are open
+		KeyType low;
+		KeyType high;
+		bool hasLow = false;
+		bool hasHigh = false;
+
+		bool owns(const KeyType& key) const {
+			return (!hasLow || !(key < low)) && (!hasHigh || key < high);
+		}
+	};
+
+	struct Layout {
+		std::vector<KeyType> separators;	// shards[i] holds keys in [separators[i - 1], separators[i])
+		std::vector<Shard*> shards;
+
+		Shard* route(const KeyType& key) const {
+			return shards[std::upper_bound(separators.begin(), separators.end(), key) - separators.begin()];
+		}
+	};
+
+	std::atomic<const Layout*> layout;
+	std::vector<std::unique_ptr<Layout>> layouts;	// every layout ever published, readers may still hold old ones
+	std::vector<Shard*> allShards;
+	std::mutex rebalanceMutex;
+	uint maxShards;
+	uint64_t rebalanceEvery;
+
+	Shard* newShard() {
+		Shard* shard = new Shard();
+		shard->tree.reset(new TTree());
+		allShards.push_back(shard);
+		return shard;
+	}
+
+	// Returns the shard owning key, locked.
+	Shard* lockShard(const KeyType& key) {
+		while (true) {
+			Shard* shard = layout.load(std::memory_order_acquire)->route(key);
+			shard->lock.lock();
+			if (shard->owns(key)) {
+				return shard;
+			}
+			// split since we routed
+			shard->lock.unlock();
+		}
+	}
+
+	template<typename F>
+	auto withShard(const KeyType& key, F f) {
+		Shard* shard = lockShard(key);
+		auto result = f(*shard->tree);
+		const uint64_t ops = shard->ops.fetch_add(1, std::memory_order_relaxed) + 1;
+		shard->lock.unlock();
+		if (rebalanceEvery && ops % rebalanceEvery == 0) {
+			rebalance();
+		}
+		return result;
+	}
+
+	// Moves the upper half of shard into a new shard and publishes the layout with it. Needs rebalanceMutex.
+	bool split(Shard* shard) {
+		std::lock_guard<SpinLock> guard(shard->lock);
+		TTree& tree = *shard->tree;
+		if (tree.size() < MinSplitSize) {
+			return false;
+		}
+
+		// both halves are rebuilt with appends, which fills their leaves completely
+		std::unique_ptr<TTree> lower(new TTree());
+		Shard* upper = newShard();
+		upper->lock.lock();
+		const uint half = tree.size() / 2;
+		uint index = 0;
+		KeyType median;
+		for (auto it = tree.first(); it.isValid(); ++it, ++index) {
+			if (index == half) {
+				median = it.key();
+			}
+			(index < half ? *lower : *upper->tree).set(it.key(), it.value());
+		}
+
+		upper->low = median;
+		upper->hasLow = true;
+		upper->high = shard->high;
+		upper->hasHigh = shard->hasHigh;
+		shard->high = median;
+		shard->hasHigh = true;
+		shard->tree.swap(lower);
+
+		const Layout* current = layout.load(std::memory_order_acquire);
+		Layout* next = new Layout(*current);
+		const size_t position = std::find(next->shards.begin(), next->shards.end(), shard) - next->shards.begin();
+		next->shards.insert(next->shards.begin() + position + 1, upper);
+		next->separators.insert(next->separators.begin() + position, median);
+		layouts.emplace_back(next);
+		layout.store(next, std::memory_order_release);
+		upper->lock.unlock();
+		return true;
+	}
+};
+
+#endif // __SHARDED_TREE_H_
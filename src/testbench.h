@@ -10,19 +10,32 @@
 #include <string>
 #include <set>
 #include <sstream>
-
-#ifdef USE_CHRONO
+#include <cstdint>
 #include <chrono>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+#include "perf_counters.h"
+#include "io_sim.h"
+
 namespace ch = std::chrono;
-#else 
+
+#ifndef USE_CHRONO
 #include <sys/time.h>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC 1
+#endif
+
 enum class TestType : int {
 	Add = 0,
 	Get,
 	Del,
 	Iterate,
+	Workload,
 	E_LAST
 };
 
@@ -32,9 +45,31 @@ constexpr auto to_underlying(E e) noexcept {
 }
 constexpr size_t TestTypeN = to_underlying(TestType::E_LAST);
 
+inline const char* TestTypeName(TestType type) {
+	switch (type) {
+	case TestType::Add:			return "add";
+	case TestType::Get:			return "get";
+	case TestType::Del:			return "del";
+	case TestType::Iterate:		return "iterate";
+	case TestType::Workload:	return "workload";
+	default:					return "?";
+	}
+}
+
+inline bool TestTypeFromName(const std::string& name, TestType& out) {
+	for (int i = 0; i < static_cast<int>(TestTypeN); ++i) {
+		if (name == TestTypeName(static_cast<TestType>(i))) {
+			out = static_cast<TestType>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
 struct TestInfo {
 	TestType type;
 	int LeafSize;
+	int Size;	// number of elements / operations in the test
 };
 
 // All the data our Benchmark should store for 1 test.
@@ -48,18 +83,184 @@ struct TestData {
 		, testsIncluded(0) {}
 
 	TestData(long long time)
-		: Time(time) {}
+		: Time(time)
+		, testsIncluded(1) {}
 };
 
 void operator+=(TestData& rhs, const TestData& lhs) {
 	rhs.Time += lhs.Time;
-	rhs.testsIncluded++;
+	rhs.testsIncluded += lhs.testsIncluded;
 }
 
 bool operator<(TestData& rhs, const TestData& lhs) {
 	return rhs.Time < lhs.Time;
 }
 
+// Cheap timestamp for per operation timings.
+// Uses rdtsc where available, ticks are converted to ns only when printing.
+struct CycleClock {
+	static uint64_t Now() {
+#ifdef HAS_RDTSC
+		return __rdtsc();
+#else
+		return ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Calibrated once against steady_clock on first use.
+	static double NanosPerTick() {
+#ifdef HAS_RDTSC
+		static const double Ratio = [] {
+			auto WallStart = ch::steady_clock::now();
+			uint64_t TickStart = __rdtsc();
+			while (ch::steady_clock::now() - WallStart < ch::milliseconds(20)) {}
+			uint64_t Ticks = __rdtsc() - TickStart;
+			long long Nanos = ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now() - WallStart).count();
+			return Ticks > 0 ? double(Nanos) / Ticks : 1.0;
+		}();
+		return Ratio;
+#else
+		return 1.0;
+#endif
+	}
+};
+
+// Resident set size of the process from /proc/self/status, in kB. -1 where not available.
+// The peak (VmHWM) can be reset through /proc/self/clear_refs so it can be read per phase.
+struct MemoryUsage {
+	static long long PeakKb() {
+		return ReadStatus("VmHWM:");
+	}
+
+	static long long CurrentKb() {
+		return ReadStatus("VmRSS:");
+	}
+
+	// Returns false when the peak can not be reset, PeakKb() is then the peak of the whole process.
+	static bool ResetPeak() {
+#ifdef __linux__
+		std::ofstream ClearRefs("/proc/self/clear_refs");
+		ClearRefs << "5";
+		ClearRefs.flush();
+		return bool(ClearRefs);
+#else
+		return false;
+#endif
+	}
+
+private:
+	static long long ReadStatus(const char* Field) {
+#ifdef __linux__
+		std::ifstream Status("/proc/self/status");
+		std::string Line;
+		const size_t Length = std::strlen(Field);
+		while (std::getline(Status, Line)) {
+			if (Line.compare(0, Length, Field) == 0) {
+				return std::atoll(Line.c_str() + Length);
+			}
+		}
+#endif
+		return -1;
+	}
+};
+
+// HDR style histogram: values below 2^SubBits get their own bucket, above that every power of 2
+// is split into 2^SubBits linear sub buckets. That keeps the relative error under 1 / 2^SubBits (~3%)
+// for any value with a fixed number of buckets.
+struct LatencyHistogram {
+	static constexpr int SubBits = 5;
+	static constexpr int SubCount = 1 << SubBits;
+	static constexpr int BucketCount = SubCount * (64 - SubBits + 1);
+
+	std::vector<uint64_t> Counts;
+	uint64_t TotalCount;
+	uint64_t MaxValue;
+
+	LatencyHistogram()
+		: Counts(BucketCount, 0)
+		, TotalCount(0)
+		, MaxValue(0) {}
+
+	static int BucketOf(uint64_t Value) {
+		if (Value < SubCount) {
+			return int(Value);
+		}
+		int Msb = 63 - __builtin_clzll(Value);
+		int Shift = Msb - SubBits;
+		int Sub = int(Value >> Shift) - SubCount;
+		return SubCount + Shift * SubCount + Sub;
+	}
+
+	// Largest value that maps to the bucket.
+	static uint64_t BucketTop(int Bucket) {
+		if (Bucket < SubCount) {
+			return uint64_t(Bucket);
+		}
+		int Shift = Bucket / SubCount - 1;
+		uint64_t Sub = Bucket % SubCount;
+		return ((SubCount + Sub + 1) << Shift) - 1;
+	}
+
+	void Record(uint64_t Value) {
+		Counts[BucketOf(Value)]++;
+		TotalCount++;
+		MaxValue = std::max(MaxValue, Value);
+	}
+
+	void Merge(const LatencyHistogram& Other) {
+		for (int i = 0; i < BucketCount; ++i) {
+			Counts[i] += Other.Counts[i];
+		}
+		TotalCount += Other.TotalCount;
+		MaxValue = std::max(MaxValue, Other.MaxValue);
+	}
+
+	void Clear() {
+		std::fill(Counts.begin(), Counts.end(), 0);
+		TotalCount = 0;
+		MaxValue = 0;
+	}
+
+	// Percentile in [0, 100]
+	uint64_t ValueAt(double Percentile) const {
+		if (TotalCount == 0) {
+			return 0;
+		}
+		uint64_t Rank = uint64_t(std::ceil(Percentile / 100.0 * TotalCount));
+		Rank = std::max<uint64_t>(Rank, 1);
+		uint64_t Seen = 0;
+		for (int i = 0; i < BucketCount; ++i) {
+			Seen += Counts[i];
+			if (Seen >= Rank) {
+				return std::min(BucketTop(i), MaxValue);
+			}
+		}
+		return MaxValue;
+	}
+};
+
+// Everything recorded for 1 test, flattened for export. Times in us, latencies in ns.
+struct TestRecord {
+	int Run;
+	std::string Title;
+	std::string Baseline;
+	TestType Type;
+	int Size;
+	int NodeSize;
+	long long ImplTime;
+	long long BaseTime;
+	long long Blocks;
+	uint32_t Ops;
+	uint64_t ImplP50;
+	uint64_t ImplP99;
+	uint64_t ImplP999;
+	uint64_t SimMisses;	// last level of the I/O simulator, 0 without one
+	long long ImplPeakRss;	// kB, -1 if unknown
+	long long BasePeakRss;
+	PerfSample ImplCounters;
+	PerfSample BaseCounters;
+};
+
 // Struct to hold the benchmark results.
 // Implementation can switch between chrono / unix time through defining USE_CHRONO.
 
@@ -67,16 +268,68 @@ struct Benchmark {
 
 private:
 	std::vector<TestData> ImplTime;
-	std::vector<TestData> LedaTime;
+	std::vector<TestData> BaseTime;
 	std::vector<long long> BlockReads;
 	std::vector<TestInfo> tests;
+	std::vector<std::string> Titles;
+	std::vector<std::string> Baselines;
+	std::vector<int> Runs;
+	int CurrentRun = 0;
+	std::string CurrentBaseline = "LEDA";
+
+	std::vector<LatencyHistogram> ImplLatency;
+	std::vector<LatencyHistogram> BaseLatency;
+	LatencyHistogram CurrentLatency;
+	uint32_t OpCounter = 0;
+
+	// Operations are counted through SampleOp(), phases that do not sample report 0.
+	std::vector<uint32_t> ImplOps;
+	std::vector<uint32_t> BaseOps;
+
+	PerfCounters Counters;
+	std::vector<PerfSample> ImplCounters;
+	std::vector<PerfSample> BaseCounters;
+
+	// Optional, fed by INCR_BLOCKS. Misses are reported per level for the tree phases.
+	std::unique_ptr<IoSimulator> Sim;
+	std::vector<std::vector<uint64_t>> SimMisses;
+
+	// Peak RSS in kB during each phase. Both containers stay alive during both phases,
+	// so the difference between the sides is what the measured phase itself added.
+	std::vector<long long> ImplPeakRss;
+	std::vector<long long> BasePeakRss;
 
 public:
 	long long CurrentBenchBlocks;
 
+	// Only 1 in SampleEvery operations gets timed, keeps the overhead low enough to always stay on.
+	// Must be a power of 2.
+	static constexpr uint32_t SampleEvery = 32;
+
+	// Times a single operation when it is selected for sampling. Use as a scoped object inside the loop body:
+	//		for (...) { auto Sample = bench.SampleOp(); tree.set(...); }
+	struct OpSample {
+		LatencyHistogram* Target;
+		uint64_t Start;
+
+		OpSample(LatencyHistogram* Target)
+			: Target(Target)
+			, Start(Target ? CycleClock::Now() : 0) {}
+
+		~OpSample() {
+			if (Target) {
+				Target->Record(CycleClock::Now() - Start);
+			}
+		}
+	};
+
+	OpSample SampleOp() {
+		return OpSample((++OpCounter & (SampleEvery - 1)) == 0 ? &CurrentLatency : nullptr);
+	}
+
 private:
 	static std::string TimestepStr() {
-		return " ms";
+		return " us";
 	}
 
 #ifdef USE_CHRONO
@@ -86,7 +339,7 @@ private:
 	}
 
 	long long GetCurrent() const {
-		return ch::duration_cast<ch::milliseconds>(ch::system_clock::now() - StartTime).count();
+		return ch::duration_cast<ch::microseconds>(ch::system_clock::now() - StartTime).count();
 	}
 #else
 	struct timeval StartTime;
@@ -113,90 +366,308 @@ private:
 
 public:
 
+	static std::string CompactStr(double Value) {
+		const char* Suffix[] = { "", "k", "M", "G", "T" };
+		int i = 0;
+		while (Value >= 1000.0 && i < 4) {
+			Value /= 1000.0;
+			++i;
+		}
+		if (i == 0) {
+			return std::to_string((long long)Value);
+		}
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(Value < 10.0 ? 2 : 1) << Value << Suffix[i];
+		return ss.str();
+	}
+
+	// Internal, prints hardware counters of a phase as totals and per operation.
+	void PrintCounterLine(const std::string& Side, const PerfSample& Sample, uint32_t Ops) {
+		if (!Sample.Any()) {
+			return;
+		}
+		std::cout << "#   " << std::setw(16) << std::left << "counters" << std::right << " " << Side << ": ";
+		for (size_t i = 0; i < PerfEventN; ++i) {
+			if (!Sample.Valid[i]) {
+				continue;
+			}
+			std::cout << PerfEventName(i) << " " << CompactStr(double(Sample.Values[i]));
+			if (Ops > 0) {
+				std::cout << " (" << std::fixed << std::setprecision(2) << double(Sample.Values[i]) / Ops << "/op)";
+				std::cout.unsetf(std::ios_base::floatfield);
+			}
+			std::cout << "  ";
+		}
+		std::cout << "\n";
+	}
+
+	// Internal, prints the simulated misses of every level.
+	void PrintSimLine(const std::vector<uint64_t>& Misses) {
+		if (!Sim || Misses.empty()) {
+			return;
+		}
+		std::cout << "#   " << std::setw(16) << std::left << "io-sim misses" << std::right << " Impl: ";
+		for (size_t l = 0; l < Misses.size(); ++l) {
+			std::cout << (l > 0 ? " | " : "") << Sim->LevelName(l) << ": " << CompactStr(double(Misses[l]));
+		}
+		std::cout << "\n";
+	}
+
+	void PrintRssLine(const std::string& BaseName, long long ImplKb, long long BaseKb) {
+		if (ImplKb < 0 && BaseKb < 0) {
+			return;
+		}
+		std::cout << "#   " << std::setw(16) << std::left << "peak RSS (MB)" << std::right
+			<< " Impl: " << std::setw(8) << ImplKb / 1024 << " | " << BaseName << ": " << std::setw(8) << BaseKb / 1024 << "\n";
+	}
+
+	// Internal, prints the tail percentiles of both histograms in ns.
+	void PrintLatencyLine(const std::string& BaseName, const LatencyHistogram& Impl, const LatencyHistogram& Base) {
+		if (Impl.TotalCount == 0 && Base.TotalCount == 0) {
+			return;
+		}
+		const double Scale = CycleClock::NanosPerTick();
+		auto PrintPercentiles = [&](const LatencyHistogram& Hist) {
+			const double Percentiles[] = { 50, 90, 99, 99.9 };
+			const char* Names[] = { "p50", "p90", "p99", "p99.9" };
+			for (int i = 0; i < 4; ++i) {
+				std::cout << Names[i] << " " << std::setw(6) << (long long)(Hist.ValueAt(Percentiles[i]) * Scale) << " ";
+			}
+			std::cout << "max " << std::setw(8) << (long long)(Hist.MaxValue * Scale);
+		};
+
+		std::cout << "#   " << std::setw(16) << std::left << "latency (ns)" << std::right << " Impl: ";
+		PrintPercentiles(Impl);
+		std::cout << " | " << BaseName << ": ";
+		PrintPercentiles(Base);
+		std::cout << "\n";
+	}
+
 	// Internal,  formats and prints a line with 2 times and their difference.
-	void PrintBenchLine(const std::string& Title, TestData Impl, TestData Leda, long long Blocks) {
+	void PrintBenchLine(const std::string& Title, const std::string& BaseName, TestData Impl, TestData Base, long long Blocks) {
 		std::string BlockStr = Blocks > 0 ? "\tBlocks Accessed: " + std::to_string(Blocks / 1000) + "k" : "";
 
 		std::cout << std::right;
 		std::cout << "# " << std::setw(18) << std::left << Title << " Impl: " << std::right << std::setw(7) << Impl.Time << TimestepStr() << " | "
-			"LEDA: " << std::setw(7) << Leda.Time << TimestepStr() << " => Diff: " << std::setw(6) << Leda.Time - Impl.Time << " " << BlockStr << "\n";
+			<< BaseName << ": " << std::setw(7) << Base.Time << TimestepStr() << " => Diff: " << std::setw(6) << Base.Time - Impl.Time << " " << BlockStr << "\n";
 	}
 
 public:
 
 	void Reset() {
 		ImplTime.clear();
-		LedaTime.clear();
+		BaseTime.clear();
+		ImplLatency.clear();
+		BaseLatency.clear();
+		ImplOps.clear();
+		BaseOps.clear();
+		ImplCounters.clear();
+		BaseCounters.clear();
+		BlockReads.clear();
+		tests.clear();
+		Titles.clear();
+		Baselines.clear();
+		Runs.clear();
+		SimMisses.clear();
+		ImplPeakRss.clear();
+		BasePeakRss.clear();
+		CurrentRun = 0;
+	}
+
+	// Try to open the hardware counters, every test after this reports them.
+	// Returns false (and the benchmark runs without counters) when they are not permitted.
+	bool EnableCounters() {
+		return Counters.Open();
+	}
+
+	const std::string& CountersError() const {
+		return Counters.LastError();
+	}
+
+	// Route every counted block through the simulator. Timings of the tree include the simulation cost.
+	void SetIoSimulator(std::unique_ptr<IoSimulator> Simulator) {
+		Sim = std::move(Simulator);
+	}
+
+	// Set by worker threads of the concurrent benchmarks, the block counter and the simulator are single threaded.
+	static inline thread_local bool IgnoreBlocks = false;
+
+	// Called through INCR_BLOCKS
+	void AccessBlock(const void* Address, size_t Size) {
+		if (IgnoreBlocks) {
+			return;
+		}
+		++CurrentBenchBlocks;
+		if (Sim && Address) {
+			Sim->Access(Address, Size);
+		}
 	}
 
 	void StartTest() {
 		CurrentBenchBlocks = 0;
+		CurrentLatency.Clear();
+		OpCounter = 0;
+		if (Sim) {
+			Sim->ResetCounters();
+		}
+		MemoryUsage::ResetPeak();
+		Counters.Start();
 		RestartTimer();
 	}
 
-	void StopLeda() {
+	void StopBaseline() {
 		long long Duration = GetCurrent();
-		LedaTime.push_back(TestData(Duration));
+		BaseCounters.push_back(Counters.Stop());
+		BaseTime.push_back(TestData(Duration));
+		BaseLatency.push_back(CurrentLatency);
+		BaseOps.push_back(OpCounter);
+		BasePeakRss.push_back(MemoryUsage::PeakKb());
 	}
 
     void StopImpl() {
 		long long Duration = GetCurrent();
+		ImplCounters.push_back(Counters.Stop());
 		ImplTime.push_back(TestData(Duration));
 		BlockReads.push_back(CurrentBenchBlocks);
+		ImplLatency.push_back(CurrentLatency);
+		ImplOps.push_back(OpCounter);
+		SimMisses.push_back(Sim ? Sim->Misses : std::vector<uint64_t>());
+		ImplPeakRss.push_back(MemoryUsage::PeakKb());
 	}
 
-	// Print the last added test.
-	void PrintLast(TestInfo Info, const std::string& Title) {
-		tests.push_back(Info);
-		size_t Index = ImplTime.size() - 1;
-		PrintBenchLine(Title, ImplTime[Index], LedaTime[Index], BlockReads[Index]);
+	// Name of the dictionary the following tests compare against, used in all output.
+	void SetBaseline(const std::string& Name) {
+		CurrentBaseline = Name;
 	}
 
-	// Calculate and print total stats.
-	void Print() {
-        bool ContainsInvalidResult = false;
-		TestData ImplTotal;
-		TestData LedaTotal;
-		long long BlocksTotal = 0;
-
-		std::array<TestData, TestTypeN> ImplPerType;
-		std::array<TestData, TestTypeN> LedaPerType;
-		std::array<long long, TestTypeN> BlocksPerType = {0};
-
-
+	// Tests added after this call are tagged with the next run index, used for repeated runs of the same tests.
+	void NextRun() {
+		++CurrentRun;
+	}
 
-		for (int i = 0; i < ImplTime.size(); ++i) {
-			ImplTotal += ImplTime[i];
-			LedaTotal += LedaTime[i];
-			BlocksTotal += BlockReads[i];
+	int RunCount() const {
+		return CurrentRun + 1;
+	}
 
-			ImplPerType[to_underlying(tests[i].type)] += ImplTime[i];
-			LedaPerType[to_underlying(tests[i].type)] += LedaTime[i];
-			BlocksPerType[to_underlying(tests[i].type)] += BlockReads[i];
+	std::vector<TestRecord> Records() const {
+		std::vector<TestRecord> Result;
+		const double Scale = CycleClock::NanosPerTick();
+		for (size_t i = 0; i < tests.size(); ++i) {
+			TestRecord Record;
+			Record.Run = Runs[i];
+			Record.Title = Titles[i];
+			Record.Baseline = Baselines[i];
+			Record.Type = tests[i].type;
+			Record.Size = tests[i].Size;
+			Record.NodeSize = tests[i].LeafSize;
+			Record.ImplTime = ImplTime[i].Time;
+			Record.BaseTime = BaseTime[i].Time;
+			Record.Blocks = BlockReads[i];
+			Record.Ops = ImplOps[i];
+			Record.ImplP50 = uint64_t(ImplLatency[i].ValueAt(50) * Scale);
+			Record.ImplP99 = uint64_t(ImplLatency[i].ValueAt(99) * Scale);
+			Record.ImplP999 = uint64_t(ImplLatency[i].ValueAt(99.9) * Scale);
+			Record.SimMisses = SimMisses[i].empty() ? 0 : SimMisses[i].back();
+			Record.ImplPeakRss = ImplPeakRss[i];
+			Record.BasePeakRss = BasePeakRss[i];
+			Record.ImplCounters = ImplCounters[i];
+			Record.BaseCounters = BaseCounters[i];
+			Result.push_back(Record);
 		}
+		return Result;
+	}
 
-		std::cout << "\n";
-		PrintBenchLine("Totals: ", ImplTotal, LedaTotal, BlocksTotal);
+	// Print the last added test.
+	void PrintLast(TestInfo Info, const std::string& Title) {
+		tests.push_back(Info);
+		Titles.push_back(Title);
+		Baselines.push_back(CurrentBaseline);
+		Runs.push_back(CurrentRun);
+		size_t Index = ImplTime.size() - 1;
+		PrintBenchLine(Title, CurrentBaseline, ImplTime[Index], BaseTime[Index], BlockReads[Index]);
+		PrintLatencyLine(CurrentBaseline, ImplLatency[Index], BaseLatency[Index]);
+		PrintCounterLine("Impl", ImplCounters[Index], ImplOps[Index]);
+		PrintCounterLine(CurrentBaseline, BaseCounters[Index], BaseOps[Index]);
+		PrintSimLine(SimMisses[Index]);
+		PrintRssLine(CurrentBaseline, ImplPeakRss[Index], BasePeakRss[Index]);
+	}
 
-		PrintBenchLine("Get: ", 
-					   ImplPerType[to_underlying(TestType::Get)], 
-					   LedaPerType[to_underlying(TestType::Get)], 
-					   BlocksPerType[to_underlying(TestType::Get)]);
+private:
+	// Sum of all tests of 1 type.
+	struct TypeTotals {
+		TestData Impl;
+		TestData Base;
+		long long Blocks = 0;
+		LatencyHistogram ImplLatency;
+		LatencyHistogram BaseLatency;
+		PerfSample ImplCounters;
+		PerfSample BaseCounters;
+		uint32_t ImplOps = 0;
+		uint32_t BaseOps = 0;
+		std::vector<uint64_t> SimMisses;
+	};
 
-		PrintBenchLine("Add: ", 
-					   ImplPerType[to_underlying(TestType::Add)], 
-					   LedaPerType[to_underlying(TestType::Add)], 
-					   BlocksPerType[to_underlying(TestType::Add)]);
+	void PrintTotals(const std::string& Title, const std::string& BaseName, const TypeTotals& Totals) {
+		PrintBenchLine(Title, BaseName, Totals.Impl, Totals.Base, Totals.Blocks);
+		PrintLatencyLine(BaseName, Totals.ImplLatency, Totals.BaseLatency);
+		PrintCounterLine("Impl", Totals.ImplCounters, Totals.ImplOps);
+		PrintCounterLine(BaseName, Totals.BaseCounters, Totals.BaseOps);
+		PrintSimLine(Totals.SimMisses);
+	}
 
-		PrintBenchLine("Del: ", 
-					   ImplPerType[to_underlying(TestType::Del)], 
-					   LedaPerType[to_underlying(TestType::Del)], 
-					   BlocksPerType[to_underlying(TestType::Del)]);
+public:
+	// Calculate and print total stats, once for every baseline that was tested.
+	void Print() {
+		std::vector<std::string> BaseNames;
+		for (const std::string& Name : Baselines) {
+			if (std::find(BaseNames.begin(), BaseNames.end(), Name) == BaseNames.end()) {
+				BaseNames.push_back(Name);
+			}
+		}
 
-		PrintBenchLine("Iter: ", 
-					   ImplPerType[to_underlying(TestType::Iterate)], 
-					   LedaPerType[to_underlying(TestType::Iterate)], 
-					   BlocksPerType[to_underlying(TestType::Iterate)]);
+		for (const std::string& BaseName : BaseNames) {
+			TypeTotals Total;
+			std::array<TypeTotals, TestTypeN> PerType;
+
+			for (size_t i = 0; i < tests.size(); ++i) {
+				if (Baselines[i] != BaseName) {
+					continue;
+				}
+				TypeTotals& Type = PerType[to_underlying(tests[i].type)];
+				for (TypeTotals* Target : { &Total, &Type }) {
+					Target->Impl += ImplTime[i];
+					Target->Base += BaseTime[i];
+					Target->Blocks += BlockReads[i];
+					Target->ImplLatency.Merge(ImplLatency[i]);
+					Target->BaseLatency.Merge(BaseLatency[i]);
+					Target->ImplCounters += ImplCounters[i];
+					Target->BaseCounters += BaseCounters[i];
+					Target->ImplOps += ImplOps[i];
+					Target->BaseOps += BaseOps[i];
+					Target->SimMisses.resize(SimMisses[i].size(), 0);
+					for (size_t l = 0; l < SimMisses[i].size(); ++l) {
+						Target->SimMisses[l] += SimMisses[i][l];
+					}
+				}
+			}
+
+			std::cout << "\n";
+			PrintBenchLine("Totals: ", BaseName, Total.Impl, Total.Base, Total.Blocks);
+
+			const std::pair<TestType, const char*> Order[] = {
+				{ TestType::Get, "Get: " },
+				{ TestType::Add, "Add: " },
+				{ TestType::Del, "Del: " },
+				{ TestType::Iterate, "Iter: " },
+				{ TestType::Workload, "Workload: " }
+			};
+			for (const auto& Entry : Order) {
+				const TypeTotals& Type = PerType[to_underlying(Entry.first)];
+				if (Type.Impl.testsIncluded > 0) {
+					PrintTotals(Entry.second, BaseName, Type);
+				}
+			}
+		}
 	}
 };
 
@@ -265,7 +736,11 @@ struct AggregateTimer {
 
 #ifdef DECLARE_EXTERN_TESTBENCH_VARS
 # if COUNT_BLOCKS
-#  define INCR_BLOCKS() do{ ++bench.CurrentBenchBlocks; }while(0)
+// The null check goes through a const void* so INCR_BLOCKS(this) does not compare 'this' to null.
+inline bool IsNullBlock(const void* Address) {
+	return Address == nullptr;
+}
+#  define INCR_BLOCKS(node) do{ bench.AccessBlock(node, IsNullBlock(node) ? 0 : (node)->allocatedBytes()); }while(0)
 # endif
 extern AggregateTimer timer;
 extern Benchmark bench;
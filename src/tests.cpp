@@ -1,9 +1,22 @@
 #ifdef _TESTS
 #define CATCH_CONFIG_MAIN
 #include "tree.h"
+#include "sharded_tree.h"
+#include "combining_tree.h"
+#include "packed_tree.h"
+#include "key_encoding.h"
+#include "cached_tree.h"
+#include "learned_index.h"
+#include "durable_tree.h"
+#include "multi_tree.h"
 #include "random_gen.h"
 #include "catch.hpp"
 #include <unordered_set>
+#include <set>
+#include <map>
+#include <fstream>
+#include <atomic>
+#include <thread>
 
 
 TEST_CASE( "set/get/del, size: 1", "[tree]" ) {
@@ -116,8 +129,8 @@ TEST_CASE("random insert odd", "[tree]") {
 
 }
 
-template<uint NodeSize>
-void verifyIterator(Tree<int, int, NodeSize>& tree, std::unordered_set<int>& set) {
+template<uint NodeSize, bool Fingerprints>
+void verifyIterator(Tree<int, int, NodeSize, Fingerprints>& tree, std::unordered_set<int>& set) {
 	REQUIRE(tree.size() == set.size());
 
 	int treeKeyTotal = 0;
@@ -146,10 +159,10 @@ void verifyIterator(Tree<int, int, NodeSize>& tree, std::unordered_set<int>& set
 	REQUIRE(treeKeyTotal == setTotal);
 }
 
-template<uint NodeSize, bool Verify, uint Size>
-void testAll(int seed) {
+template<uint NodeSize, bool Verify, uint Size, bool Fingerprints = false>
+void testAll(int seed, uint capacity = NodeSize) {
 	constexpr int MaxNum = 4000;
-	Tree<int, int, NodeSize> tree;
+	Tree<int, int, NodeSize, Fingerprints> tree(capacity);
 
 	std::unordered_set<int> set;
 
@@ -248,6 +261,1382 @@ TEST_CASE("test all 3,4,5,6", "[tree]") {
 	testAll<6, true, 800>(4);
 }
 
+TEST_CASE("runtime capacity 3,4,5,6,64", "[tree]") {
+	testAll<DynamicSize, true, 800>(1, 3);
+	testAll<DynamicSize, true, 800>(2, 4);
+	testAll<DynamicSize, true, 800>(3, 5);
+	testAll<DynamicSize, true, 800>(4, 6);
+	testAll<DynamicSize, false, 2000>(5, 64);
+
+	DynTree<std::string, int> tree(7);
+	REQUIRE(tree.capacity() == 7);
+	for (int i = 0; i < 200; ++i) {
+		tree.set(std::to_string(i), new int(i));
+	}
+	REQUIRE(tree.size() == 200);
+	REQUIRE(*tree.find("123").value() == 123);
+	tree.clearDestructor([](int* value) { delete value; });
+	REQUIRE(tree.size() == 0);
+}
+
+template<uint NodeSize>
+void testAppend(int seed) {
+	constexpr int Count = 3000;
+	Tree<int, int, NodeSize> tree;
+	std::unordered_set<int> set;
+
+	for (int i = 0; i < Count; ++i) {
+		REQUIRE(tree.set(i * 2, new int(i * 2)));
+		set.insert(i * 2);
+	}
+	tree.validate_ptrs();
+	verifyIterator(tree, set);
+	// every leaf but the last is full
+	REQUIRE(tree.fillFactor() > 0.9);
+
+	rd::seed(seed);
+	rd::setMax(Count * 2);
+	for (int i = 0; i < Count; ++i) {
+		int number = rd::get();
+		if (set.erase(number) > 0) {
+			int* deleted = nullptr;
+			REQUIRE(tree.removePop(number, deleted));
+			delete deleted;
+		}
+		else if (number % 2 == 1) {
+			set.insert(number);
+			REQUIRE(tree.set(number, new int(number)));
+		}
+		tree.validate_ptrs();
+	}
+	verifyIterator(tree, set);
+
+	// appends after deletes removed the old tail
+	for (int i = Count * 2; i < Count * 3; ++i) {
+		REQUIRE(tree.set(i, new int(i)));
+		set.insert(i);
+	}
+	tree.validate_ptrs();
+	verifyIterator(tree, set);
+	tree.clearDestructor([](int* value) { delete value; });
+}
+
+TEST_CASE("append fast path 3,4,7,64", "[tree]") {
+	testAppend<3>(1);
+	testAppend<4>(2);
+	testAppend<7>(3);
+	testAppend<64>(4);
+}
+
+template<uint NodeSize>
+void testHinted(int seed) {
+	constexpr int MaxNum = 4000;
+	Tree<int, int, NodeSize> tree;
+	std::unordered_set<int> set;
+	typename Tree<int, int, NodeSize>::Iterator hint = tree.find(0);
+
+	rd::seed(seed);
+	rd::setMax(17);
+	int key = MaxNum / 2;
+	for (int i = 0; i < 20000; ++i) {
+		// random walk with steps in [-8, 8]
+		key = std::min(MaxNum, std::max(0, key + int(rd::get()) - 8));
+		switch (i % 3) {
+		case 0: {
+			bool didInsert = set.insert(key).second;
+			int* old = nullptr;
+			tree.get(key, old);
+			REQUIRE(tree.set(key, new int(key), hint) == didInsert);
+			delete old;
+			REQUIRE(hint.exists);
+			REQUIRE(hint.key() == key);
+			break;
+		}
+		case 1: {
+			bool didDelete = set.erase(key) > 0;
+			int* value = nullptr;
+			if (i % 2 == 0) {
+				REQUIRE(tree.removePop(key, value, hint) == didDelete);
+				REQUIRE((!didDelete || *value == key));
+			}
+			else {
+				if (didDelete) {
+					tree.get(key, value);
+				}
+				REQUIRE(tree.remove(key, hint) == didDelete);
+			}
+			delete value;
+			break;
+		}
+		case 2: {
+			auto found = tree.find(key, hint);
+			REQUIRE(found.exists == (set.count(key) > 0));
+			REQUIRE(found.leaf == tree.find(key).leaf);
+			hint = found;
+			break;
+		}
+		}
+		if (i % 100 == 0) {
+			tree.validate_ptrs();
+		}
+	}
+	verifyIterator(tree, set);
+	tree.clearDestructor([](int* value) { delete value; });
+}
+
+TEST_CASE("hinted find / set / remove 3,4,5,32", "[tree]") {
+	testHinted<3>(1);
+	testHinted<4>(2);
+	testHinted<5>(3);
+	testHinted<32>(4);
+}
+
+// Both compactions keep the minimum fill of a tree after deletes: half the capacity in every leaf and
+// capacity / 2 + 1 children in every inner node, the root excepted.
+template<uint NodeSize>
+void requireMinimumFill(const Tree<int, int, NodeSize>& tree) {
+	constexpr int HalfKeys = NodeSize / 2 + NodeSize % 2;
+	std::function<void(const Node<int, int, NodeSize>*)> check = [&](const Node<int, int, NodeSize>* node) {
+		if (node->isLeaf) {
+			REQUIRE((node->isRoot() || node->childrenCount >= HalfKeys));
+			return;
+		}
+		REQUIRE((node->isRoot() || node->childrenCount + 1 >= int(NodeSize / 2 + 1)));
+		for (int i = 0; i <= node->childrenCount; ++i) {
+			check(node->ptrs[i]);
+		}
+	};
+	check(tree.root);
+}
+
+template<uint NodeSize>
+void testCompact(int seed, bool incremental, double fill) {
+	constexpr int MaxNum = 20000;
+	Tree<int, int, NodeSize> tree;
+	std::unordered_set<int> set;
+
+	rd::seed(seed);
+	rd::setMax(MaxNum);
+	for (int i = 0; i < MaxNum; ++i) {
+		int number = rd::get();
+		if (set.insert(number).second) {
+			tree.set(number, new int(number));
+		}
+	}
+	for (int i = 0; i < MaxNum; ++i) {
+		int number = rd::get();
+		int* deleted = nullptr;
+		if (set.erase(number) > 0) {
+			REQUIRE(tree.removePop(number, deleted));
+			delete deleted;
+		}
+	}
+
+	const uint nodesBefore = tree.nodes;
+	const double fillBefore = tree.fillFactor();
+	if (incremental) {
+		while (!tree.compactStep(5, fill)) {
+			tree.validate_ptrs();
+			requireMinimumFill(tree);
+		}
+	}
+	else {
+		tree.compact(fill);
+	}
+	tree.validate_ptrs();
+	requireMinimumFill(tree);
+	verifyIterator(tree, set);
+	REQUIRE(tree.nodes <= nodesBefore);
+	// the incremental pass keeps every leaf at half(), 2 leaves that can not merge may stay below fill
+	REQUIRE(tree.fillFactor() >= (incremental ? fillBefore : fill - 0.05));
+
+	// still a working tree afterwards
+	for (int i = 0; i < MaxNum; ++i) {
+		int number = rd::get();
+		if (i % 2 == 0 && set.insert(number).second) {
+			REQUIRE(tree.set(number, new int(number)));
+		}
+		else if (i % 2 == 1 && set.erase(number) > 0) {
+			int* deleted = nullptr;
+			REQUIRE(tree.removePop(number, deleted));
+			delete deleted;
+		}
+	}
+	tree.validate_ptrs();
+	verifyIterator(tree, set);
+	tree.clearDestructor([](int* value) { delete value; });
+}
+
+TEST_CASE("compact and incremental compaction", "[tree]") {
+	testCompact<3>(1, false, 1.0);
+	testCompact<4>(2, false, 0.75);
+	testCompact<16>(3, false, 0.9);
+	testCompact<3>(4, true, 1.0);
+	testCompact<5>(5, true, 1.0);
+	testCompact<16>(6, true, 0.8);
+	testCompact<16>(7, true, 0.5);
+
+	// at half fill an even split of the entries falls under half(): 801 entries in leaves of 8 would be
+	// 101 leaves of 7 or 8 keys
+	for (int count : { 9, 17, 801, 5000 }) {
+		Tree<int, int, 16> tree;
+		for (int i = 0; i < 4 * count; ++i) {
+			tree.set(i, nullptr);
+		}
+		for (int i = count; i < 4 * count; ++i) {
+			tree.remove(i);
+		}
+		tree.compact(0.5);
+		tree.validate_ptrs();
+		requireMinimumFill(tree);
+		REQUIRE(tree.size() == uint(count));
+	}
+
+	// leaves of 9 and 8 keys: refilling the first to 16 would leave 1 key in the last child of the parent
+	Tree<int, int, 16> tree;
+	for (int i = 0; i < 17; ++i) {
+		tree.set(i, nullptr);
+	}
+	tree.compact(0.5);
+	REQUIRE(tree.nodes == 3);
+	while (!tree.compactStep(4, 1.0)) {
+	}
+	tree.validate_ptrs();
+	requireMinimumFill(tree);
+	REQUIRE(tree.size() == 17);
+}
+
+TEST_CASE("fingerprints 3,4,5,17,64", "[tree]") {
+	testAll<3, true, 800, true>(1);
+	testAll<4, true, 800, true>(2);
+	testAll<5, true, 800, true>(3);
+	testAll<17, true, 800, true>(4);
+	testAll<64, true, 2000, true>(5);
+
+	// string keys through splits, merges, redistribution and both compactions
+	FingerprintTree<std::string, int, 8> tree;
+	std::set<std::string> set;
+	rd::seed(6);
+	rd::setMax(3000);
+	for (int i = 0; i < 20000; ++i) {
+		const std::string key = "key" + std::to_string(rd::get());
+		if (i % 3 == 2) {
+			REQUIRE(tree.remove(key) == (set.erase(key) > 0));
+		}
+		else {
+			REQUIRE(tree.set(key, nullptr) == set.insert(key).second);
+		}
+		if (i == 10000) {
+			while (!tree.compactStep(16, 0.9)) {}
+		}
+	}
+	tree.validate_ptrs();
+	tree.compact();
+	tree.validate_ptrs();
+	REQUIRE(tree.size() == set.size());
+	for (int k = 0; k < 3000; ++k) {
+		const std::string key = "key" + std::to_string(k);
+		int* value;
+		REQUIRE(tree.get(key, value) == (set.count(key) > 0));
+	}
+}
+
+TEST_CASE("stats", "[tree]") {
+	Tree<int, int, 4> tree;
+	for (int i = 0; i < 1000; ++i) {
+		tree.set(i * 7 % 1000, nullptr);
+	}
+	TreeStats stats = tree.stats();
+
+	REQUIRE(stats.elements == 1000);
+	REQUIRE(stats.levels.size() == tree.height + 1);
+	REQUIRE(stats.leaves + stats.innerNodes == tree.nodes);
+	REQUIRE(stats.levels.back().nodes == stats.leaves);
+	REQUIRE(stats.levels.back().keys == 1000);
+	REQUIRE(stats.levels[0].nodes == 1);
+	REQUIRE(stats.nodeBytes == tree.nodes * sizeof(Node<int, int, 4>));
+	REQUIRE(stats.adjacentLinks <= stats.leaves - 1);
+	REQUIRE(stats.bytesPerKey() > (sizeof(int) + sizeof(int*)));
+}
+
+TEST_CASE("sharded tree", "[sharded]") {
+	ShardedTree<int, int, 8> tree({ 1000 });
+	REQUIRE(tree.shardCount() == 2);
+
+	std::set<int> set;
+	rd::seed(7);
+	rd::setMax(5000);
+	for (int i = 0; i < 20000; ++i) {
+		int number = rd::get();
+		if (i % 4 == 3) {
+			REQUIRE(tree.remove(number) == (set.erase(number) > 0));
+		}
+		else {
+			REQUIRE(tree.set(number, nullptr) == set.insert(number).second);
+		}
+		if (i == 10000) {
+			// [1000, inf) gets 80% of the operations
+			REQUIRE(tree.rebalance() == 1);
+		}
+	}
+	REQUIRE(tree.shardCount() == 3);
+	REQUIRE(tree.size() == set.size());
+
+	std::vector<int> all;
+	tree.forEach([&](int key, int*) { all.push_back(key); });
+	REQUIRE(all == std::vector<int>(set.begin(), set.end()));
+
+	// scans cross shard boundaries
+	std::vector<int> scanned;
+	tree.scan(990, 2000, [&](int key, int*) { scanned.push_back(key); });
+	std::vector<int> expected;
+	for (auto it = set.lower_bound(990); it != set.end() && expected.size() < 2000; ++it) {
+		expected.push_back(*it);
+	}
+	REQUIRE(scanned == expected);
+}
+
+TEST_CASE("sharded tree concurrent writers", "[sharded]") {
+	constexpr int Threads = 4;
+	constexpr int PerThread = 20000;
+	ShardedTree<int, int, 16> tree({ 1 << 28, 2 << 28, 3 << 28 });
+	tree.setAutoRebalance(4096);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < Threads; ++t) {
+		threads.emplace_back([&tree, t] {
+			for (int i = 0; i < PerThread; ++i) {
+				// interleaved keys, every thread writes to every shard
+				tree.set(i * Threads + t, nullptr);
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	REQUIRE(tree.size() == Threads * PerThread);
+	int expected = 0;
+	bool ordered = true;
+	tree.forEach([&](int key, int*) { ordered = ordered && key == expected++; });
+	REQUIRE(ordered);
+	REQUIRE(expected == Threads * PerThread);
+}
+
+TEST_CASE("flat combining tree concurrent writers", "[combining]") {
+	constexpr int Threads = 4;
+	constexpr int PerThread = 20000;
+	CombiningTree<int, int, 16> tree;
+	// Catch assertions are not thread safe, the workers only count wrong results
+	std::atomic<int> wrong{ 0 };
+	int marker = 0;
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < Threads; ++t) {
+		threads.emplace_back([&, t] {
+			for (int i = 0; i < PerThread; ++i) {
+				const int key = i * Threads + t;
+				int* popped = nullptr;
+				wrong += !tree.set(key, &marker);
+				// every thread removes its odd keys again
+				if (i % 2 == 1) {
+					wrong += !tree.removePop(key, popped) || popped != &marker;
+					wrong += tree.remove(key);
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(wrong == 0);
+
+	Tree<int, int, 16>& result = tree.unsafeTree();
+	REQUIRE(result.size() == Threads * PerThread / 2);
+	REQUIRE(tree.combinedOps() == uint64_t(Threads) * PerThread * 2);
+	int expected = 0;
+	for (auto it = result.first(); it.isValid(); ++it) {
+		REQUIRE(it.key() == expected);
+		expected += (expected % (2 * Threads) == Threads - 1) ? Threads + 1 : 1;
+	}
+	result.validate_ptrs();
+
+	int* found = nullptr;
+	REQUIRE(tree.get(0, found));
+	REQUIRE_FALSE(tree.get(Threads, found));
+}
+
+// Random sets / removes against std::map, keys are multiples of spread around 0 so leaves need every delta width.
+template<typename KeyType, uint LeafCapacity>
+void testPacked(int seed, long long spread) {
+	PackedTree<KeyType, int, LeafCapacity> tree;
+	std::map<KeyType, int*> map;
+	int values[2];
+
+	rd::seed(seed);
+	rd::setMax(4000);
+	for (int i = 0; i < 40000; ++i) {
+		const KeyType key = KeyType((long long)(rd::get()) - 2000) * KeyType(spread);
+		int* value = &values[i % 2];
+		if (i % 3 == 2 || (i > 30000 && i % 3 != 0)) {
+			int* popped = nullptr;
+			const bool removed = map.erase(key) > 0;
+			REQUIRE(tree.removePop(key, popped) == removed);
+		}
+		else if (i % 5 == 0) {
+			REQUIRE(tree.maybe_add(key, value) == map.insert({ key, value }).second);
+		}
+		else {
+			REQUIRE(tree.set(key, value) == (map.count(key) == 0));
+			map[key] = value;
+		}
+	}
+
+	REQUIRE(tree.size() == map.size());
+	auto expected = map.begin();
+	bool same = true;
+	tree.forEach([&](KeyType key, int* value) {
+		same = same && expected != map.end() && expected->first == key && expected->second == value;
+		++expected;
+	});
+	REQUIRE(same);
+	REQUIRE(expected == map.end());
+
+	for (long long k = -2001; k <= 2001; ++k) {
+		const KeyType key = KeyType(k) * KeyType(spread);
+		int* value = nullptr;
+		auto found = map.find(key);
+		REQUIRE(tree.get(key, value) == (found != map.end()));
+		if (found != map.end()) {
+			REQUIRE(value == found->second);
+		}
+	}
+}
+
+TEST_CASE("packed tree", "[packed]") {
+	testPacked<int, 4>(1, 1);
+	testPacked<int, 16>(2, 3);
+	testPacked<int, 256>(3, 1);
+	testPacked<int, 64>(4, 300);
+	testPacked<int64_t, 32>(5, 1LL << 40);
+	testPacked<int64_t, 256>(6, 7);
+
+	PackedTree<int, int, 64> dense;
+	for (int i = 0; i < 10000; ++i) {
+		dense.set(i, nullptr);
+	}
+	std::vector<int> widths = dense.deltaWidths();
+	REQUIRE(std::all_of(widths.begin(), widths.end(), [](int width) { return width == 1; }));
+	REQUIRE(dense.allocatedBytes() < dense.size() * (sizeof(int) + sizeof(int*)) * 2);
+
+	PackedTree<int64_t, int, 64> wide;
+	wide.set(INT64_MIN, nullptr);
+	wide.set(INT64_MAX, nullptr);
+	wide.set(0, nullptr);
+	int* value;
+	REQUIRE(wide.get(INT64_MIN, value));
+	REQUIRE(wide.get(INT64_MAX, value));
+	REQUIRE_FALSE(wide.get(1, value));
+	REQUIRE(wide.deltaWidths() == std::vector<int>{ 8 });
+}
+
+TEST_CASE("normalized composite keys", "[keys]") {
+	typedef KeyEncoder<uint32_t, int64_t, int8_t, FixedString<5>> Encoder;
+	static_assert(Encoder::Width == 4 + 8 + 1 + 5, "field widths");
+
+	std::mt19937 gen(3);
+	const int64_t edges[] = { INT64_MIN, INT64_MIN + 1, -1, 0, 1, INT64_MAX - 1, INT64_MAX };
+	const char* names[] = { "", "a", "ab", "abcde", "b", "zz" };
+	std::vector<Encoder::Tuple> tuples;
+	for (int i = 0; i < 300; ++i) {
+		tuples.emplace_back(uint32_t(gen() % 3) * 0x7fffffffu, edges[gen() % 7],
+			int8_t(gen()), FixedString<5>(names[gen() % 6]));
+	}
+
+	auto less = [](const Encoder::Tuple& a, const Encoder::Tuple& b) {
+		return std::make_tuple(std::get<0>(a), std::get<1>(a), std::get<2>(a), std::get<3>(a).value)
+			< std::make_tuple(std::get<0>(b), std::get<1>(b), std::get<2>(b), std::get<3>(b).value);
+	};
+	bool sameOrder = true;
+	bool roundTrip = true;
+	for (const auto& a : tuples) {
+		const Encoder::Key encoded = Encoder::encode(a);
+		const Encoder::Tuple decoded = Encoder::decode(encoded);
+		roundTrip = roundTrip && !less(a, decoded) && !less(decoded, a) && Encoder::field<1>(encoded) == std::get<1>(a);
+		for (const auto& b : tuples) {
+			const Encoder::Key other = Encoder::encode(b);
+			sameOrder = sameOrder && (encoded < other) == less(a, b) && (encoded == other) == (!less(a, b) && !less(b, a));
+		}
+	}
+	REQUIRE(sameOrder);
+	REQUIRE(roundTrip);
+
+	// as tree keys, in the order of the tuples
+	typedef KeyEncoder<uint32_t, int64_t, uint64_t> Composite;
+	Tree<Composite::Key, int, 8> tree;
+	std::set<std::tuple<uint32_t, int64_t, uint64_t>> set;
+	for (int i = 0; i < 5000; ++i) {
+		auto fields = std::make_tuple(uint32_t(gen() % 4), int64_t(gen() % 1000) - 500, uint64_t(gen()));
+		REQUIRE(tree.set(Composite::encode(fields), nullptr) == set.insert(fields).second);
+	}
+	REQUIRE(tree.size() == set.size());
+	auto expected = set.begin();
+	for (auto it = tree.first(); it.isValid(); ++it, ++expected) {
+		REQUIRE(Composite::decode(it.key()) == *expected);
+	}
+}
+
+TEST_CASE("hot key cache", "[cached]") {
+	// few slots and small nodes, so entries get evicted and leaves split, merge and redistribute under the cache
+	CachedTree<int, int, 4> tree(16);
+	std::map<int, int*> map;
+	int values[3];
+
+	rd::seed(9);
+	rd::setMax(300);
+	for (int i = 0; i < 50000; ++i) {
+		const int key = rd::get();
+		int* value = &values[i % 3];
+		int* found = nullptr;
+		switch (i % 5) {
+		case 0:
+			REQUIRE(tree.set(key, value) == (map.count(key) == 0));
+			map[key] = value;
+			break;
+		case 1:
+			REQUIRE(tree.maybe_add(key, value) == map.insert({ key, value }).second);
+			break;
+		case 2:
+			REQUIRE(tree.remove(key) == (map.erase(key) > 0));
+			break;
+		default:
+			REQUIRE(tree.get(key, found) == (map.count(key) > 0));
+			REQUIRE(found == (map.count(key) ? map[key] : nullptr));
+		}
+	}
+	REQUIRE(tree.size() == map.size());
+	REQUIRE(tree.cacheSlots() == 16);
+	REQUIRE(tree.hits() > 0);
+	REQUIRE(tree.hits() + tree.misses() == 20000);
+	tree.tree().validate_ptrs();
+}
+
+template<typename KeyType, uint NodeSize, typename MakeKey>
+void testFrozen(int count, MakeKey makeKey) {
+	Tree<KeyType, int, NodeSize> tree;
+	std::vector<int> values(2 * count + 2);
+	for (int i = 0; i < count; ++i) {
+		// every other key, odd ones miss
+		tree.set(makeKey(2 * i + 1), &values[2 * i + 1]);
+	}
+	FrozenTree<KeyType, int> frozen = tree.freeze();
+	REQUIRE(frozen.size() == tree.size());
+
+	for (int i = 0; i < 2 * count + 2; ++i) {
+		const KeyType key = makeKey(i);
+		auto expected = tree.find(key);
+		auto found = frozen.find(key);
+		REQUIRE(found.exists == expected.exists);
+		int* value = nullptr;
+		REQUIRE(frozen.get(key, value) == expected.exists);
+		if (expected.exists) {
+			REQUIRE(value == &values[i]);
+		}
+		// both stop at the largest smaller key
+		REQUIRE(found.isValid() == (i > 0 && count > 0));
+		if (found.isValid()) {
+			REQUIRE(found.key() == makeKey(std::min(i % 2 ? i : i - 1, 2 * count - 1)));
+		}
+	}
+
+	int scanned = 0;
+	auto it = tree.first();
+	for (auto frozenIt = frozen.first(); frozenIt.isValid(); ++frozenIt, ++it, ++scanned) {
+		REQUIRE(frozenIt.key() == it.key());
+		REQUIRE(frozenIt.value() == it.value());
+	}
+	REQUIRE(scanned == count);
+}
+
+TEST_CASE("frozen tree", "[frozen]") {
+	auto number = [](int i) { return i; };
+	for (int count : { 0, 1, 15, 16, 17, 272, 273, 290, 5000, 80000 }) {
+		testFrozen<int, 16>(count, number);
+	}
+	testFrozen<int64_t, 8>(3000, [](int i) { return int64_t(i) << 33; });
+	// 4 keys per node, so a few thousand keys make several levels
+	for (int count : { 3, 4, 5, 24, 25, 26, 3000 }) {
+		testFrozen<std::string, 4>(count, [](int i) {
+			std::string key = std::to_string(i);
+			return std::string(8 - key.size(), '0') + key;
+		});
+	}
+
+	FrozenTree<int, int> frozen(std::vector<int>{ 1, 5, 9 }, std::vector<int*>{ nullptr, nullptr, nullptr });
+	REQUIRE(frozen.height() == 0);
+	REQUIRE(frozen.find(5).exists);
+	REQUIRE_FALSE(frozen.find(0).isValid());
+	REQUIRE(frozen.find(100).key() == 9);
+}
+
+template<uint Error, typename KeyType>
+void testLearned(std::vector<KeyType> keys) {
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	std::vector<int> values(keys.size());
+	std::vector<int*> data;
+	for (int& value : values) {
+		data.push_back(&value);
+	}
+	LearnedIndex<KeyType, int, Error> index(keys, data);
+	REQUIRE(index.size() == keys.size());
+
+	// every key, and the keys right next to it that are missing
+	std::vector<KeyType> probes;
+	for (KeyType key : keys) {
+		probes.push_back(key);
+		if (key != std::numeric_limits<KeyType>::min()) {
+			probes.push_back(key - 1);
+		}
+		if (key != std::numeric_limits<KeyType>::max()) {
+			probes.push_back(key + 1);
+		}
+	}
+	probes.push_back(std::numeric_limits<KeyType>::min());
+	probes.push_back(std::numeric_limits<KeyType>::max());
+	for (KeyType probe : probes) {
+		const long long expected = std::upper_bound(keys.begin(), keys.end(), probe) - keys.begin() - 1;
+		auto found = index.find(probe);
+		REQUIRE(found.position == expected);
+		REQUIRE(found.exists == (expected >= 0 && keys[expected] == probe));
+		int* value = nullptr;
+		REQUIRE(index.get(probe, value) == found.exists);
+		if (found.exists) {
+			REQUIRE(value == &values[expected]);
+		}
+	}
+}
+
+TEST_CASE("learned index", "[learned]") {
+	std::mt19937_64 gen(7);
+	std::vector<int64_t> uniform;
+	for (int i = 0; i < 50000; ++i) {
+		uniform.push_back(int64_t(gen() >> 24));
+	}
+	testLearned<32>(uniform);
+	testLearned<4>(uniform);
+
+	// dense runs with big jumps between them, and quickly growing gaps
+	std::vector<int64_t> skewed;
+	for (int i = 0; i < 20000; ++i) {
+		skewed.push_back((int64_t(i / 1000) << 40) + i % 1000);
+		skewed.push_back(int64_t(i) * i * i);
+	}
+	testLearned<32>(skewed);
+	testLearned<1>(skewed);
+
+	std::vector<int> negative;
+	for (int i = -3000; i < 3000; ++i) {
+		negative.push_back(i * (i % 7 + 1));
+	}
+	negative.push_back(std::numeric_limits<int>::min());
+	negative.push_back(std::numeric_limits<int>::max());
+	testLearned<8>(negative);
+	testLearned<8>(std::vector<uint8_t>{ 0, 1, 2, 200, 255 });
+	testLearned<8>(std::vector<int>{ 5 });
+	testLearned<8>(std::vector<int>{});
+
+	// built from a tree
+	Tree<int, int, 16> tree;
+	std::vector<int> values(100000);
+	for (int i = 0; i < 100000; ++i) {
+		tree.set(i * 3, &values[i]);
+	}
+	LearnedIndex<int, int> fromTree(tree.first(), tree.size());
+	REQUIRE(fromTree.segmentCount() == 1);
+	for (int i = 0; i < 300000; ++i) {
+		auto expected = tree.find(i);
+		auto found = fromTree.find(i);
+		REQUIRE(found.exists == expected.exists);
+		REQUIRE(found.key() == expected.key());
+		REQUIRE(found.value() == expected.value());
+	}
+}
+
+// Fresh directory for a DurableTree, removed again by removeDurableDir.
+std::string makeDurableDir() {
+	char path[] = "/tmp/tree_wal_XXXXXX";
+	REQUIRE(mkdtemp(path) != nullptr);
+	return path;
+}
+
+void removeDurableDir(const std::string& dir) {
+	for (const char* name : { "/wal.log", "/checkpoint", "/checkpoint.tmp" }) {
+		unlink((dir + name).c_str());
+	}
+	rmdir(dir.c_str());
+}
+
+template<typename DurableType>
+void requireSame(const DurableType& durable, const std::map<int, int>& model) {
+	REQUIRE(durable.size() == model.size());
+	auto expected = model.begin();
+	for (auto it = durable.tree().first(); it.isValid(); it.next(), ++expected) {
+		REQUIRE(it.key() == expected->first);
+		if (expected->second < 0) {
+			REQUIRE(it.value() == nullptr);
+		}
+		else {
+			REQUIRE(it.value() != nullptr);
+			REQUIRE(*it.value() == expected->second);
+		}
+	}
+}
+
+TEST_CASE("durable tree recovery", "[durable]") {
+	const std::string dir = makeDurableDir();
+	// value -1 is a null pointer
+	std::map<int, int> model;
+	std::vector<int> values(20000);
+	// operations that changed the tree, only those are logged
+	uint64_t logged = 0;
+	rd::seed(5);
+	auto randomOps = [&](DurableTree<int, int, 16>& durable, int count) {
+		for (int i = 0; i < count; ++i) {
+			const int key = rd::get() % 3000;
+			const int op = rd::get() % 10;
+			if (op < 6) {
+				int* value = &values[rd::get() % values.size()];
+				*value = int(value - values.data());
+				const bool nullValue = op == 0;
+				REQUIRE(durable.set(key, nullValue ? nullptr : value) == (model.count(key) == 0));
+				model[key] = nullValue ? -1 : *value;
+				logged++;
+			}
+			else if (op < 7) {
+				int* value = &values[key];
+				*value = key;
+				const bool inserted = model.emplace(key, key).second;
+				REQUIRE(durable.maybe_add(key, value) == inserted);
+				logged += inserted;
+			}
+			else {
+				const bool removed = model.erase(key) == 1;
+				REQUIRE(durable.remove(key) == removed);
+				logged += removed;
+			}
+		}
+	};
+
+	SECTION("log only") {
+		{
+			DurabilityOptions options;
+			options.syncInterval = 7;
+			DurableTree<int, int, 16> durable(options);
+			REQUIRE(durable.open(dir));
+			randomOps(durable, 20000);
+			REQUIRE(durable.syncCount() > 0);
+		}
+		DurableTree<int, int, 16> recovered;
+		REQUIRE(recovered.open(dir));
+		REQUIRE(recovered.recoveredRecords() > 0);
+		requireSame(recovered, model);
+		recovered.tree().validate_ptrs();
+
+		// writes after recovery continue the log
+		randomOps(recovered, 5000);
+		recovered.close();
+		DurableTree<int, int, 16> again;
+		REQUIRE(again.open(dir));
+		requireSame(again, model);
+	}
+
+	SECTION("checkpoints") {
+		DurabilityOptions options;
+		options.checkpointInterval = 3000;
+		{
+			DurableTree<int, int, 16> durable(options);
+			REQUIRE(durable.open(dir));
+			randomOps(durable, 10000);
+			REQUIRE(durable.checkpointCount() == logged / 3000);
+		}
+		DurableTree<int, int, 16> recovered;
+		REQUIRE(recovered.open(dir));
+		REQUIRE(recovered.recoveredRecords() == logged % 3000);
+		requireSame(recovered, model);
+	}
+
+	SECTION("torn tail and crash between checkpoint and log truncation") {
+		std::vector<char> oldLog;
+		{
+			DurableTree<int, int, 16> durable;
+			REQUIRE(durable.open(dir));
+			randomOps(durable, 4000);
+			REQUIRE(durable.sync());
+			std::ifstream in(dir + "/wal.log", std::ios::binary);
+			oldLog.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			REQUIRE(durable.checkpoint());
+			randomOps(durable, 1000);
+		}
+		// the log from before the checkpoint back in front of the new one, then half a record
+		std::ifstream in(dir + "/wal.log", std::ios::binary);
+		std::vector<char> newLog((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		in.close();
+		std::ofstream out(dir + "/wal.log", std::ios::binary | std::ios::trunc);
+		out.write(oldLog.data(), oldLog.size());
+		out.write(newLog.data(), newLog.size());
+		out.write(newLog.data(), 5);
+		out.close();
+
+		DurableTree<int, int, 16> recovered;
+		REQUIRE(recovered.open(dir));
+		requireSame(recovered, model);
+		randomOps(recovered, 1000);
+		recovered.close();
+		DurableTree<int, int, 16> again;
+		REQUIRE(again.open(dir));
+		requireSame(again, model);
+	}
+
+	SECTION("damaged checkpoint") {
+		{
+			DurableTree<int, int, 16> durable;
+			REQUIRE(durable.open(dir));
+			randomOps(durable, 100);
+			REQUIRE(durable.checkpoint());
+		}
+		std::ofstream out(dir + "/checkpoint", std::ios::binary | std::ios::in | std::ios::out);
+		out.seekp(20);
+		out.put('x');
+		out.close();
+		DurableTree<int, int, 16> recovered;
+		REQUIRE_FALSE(recovered.open(dir));
+		REQUIRE_FALSE(recovered.lastError().empty());
+	}
+
+	SECTION("failed directory sync keeps the log") {
+		auto readLog = [&] {
+			std::ifstream in(dir + "/wal.log", std::ios::binary);
+			return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		};
+		{
+			DurabilityOptions options;
+			options.syncDirectory = [](int) { errno = EIO; return -1; };
+			DurableTree<int, int, 16> durable(options);
+			REQUIRE(durable.open(dir));
+			randomOps(durable, 2000);
+			REQUIRE(durable.sync());
+			const std::vector<char> before = readLog();
+			REQUIRE_FALSE(before.empty());
+			REQUIRE_FALSE(durable.checkpoint());
+			REQUIRE(durable.lastError().find("fsync") == 0);
+			REQUIRE(readLog() == before);
+
+			// no more writes once logging failed
+			const uint size = durable.size();
+			int value = 1;
+			REQUIRE_FALSE(durable.set(100000, &value));
+			REQUIRE_FALSE(durable.remove(model.begin()->first));
+			REQUIRE(durable.size() == size);
+		}
+		DurableTree<int, int, 16> recovered;
+		REQUIRE(recovered.open(dir));
+		requireSame(recovered, model);
+	}
+
+	SECTION("open again drops the previous state") {
+		DurableTree<int, int, 16> durable;
+		REQUIRE(durable.open(dir));
+		randomOps(durable, 2000);
+		durable.close();
+		int value = 1;
+		REQUIRE(durable.set(100000, &value));
+		REQUIRE(durable.open(dir));
+		requireSame(durable, model);
+
+		const std::string other = makeDurableDir();
+		REQUIRE(durable.open(other));
+		REQUIRE(durable.size() == 0);
+		durable.close();
+		removeDurableDir(other);
+	}
+	removeDurableDir(dir);
+}
+
+template<uint NodeSize, bool Fingerprints>
+void testUpsert() {
+	Tree<int, int, NodeSize, Fingerprints> tree;
+	std::map<int, int> model;
+	std::vector<std::unique_ptr<int>> owned;
+	auto newValue = [&](int value) {
+		owned.emplace_back(new int(value));
+		return owned.back().get();
+	};
+
+	rd::seed(NodeSize);
+	for (int i = 0; i < 20000; ++i) {
+		// sequential runs hit the rightmost leaf path, the rest lands anywhere
+		const int key = i % 3 == 0 ? i : int(rd::get() % 5000);
+		const bool existed = model.count(key) == 1;
+		switch (rd::get() % 4) {
+		case 0: {
+			const bool inserted = tree.upsert(key, [&](int*& data, bool exists) {
+				REQUIRE(exists == existed);
+				if (exists) {
+					++*data;
+				}
+				else {
+					data = newValue(1);
+				}
+			});
+			REQUIRE(inserted == !existed);
+			model[key]++;
+			break;
+		}
+		case 1: {
+			int* previous = nullptr;
+			REQUIRE(tree.insertOrAssign(key, newValue(i), previous) == !existed);
+			if (existed) {
+				REQUIRE(*previous == model[key]);
+			}
+			model[key] = i;
+			break;
+		}
+		case 2: {
+			bool made = false;
+			int* data = nullptr;
+			REQUIRE(tree.tryEmplace(key, [&] { made = true; return newValue(-i); }, data) == !existed);
+			REQUIRE(made == !existed);
+			model.emplace(key, -i);
+			REQUIRE(*data == model[key]);
+			break;
+		}
+		default:
+			REQUIRE(tree.modify(key, [&](int*& data) { *data += 10; }) == existed);
+			if (existed) {
+				model[key] += 10;
+			}
+			break;
+		}
+	}
+
+	tree.validate_ptrs();
+	REQUIRE(tree.size() == model.size());
+	auto expected = model.begin();
+	for (auto it = tree.first(); it.isValid(); it.next(), ++expected) {
+		REQUIRE(it.key() == expected->first);
+		REQUIRE(*it.value() == expected->second);
+	}
+
+	// modify can swap the pointer
+	tree.maybe_add(0, newValue(0));
+	int replacement = 77;
+	REQUIRE(tree.modify(0, [&](int*& data) { data = &replacement; }));
+	int* found = nullptr;
+	REQUIRE(tree.get(0, found));
+	REQUIRE(found == &replacement);
+}
+
+TEST_CASE("upsert and read-modify-write", "[upsert]") {
+	testUpsert<3, false>();
+	testUpsert<4, false>();
+	testUpsert<5, false>();
+	testUpsert<64, false>();
+	testUpsert<16, true>();
+}
+
+// Key that counts its copies, moves are free.
+struct CountedKey {
+	static int copies;
+	int value = 0;
+
+	CountedKey() {}
+	explicit CountedKey(int value)
+		: value(value) {}
+	CountedKey(const CountedKey& other)
+		: value(other.value) {
+		copies++;
+	}
+	CountedKey(CountedKey&& other) noexcept
+		: value(other.value) {}
+	CountedKey& operator=(const CountedKey& other) {
+		value = other.value;
+		copies++;
+		return *this;
+	}
+	CountedKey& operator=(CountedKey&& other) noexcept {
+		value = other.value;
+		return *this;
+	}
+
+	bool operator<(const CountedKey& other) const { return value < other.value; }
+	bool operator<=(const CountedKey& other) const { return value <= other.value; }
+	bool operator>(const CountedKey& other) const { return value > other.value; }
+	bool operator>=(const CountedKey& other) const { return value >= other.value; }
+	bool operator==(const CountedKey& other) const { return value == other.value; }
+
+	friend std::ostream& operator<<(std::ostream& out, const CountedKey& key) {
+		return out << key.value;
+	}
+};
+int CountedKey::copies = 0;
+
+template<uint NodeSize>
+void testKeyMoves() {
+	rd::seed(NodeSize);
+	std::vector<int> keys;
+	for (int i = 0; i < 20000; ++i) {
+		keys.push_back(rd::get() % 100000);
+	}
+	int value = 0;
+
+	// only a leaf split copies a key (its separator), moves go through the leaf and internal splits
+	Tree<CountedKey, int, NodeSize> moved;
+	CountedKey::copies = 0;
+	for (int key : keys) {
+		moved.set(CountedKey(key), &value);
+	}
+	const int movedCopies = CountedKey::copies;
+	REQUIRE(movedCopies == int(moved.stats().leaves) - 1);
+	moved.validate_ptrs();
+
+	// emplace on the append path, every split is 100/0
+	Tree<CountedKey, int, NodeSize> emplaced;
+	CountedKey::copies = 0;
+	for (int i = 0; i < 20000; ++i) {
+		REQUIRE(emplaced.emplace(&value, i));
+	}
+	REQUIRE_FALSE(emplaced.emplace(&value, 5));
+	const int emplacedCopies = CountedKey::copies;
+	REQUIRE(emplacedCopies == int(emplaced.stats().leaves) - 1);
+	emplaced.validate_ptrs();
+
+	Tree<CountedKey, int, NodeSize> copied;
+	CountedKey::copies = 0;
+	for (int key : keys) {
+		const CountedKey counted(key);
+		copied.set(counted, &value);
+	}
+	REQUIRE(CountedKey::copies >= int(copied.size()));
+
+	REQUIRE(moved.size() == copied.size());
+	for (auto a = moved.first(), b = copied.first(); a.isValid(); a.next(), b.next()) {
+		REQUIRE(a.key() == b.key());
+	}
+}
+
+TEST_CASE("moved and emplaced keys", "[moves]") {
+	testKeyMoves<3>();
+	testKeyMoves<4>();
+	testKeyMoves<17>();
+
+	Tree<std::string, int, 5> tree;
+	std::set<std::string> model;
+	int value = 0;
+	for (int i = 0; i < 3000; ++i) {
+		std::string key = "a long key that does not fit in place " + std::to_string(i * 7919 % 3000);
+		model.insert(key);
+		if (i % 2) {
+			REQUIRE(tree.set(std::move(key), &value));
+		}
+		else {
+			REQUIRE(tree.maybe_add(std::move(key), &value));
+		}
+	}
+	REQUIRE(tree.emplace(&value, 3, 'z'));
+	model.insert("zzz");
+	REQUIRE_FALSE(tree.emplace(&value, "zzz"));
+	tree.validate_ptrs();
+	REQUIRE(tree.size() == model.size());
+	auto expected = model.begin();
+	for (auto it = tree.first(); it.isValid(); it.next(), ++expected) {
+		REQUIRE(it.key() == *expected);
+	}
+}
+
+template<uint NodeSize>
+void testMultiTree() {
+	MultiTree<int, int, NodeSize> multi;
+	std::map<int, std::multiset<int*>> model;
+	size_t total = 0;
+	std::vector<int> values(500);
+
+	rd::seed(NodeSize);
+	for (int i = 0; i < 40000; ++i) {
+		// few keys get long lists across several chunks, most keep a handful of values
+		const int key = rd::get() % 8 == 0 ? int(rd::get() % 4) : int(rd::get() % 3000);
+		int* value = &values[rd::get() % values.size()];
+		if (rd::get() % 3 == 0) {
+			auto found = model.find(key);
+			// pick a value that is there most of the time
+			if (found != model.end() && rd::get() % 4 != 0) {
+				value = *found->second.begin();
+			}
+			const bool exists = found != model.end() && found->second.count(value) > 0;
+			REQUIRE(multi.erase(key, value) == exists);
+			if (exists) {
+				found->second.erase(found->second.find(value));
+				total--;
+				if (found->second.empty()) {
+					model.erase(found);
+				}
+			}
+		}
+		else {
+			REQUIRE(multi.insert(key, value) == (model.count(key) == 0));
+			model[key].insert(value);
+			total++;
+		}
+	}
+
+	REQUIRE(multi.size() == total);
+	REQUIRE(multi.keyCount() == model.size());
+	for (int key = -1; key < 3001; ++key) {
+		auto range = multi.equalRange(key);
+		auto found = model.find(key);
+		if (found == model.end()) {
+			REQUIRE(range.empty());
+			continue;
+		}
+		std::multiset<int*> got;
+		for (int* value : range) {
+			got.insert(value);
+		}
+		REQUIRE(got == found->second);
+		got.clear();
+		multi.forEachValue(key, [&](int* value) { got.insert(value); });
+		REQUIRE(got == found->second);
+		REQUIRE(multi.count(key) == found->second.size());
+	}
+
+	auto expected = model.begin();
+	std::multiset<int*> keyValues;
+	int lastKey = -1;
+	multi.forEach([&](int key, int* value) {
+		if (key != lastKey && lastKey >= 0) {
+			REQUIRE(keyValues == expected->second);
+			keyValues.clear();
+			++expected;
+		}
+		REQUIRE(key == expected->first);
+		keyValues.insert(value);
+		lastKey = key;
+	});
+
+	const size_t longest = model[0].size();
+	REQUIRE(multi.eraseKey(0) == longest);
+	REQUIRE(multi.eraseKey(0) == 0);
+	REQUIRE(multi.size() == total - longest);
+}
+
+TEST_CASE("multimap posting lists", "[multi]") {
+	testMultiTree<3>();
+	testMultiTree<16>();
+
+	// inline, chunk boundaries and back
+	PostingList<int, 4, 8> list;
+	std::vector<int> values(100);
+	for (int i = 0; i < 100; ++i) {
+		list.push(&values[i]);
+		REQUIRE(list.size() == size_t(i + 1));
+		REQUIRE(list[i] == &values[i]);
+	}
+	REQUIRE(list.chunks.size() == 12);
+	REQUIRE_FALSE(list.remove(nullptr));
+	for (int i = 99; i >= 0; i -= 2) {
+		REQUIRE(list.remove(&values[i]));
+	}
+	for (int i = 0; i < 100; i += 2) {
+		REQUIRE(list.remove(&values[i]));
+	}
+	REQUIRE(list.empty());
+	REQUIRE(list.chunks.empty());
+}
+
+// StatsOf plus the first and last key, combine checks that its sides come in key order. Declared commutative
+// it takes the insert shortcut of the tree, which combines out of order.
+template<bool Commutative>
+struct OrderedStats {
+	typedef StatsOf<long long> Stats;
+
+	static constexpr bool commutative = Commutative;
+
+	struct type {
+		Stats::type stats;
+		int firstKey = 0;
+		int lastKey = 0;
+		bool ordered = true;
+	};
+
+	static type identity() {
+		return type();
+	}
+
+	static type of(const int& key, const long long* data) {
+		return type{ Stats::of(key, data), key, key, true };
+	}
+
+	static type combine(const type& left, const type& right) {
+		if (left.stats.count == 0 || right.stats.count == 0) {
+			return left.stats.count == 0 ? right : left;
+		}
+		return type{ Stats::combine(left.stats, right.stats), left.firstKey, right.lastKey,
+			left.ordered && right.ordered && left.lastKey < right.firstKey };
+	}
+};
+
+template<typename Augment, typename TNode>
+typename Augment::type checkAggregates(const TNode* node) {
+	typename Augment::type result;
+	if (node->isLeaf) {
+		for (int i = 0; i < node->childrenCount; ++i) {
+			result = Augment::combine(result, Augment::of(node->keys[i], node->getAsData(i)));
+		}
+		return result;
+	}
+	for (int i = 0; i <= node->childrenCount; ++i) {
+		const typename Augment::type child = checkAggregates<Augment>(node->ptrs[i]);
+		REQUIRE(node->aggregates[i].stats.count == child.stats.count);
+		REQUIRE(node->aggregates[i].stats.sum == child.stats.sum);
+		REQUIRE(node->aggregates[i].stats.min == child.stats.min);
+		REQUIRE(node->aggregates[i].stats.max == child.stats.max);
+		result = Augment::combine(result, child);
+	}
+	return result;
+}
+
+template<typename Augment, typename TreeType>
+void requireRanges(const TreeType& tree, const std::map<int, long long>& model, int keys) {
+	for (int q = 0; q < 200; ++q) {
+		const int lo = int(rd::get() % (keys + 20)) - 10;
+		const int hi = lo + int(rd::get() % (q % 4 == 0 ? keys : 50));
+		StatsOf<long long>::type expected;
+		for (auto it = model.lower_bound(lo); it != model.end() && it->first <= hi; ++it) {
+			expected = StatsOf<long long>::combine(expected, StatsOf<long long>::of(it->first, &it->second));
+		}
+		const typename Augment::type got = tree.aggregate(lo, hi);
+		REQUIRE((got.ordered || Augment::commutative));
+		REQUIRE(got.stats.count == expected.count);
+		REQUIRE(got.stats.sum == expected.sum);
+		REQUIRE(got.stats.min == expected.min);
+		REQUIRE(got.stats.max == expected.max);
+	}
+}
+
+template<uint NodeSize, bool Commutative>
+void testAugmented() {
+	typedef OrderedStats<Commutative> Augment;
+	typedef AugmentedTree<int, long long, Augment, NodeSize> TreeType;
+	constexpr int Keys = 4000;
+	TreeType tree;
+	std::map<int, long long> model;
+	std::vector<std::unique_ptr<long long>> owned;
+	auto newValue = [&](long long value) {
+		owned.emplace_back(new long long(value));
+		return owned.back().get();
+	};
+
+	rd::seed(NodeSize);
+	typename TreeType::Iterator hint = tree.find(0);
+	for (int i = 0; i < 30000; ++i) {
+		// grow, then shrink through merges and redistribution, then grow again
+		const int phase = i / 10000;
+		const int key = i % 5 == 0 ? i % Keys : int(rd::get() % Keys);
+		const long long value = (long long)(rd::get() % 2001) - 1000;
+		const bool insert = phase == 1 ? rd::get() % 4 == 0 : rd::get() % 4 != 0;
+		const int op = int(rd::get() % 5);
+		switch (op) {
+		case 0:
+			if (insert) {
+				tree.set(key, newValue(value), hint);
+				model[key] = value;
+			}
+			else {
+				REQUIRE(tree.remove(key, hint) == (model.erase(key) == 1));
+			}
+			break;
+		case 1:
+			REQUIRE(tree.modify(key, [&](long long*& data) { data = newValue(*data + value); }) == (model.count(key) == 1));
+			if (model.count(key)) {
+				model[key] += value;
+			}
+			break;
+		case 2:
+			tree.upsert(key, [&](long long*& data, bool exists) { data = newValue(exists ? *data * 2 : value); });
+			model[key] = model.count(key) ? model[key] * 2 : value;
+			break;
+		default:
+			if (insert) {
+				tree.set(key, newValue(value));
+				model[key] = value;
+			}
+			else {
+				REQUIRE(tree.remove(key) == (model.erase(key) == 1));
+			}
+			break;
+		}
+		if (op != 0) {
+			// the other writes may have freed the hinted leaf
+			hint = tree.find(key);
+		}
+		if (i % 1000 == 999) {
+			REQUIRE(checkAggregates<Augment>(tree.root).stats.count == model.size());
+			requireRanges<Augment>(tree, model, Keys);
+		}
+	}
+
+	tree.validate_ptrs();
+	REQUIRE(tree.aggregate().stats.count == model.size());
+	while (!tree.compactStep(3, 0.9)) {
+	}
+	checkAggregates<Augment>(tree.root);
+	requireRanges<Augment>(tree, model, Keys);
+	tree.compact();
+	checkAggregates<Augment>(tree.root);
+	requireRanges<Augment>(tree, model, Keys);
+	REQUIRE(tree.aggregate(10, 5).stats.count == 0);
+}
+
+TEST_CASE("augmented aggregates", "[augment]") {
+	testAugmented<3, false>();
+	testAugmented<4, false>();
+	testAugmented<5, true>();
+	testAugmented<16, false>();
+	testAugmented<16, true>();
+
+	// sequential inserts take the 100/0 append splits
+	AugmentedTree<int, int, SumOf<int>, 4> sums;
+	std::vector<int> values(1000);
+	for (int i = 0; i < 1000; ++i) {
+		values[i] = i;
+		sums.set(i, &values[i]);
+	}
+	REQUIRE(sums.aggregate() == 999 * 1000 / 2);
+	REQUIRE(sums.aggregate(10, 19) == 145);
+	AugmentedTree<int, int, MaxOf<int>, 4> maxima;
+	for (int i = 999; i >= 0; --i) {
+		maxima.set(i, &values[i]);
+	}
+	REQUIRE(maxima.aggregate(-5, 500) == 500);
+	REQUIRE(maxima.aggregate(2000, 3000) == std::numeric_limits<int>::lowest());
+
+	// null values are allowed and aggregate as identity()
+	AugmentedTree<int, int, StatsOf<int>, 4> nulls;
+	for (int i = 0; i < 1000; ++i) {
+		nulls.set(i, i % 3 == 0 ? nullptr : &values[i]);
+	}
+	nulls.upsert(1000, [](int*& data, bool) { data = nullptr; });
+	int* inserted = nullptr;
+	nulls.tryEmplace(1001, []() -> int* { return nullptr; }, inserted);
+	REQUIRE(nulls.size() == 1002);
+	REQUIRE(nulls.aggregate().count == 666);
+	REQUIRE(nulls.aggregate(0, 5).sum == 1 + 2 + 4 + 5);
+	REQUIRE(nulls.aggregate(999, 2000).count == 0);
+	REQUIRE(nulls.aggregate(999, 2000).max == std::numeric_limits<int>::lowest());
+	REQUIRE(nulls.remove(1));
+	REQUIRE(nulls.aggregate(0, 5).min == 2);
+}
+
 TEST_CASE("test iterator", "[tree]") {
 	Tree<int, int, 4> tree;
 
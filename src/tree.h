@@ -2,6 +2,11 @@
 #define __TREE_H_
 
 #include "node.h"
+#include "frozen_tree.h"
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <cstdint>
 
 
 // Requirements for types:
@@ -10,21 +15,30 @@
 
 // Not an actuall stl like iterator but good enough for our example
 // can be used to linearly iterate over elements with O(1) increment for the next element
-template<typename KeyType, typename DataType, uint N>
+template<typename KeyType, typename DataType, uint N, bool Fingerprints = false, typename Augment = NoAugment>
 struct Iterator {
-	typedef Node<KeyType, DataType, N> TNode;
+	typedef Node<KeyType, DataType, N, Fingerprints, Augment> TNode;
+
+	// Leaves prefetched ahead of the current one while iterating.
+	static constexpr int PrefetchDistance = 4;
 
 	// order is important here for best performance
 	bool exists;
 	TNode* leaf;
 	int index;
 
+	// PrefetchDistance leaves after leaf once the iteration crossed a leaf
+	TNode* ahead;
+	int aheadDistance;
+
 	Iterator() {}
 
 	Iterator(TNode* leaf, int elemIndex, bool found)
 		: leaf(leaf)
 		, index(elemIndex)
-		, exists(found) {}
+		, exists(found)
+		, ahead(leaf)
+		, aheadDistance(0) {}
 
 
 	void operator++() {
@@ -36,7 +50,7 @@ struct Iterator {
 		++index;
 		if (index >= leaf->childrenCount) {
 			nextLeaf();
-			INCR_BLOCKS();
+			INCR_BLOCKS(leaf);
 		}
 	}
 
@@ -50,6 +64,15 @@ struct Iterator {
 	void nextLeaf() {
 		index = 0;
 		leaf = leaf->getNextLeaf();
+		// at most 2 steps so short scans do not chase the whole distance at once,
+		// once the distance is reached every step reads a leaf prefetched PrefetchDistance crossings ago
+		--aheadDistance;
+		for (int steps = 0; ahead && aheadDistance < PrefetchDistance && steps < 2; ++steps, ++aheadDistance) {
+			ahead = ahead->getNextLeaf();
+			if (ahead) {
+				ahead->prefetch();
+			}
+		}
 	}
 
 	const KeyType& key() const {
@@ -60,21 +83,75 @@ struct Iterator {
 		return leaf->getAsData(index);
 	}
 
+	// Bypasses the aggregates of an augmented tree, use Tree::modify there.
 	DataType*& valueAsMutablePtr() {
 		return leaf->getAsDataMutable(index);
 	}
 };
 
+// Result of Tree::stats(), a snapshot of the structure and memory use.
+struct TreeStats {
+	static constexpr int FillBuckets = 10;
+
+	// Level 0 is the root, the last level holds the leaves.
+	struct Level {
+		uint nodes = 0;
+		size_t keys = 0;
+		// nodes by keys / capacity in 10% steps, the last bucket also takes full nodes
+		std::array<uint, FillBuckets> fill{};
+	};
+
+	std::vector<Level> levels;
+	uint leaves = 0;
+	uint innerNodes = 0;
+	size_t elements = 0;
+	// Bytes of the node allocations (without the allocator's own overhead) and bytes of the keys and value
+	// pointers actually stored in them.
+	size_t nodeBytes = 0;
+	size_t payloadBytes = 0;
+	// Leaf chain links whose next leaf starts within a cache line after the end of the leaf,
+	// and links that point forward in memory at all.
+	uint adjacentLinks = 0;
+	uint forwardLinks = 0;
+
+	double bytesPerKey() const {
+		return elements ? double(nodeBytes) / elements : 0.0;
+	}
+
+	double adjacentFraction() const {
+		return leaves > 1 ? double(adjacentLinks) / (leaves - 1) : 0.0;
+	}
+
+	void print(std::ostream& out) const {
+		out << "leaves " << leaves << " inner " << innerNodes << " elements " << elements
+			<< " | node bytes " << nodeBytes << " payload " << payloadBytes
+			<< " bytes/key " << std::fixed << std::setprecision(1) << bytesPerKey() << "\n";
+		out << "leaf chain: adjacent " << std::setprecision(3) << adjacentFraction()
+			<< " forward " << (leaves > 1 ? double(forwardLinks) / (leaves - 1) : 0.0) << "\n";
+		for (size_t l = 0; l < levels.size(); ++l) {
+			out << "level " << l << ": " << levels[l].nodes << " nodes " << levels[l].keys << " keys, fill %";
+			for (int b = 0; b < FillBuckets; ++b) {
+				out << " " << b * 10 << ":" << levels[l].fill[b];
+			}
+			out << "\n";
+		}
+	}
+};
+
 // Requirements for types:
-// key: operator< & operator==, movable, copy-constructuble
+// key: operator< & operator==, movable, copy-constructuble (inner nodes hold copies of leaf keys as separators)
 // 
-template<typename KeyType, typename DataType, uint N = 10>
+// Fingerprints: leaves keep a 1 byte hash of every key (KeyFingerprint), get / remove compare only the keys
+// whose hash matches. Misses then cost no key comparison in the leaf, worth it for expensive comparisons.
+// 
+// Augment: a monoid over the entries (see augment.h), inner nodes keep it per child and aggregate(lo, hi)
+// answers in O(log n) nodes. Every write refreshes the aggregates on the path of the changed leaves, O(N) per level.
+// 
+template<typename KeyType, typename DataType, uint N = 10, bool Fingerprints = false, typename Augment = NoAugment>
 struct Tree {
-	typedef Node<KeyType, DataType, N> TNode;
-	typedef Iterator<KeyType, DataType, N> Iterator;
-
-	static const int Parity = N % 2;
-	static const int HN = N / 2 + Parity;
+	typedef Node<KeyType, DataType, N, Fingerprints, Augment> TNode;
+	typedef ::Iterator<KeyType, DataType, N, Fingerprints, Augment> Iterator;
+	typedef typename Augment::type Aggregate;
 
 	TNode* root;
 
@@ -83,14 +160,22 @@ struct Tree {
 
 	uint elementCount;
 
-	Tree() {
-		root = new TNode();
+	// capacity is the max keys per node, it can only differ from N when N == DynamicSize.
+	explicit Tree(uint capacity = N != DynamicSize ? N : 10)
+		: nodeCapacity(capacity) {
+		assert(TNode::IsDynamic || capacity == N);
+		assert(capacity >= 3);
+		root = TNode::create(nodeCapacity);
 		init();
 	}
 
 	~Tree() {
 		clear();
-		delete root;
+		TNode::destroy(root);
+	}
+
+	int capacity() const {
+		return TNode::IsDynamic ? nodeCapacity : N;
 	}
 
 	// Return if an insert was actually made.
@@ -98,12 +183,82 @@ struct Tree {
 		return insertKeyVal(key, data);
 	}
 
+	// The key is moved into the leaf (and through a split of it), an insert makes no copy of it.
+	bool set(KeyType&& key, DataType* data) {
+		return insertKeyVal(MoveVal(key), data);
+	}
+
 	bool maybe_add(const KeyType& key, DataType* data) {
 		return insertKeyVal(key, data, false);
 	}
 
+	bool maybe_add(KeyType&& key, DataType* data) {
+		return insertKeyVal(MoveVal(key), data, false);
+	}
+
+	// maybe_add with the key constructed from keyArgs, then moved into the leaf.
+	template<typename... Args>
+	bool emplace(DataType* data, Args&&... keyArgs) {
+		return insertKeyVal(KeyType(std::forward<Args>(keyArgs)...), data, false);
+	}
+
+	// Like set, previous gets the replaced pointer if the key existed (the return is false then).
+	bool insertOrAssign(const KeyType& key, DataType* data, DataType*& previous) {
+		Iterator location = locate(key);
+		if (location.exists) {
+			previous = location.value();
+			setAtIt(location, data);
+			return false;
+		}
+		insertAt(location, key, data);
+		return true;
+	}
+
+	// Like maybe_add, but the pointer comes from make(), which only runs if the key is missing.
+	// outData gets the existing or the new pointer.
+	template<typename Make>
+	bool tryEmplace(const KeyType& key, Make make, DataType*& outData) {
+		Iterator location = locate(key);
+		if (location.exists) {
+			outData = location.value();
+			return false;
+		}
+		outData = make();
+		insertAt(location, key, outData);
+		return true;
+	}
+
+	// Read-modify-write with 1 descent: fn(DataType*& data, bool exists) gets the stored pointer of an existing key
+	// and may change it in place. For a missing key data starts as nullptr and what fn leaves in it is inserted
+	// at the position the descent found. Returns if an insert was made.
+	template<typename F>
+	bool upsert(const KeyType& key, F fn) {
+		Iterator location = locate(key);
+		if (location.exists) {
+			fn(location.valueAsMutablePtr(), true);
+			refreshUp(location.leaf);
+			return false;
+		}
+		DataType* data = nullptr;
+		fn(data, false);
+		insertAt(location, key, data);
+		return true;
+	}
+
+	// fn(DataType*& data) on the stored pointer of an existing key, in place. Returns false if the key is missing.
+	template<typename F>
+	bool modify(const KeyType& key, F fn) {
+		Iterator location = findExisting(key);
+		if (!location.exists) {
+			return false;
+		}
+		fn(location.valueAsMutablePtr());
+		refreshUp(location.leaf);
+		return true;
+	}
+
 	bool get(const KeyType& key, DataType*& outData) const {
-		Iterator loc = find(key);
+		Iterator loc = findExisting(key);
 		if (!loc.exists) {
 			return false;
 		}
@@ -113,7 +268,7 @@ struct Tree {
 
 	// Return true if actually removed something
 	bool remove(const KeyType& key) {
-		Iterator loc = find(key);
+		Iterator loc = findExisting(key);
 		if (!loc.exists) {
 			return false;
 		}
@@ -123,7 +278,7 @@ struct Tree {
 
 	// Remove a key and return the pointer to the element if it existed.
 	bool removePop(const KeyType& key, DataType*& popped) {
-		Iterator loc = find(key);
+		Iterator loc = findExisting(key);
 		if (!loc.exists) {
 			return false;
 		}
@@ -132,23 +287,53 @@ struct Tree {
 		return true;
 	}
 
+	// Augment::combine over the entries with lo <= key <= hi, in key order. Whole subtrees inside the range count
+	// by the aggregate their parent keeps, so only the nodes on the paths to lo and hi are read.
+	Aggregate aggregate(const KeyType& lo, const KeyType& hi) const {
+		static_assert(Augmented, "aggregate needs a Tree with an Augment");
+		if (hi < lo) {
+			return Augment::identity();
+		}
+		return aggregateUnder(root, lo, hi, true, true);
+	}
+
+	// Over all entries, from the root alone.
+	Aggregate aggregate() const {
+		static_assert(Augmented, "aggregate needs a Tree with an Augment");
+		return summarize(root);
+	}
+
 	uint size() const {
 		return elementCount;
 	}
 
+	// Used key slots over all key slots of the leaves.
+	double fillFactor() const {
+		if (empty()) {
+			return 0.0;
+		}
+		size_t leaves = 0;
+		for (TNode* leaf = first().leaf; leaf; leaf = leaf->getNextLeaf()) {
+			++leaves;
+		}
+		return double(elementCount) / (double(leaves) * capacity());
+	}
+
 	void clearNode(TNode* node) {
 		if (node->isLeaf) {
-			delete node;
+			TNode::destroy(node);
 			return;
 		}
 		for (int i = 0; i <= node->childrenCount; ++i) {
 			clearNode(node->ptrs[i]);
 		}
-		delete node;
+		TNode::destroy(node);
 	}
 
 	void clear() {
-		if (root->childrenCount == 0) {
+		// a leaf root has values in ptrs, not children
+		if (root->isLeaf) {
+			init();
 			return;
 		}
 		for (int i = 0; i <= root->childrenCount; ++i) {
@@ -179,30 +364,292 @@ struct Tree {
 
 		while (!nextNode->isLeaf) {
 			nextNode = nextNode->ptrs[0];
-			INCR_BLOCKS();
+			INCR_BLOCKS(nextNode);
 		}
 		assert(nextNode->isLeaf);
 		return Iterator(nextNode , 0, true);
 	}
 
 	Iterator find(const KeyType& key) const {
-		int nextLoc;
-		TNode* nextNode = root;
+		return findFrom(root, key);
+	}
 
-		while (!nextNode->isLeaf) {
-			nextLoc = nextNode->getIndexOf(key);
-			nextNode = nextNode->ptrs[nextLoc];
-			INCR_BLOCKS();
+	//
+	// Finger search: hint is an iterator from an earlier operation on a nearby key. The search checks the hinted
+	// leaf and the next one, then climbs parents only until a node whose keys enclose the key and descends from there.
+	// A key d elements away costs O(log d) instead of O(log n).
+	// The hint must come from find or from the hinted set / remove (which update it), with no other
+	// modifications of the tree in between, since those can free its leaf.
+	//
+	Iterator find(const KeyType& key, const Iterator& hint) const {
+		TNode* node = hint.leaf;
+		if (!node || node->childrenCount == 0) {
+			return find(key);
 		}
 
+		if (node->keys[node->childrenCount - 1] < key) {
+			TNode* next = node->getNextLeaf();
+			if (next && next->keys[0] <= key) {
+				INCR_BLOCKS(next);
+				node = next;
+			}
+		}
+
+		// the rightmost leaf also takes everything above its keys
+		const bool inTail = node == rightmostLeaf && !(key < node->keys[0]);
+		while (!inTail && !node->isRoot() && !encloses(node, key)) {
+			node = node->parent;
+			INCR_BLOCKS(node);
+		}
+		return findFrom(node, key);
+	}
+
+	// set / remove / removePop starting from hint, see find(key, hint). hint is moved to the key (or its neighbors if removed).
+	bool set(const KeyType& key, DataType* data, Iterator& hint) {
+		Iterator location = find(key, hint);
+		if (location.exists) {
+			setAtIt(location, data);
+			hint = location;
+			return false;
+		}
+		insertAt(location, key, data);
+		// the leaf may have split, the key is then in the next leaf
+		hint = find(key, location);
+		return true;
+	}
+
+	bool remove(const KeyType& key, Iterator& hint) {
+		DataType* popped;
+		return removePop(key, popped, hint);
+	}
+
+	bool removePop(const KeyType& key, DataType*& popped, Iterator& hint) {
+		Iterator location = find(key, hint);
+		if (!location.exists) {
+			hint = location;
+			return false;
+		}
+		popped = location.value();
+		TNode* survivor = deleteEntryLeaf(location);
+		elementCount--;
+		hint = Iterator(survivor, 0, false);
+		return true;
+	}
+
+	//
+	// Rebuilds the tree bottom up with every node holding targetFill (0.5 - 1.0) of its capacity.
+	// Delete heavy phases leave nodes near half full, this gives the memory and the height back.
+	// Entries are moved leaf by leaf and old leaves are freed as soon as they are emptied.
+	// Invalidates every iterator.
+	//
+	void compact(double targetFill = 1.0) {
+		compactFrom = KeyType();
+		compacting = false;
+		if (root->isLeaf) {
+			return;
+		}
+		const int perNode = fillCount(targetFill);
+
+		TNode* oldLeaf = first().leaf;
+		destroyInner(root);
+
+		// leaves with an even share of the entries each, so the last one is not left under filled. Few enough
+		// leaves that the share stays at least half() when perNode is half() itself.
+		std::vector<TNode*> level;
+		const size_t leafCount = std::max<size_t>(1,
+			std::min<size_t>((elementCount + perNode - 1) / perNode, elementCount / half()));
+		level.reserve(leafCount);
+		int oldIndex = 0;
+		TNode* previous = nullptr;
+		for (size_t l = 0; l < leafCount; ++l) {
+			TNode* leaf = TNode::create(capacity());
+			leaf->isLeaf = true;
+			const int count = int(elementCount / leafCount + (l < elementCount % leafCount ? 1 : 0));
+			for (int i = 0; i < count; ++i) {
+				while (oldIndex == oldLeaf->childrenCount) {
+					TNode* emptied = oldLeaf;
+					oldLeaf = oldLeaf->getNextLeaf();
+					TNode::destroy(emptied);
+					oldIndex = 0;
+				}
+				leaf->keys[i] = MoveVal(oldLeaf->keys[oldIndex]);
+				leaf->ptrs[i] = oldLeaf->ptrs[oldIndex];
+				leaf->copyFingerprint(i, oldLeaf, oldIndex);
+				++oldIndex;
+			}
+			leaf->childrenCount = count;
+			if (previous) {
+				previous->setNextLeaf(leaf);
+			}
+			previous = leaf;
+			level.push_back(leaf);
+		}
+		while (oldLeaf) {
+			TNode* emptied = oldLeaf;
+			oldLeaf = oldLeaf->getNextLeaf();
+			TNode::destroy(emptied);
+		}
+		rightmostLeaf = previous;
+		nodes = uint(level.size());
+		height = 0;
+
+		// inner levels, a node with perNode keys has perNode + 1 children. Same rule as the leaves, with
+		// capacity() / 2 + 1 children as the minimum of an inner node in place of half().
+		const size_t minChildren = capacity() / 2 + 1;
+		while (level.size() > 1) {
+			const size_t parentCount = std::max<size_t>(1,
+				std::min<size_t>((level.size() + perNode) / (perNode + 1), level.size() / minChildren));
+			std::vector<TNode*> parents;
+			parents.reserve(parentCount);
+			size_t child = 0;
+			for (size_t p = 0; p < parentCount; ++p) {
+				TNode* parent = TNode::create(capacity());
+				parent->allocateAggregates();
+				const size_t count = level.size() / parentCount + (p < level.size() % parentCount ? 1 : 0);
+				for (size_t i = 0; i < count; ++i, ++child) {
+					parent->ptrs[i] = level[child];
+					level[child]->parent = parent;
+					if constexpr (Augmented) {
+						parent->aggregates[i] = summarize(level[child]);
+					}
+					if (i > 0) {
+						parent->keys[i - 1] = minKey(level[child]);
+					}
+				}
+				parent->childrenCount = int(count) - 1;
+				parents.push_back(parent);
+			}
+			nodes += uint(parents.size());
+			height++;
+			level.swap(parents);
+		}
+		root = level[0];
+		root->parent = nullptr;
+	}
+
+	//
+	// Incremental compaction for running between requests: looks at no more than maxLeaves leaves, merging each
+	// with its right sibling or refilling it from the sibling up to targetFill. The next call continues where this
+	// one stopped. Returns true when a pass over all leaves finished.
+	//
+	bool compactStep(uint maxLeaves, double targetFill = 1.0) {
+		const int perNode = fillCount(targetFill);
+		TNode* leaf = compacting ? find(compactFrom).leaf : first().leaf;
+
+		for (uint n = 0; leaf && n < maxLeaves; ++n) {
+			TNode* right = leaf->getNextLeaf();
+			if (!right) {
+				leaf = nullptr;
+				break;
+			}
+			if (right->parent != leaf->parent || leaf->childrenCount >= perNode) {
+				leaf = right;
+				continue;
+			}
+
+			TNode* parent = leaf->parent;
+			const int rightIndex = parent->getIndexOf(right->keys[0]);
+			if (leaf->childrenCount + right->childrenCount <= perNode) {
+				// stay on leaf, it may take the next sibling too
+				mergeLeaves(leaf, right, parent->keys[rightIndex - 1]);
+				continue;
+			}
+
+			// right keeps at least half(), if it is the last child of its parent no later step refills it
+			const int moved = std::min(perNode - leaf->childrenCount, right->childrenCount - half());
+			if (moved <= 0) {
+				leaf = right;
+				continue;
+			}
+			for (int i = 0; i < moved; ++i) {
+				leaf->keys[leaf->childrenCount + i] = MoveVal(right->keys[i]);
+				leaf->ptrs[leaf->childrenCount + i] = right->ptrs[i];
+				leaf->copyFingerprint(leaf->childrenCount + i, right, i);
+			}
+			leaf->childrenCount += moved;
+			for (int i = moved; i < right->childrenCount; ++i) {
+				right->keys[i - moved] = MoveVal(right->keys[i]);
+				right->ptrs[i - moved] = right->ptrs[i];
+				right->copyFingerprint(i - moved, right, i);
+			}
+			right->childrenCount -= moved;
+			parent->keys[rightIndex - 1] = right->keys[0];
+			refreshSlot(right);
+			refreshUp(leaf);
+			leaf = right;
+		}
+
+		compacting = leaf != nullptr;
+		if (compacting) {
+			compactFrom = leaf->keys[0];
+		}
+		return !compacting;
+	}
+
+private:
+	Iterator findFrom(TNode* nextNode, const KeyType& key) const {
+		nextNode = descend(nextNode, key);
+
 		bool found = false;
-		nextLoc = nextNode->getIndexOfFound(key, found);
+		nextNode->prefetchSearch();
+		const int nextLoc = nextNode->getIndexOfFound(key, found);
 
 		return Iterator(nextNode, nextLoc - 1, found);
 	}
 
-private:
+	// The leaf under node that holds key if it exists.
+	TNode* descend(TNode* nextNode, const KeyType& key) const {
+		while (!nextNode->isLeaf) {
+			nextNode->prefetchSearch();
+			const int nextLoc = nextNode->getIndexOf(key);
+			nextNode = nextNode->ptrs[nextLoc];
+			INCR_BLOCKS(nextNode);
+		}
+		return nextNode;
+	}
+
+	// find for operations that only need the key if it exists. With fingerprints a missing key has no position
+	// (exists is false and index -1).
+	Iterator findExisting(const KeyType& key) const {
+		if constexpr (Fingerprints) {
+			TNode* leaf = descend(root, key);
+			const int index = leaf->findByFingerprint(key);
+			return Iterator(leaf, index, index >= 0);
+		}
+		else {
+			return find(key);
+		}
+	}
+
+	// True if the key belongs under node, judged by its own keys only. For an internal node the last pointer is
+	// bounded by a key of some ancestor, so the key has to be below the last key.
+	static bool encloses(const TNode* node, const KeyType& key) {
+		if (node->childrenCount == 0 || key < node->keys[0]) {
+			return false;
+		}
+		return node->isLeaf ? !(node->keys[node->childrenCount - 1] < key) : key < node->keys[node->childrenCount - 1];
+	}
+
+	int nodeCapacity;
+	TNode* rightmostLeaf;
+
+	// where compactStep continues
+	KeyType compactFrom;
+	bool compacting = false;
+
+	static const KeyType& minKey(const TNode* node) {
+		while (!node->isLeaf) {
+			node = node->ptrs[0];
+		}
+		return node->keys[0];
+	}
+
+	int half() const {
+		return capacity() / 2 + capacity() % 2;
+	}
+
 	void init() {
+		rightmostLeaf = root;
 		root->isLeaf = true;
 		root->childrenCount = 0;
 		elementCount = 0;
@@ -213,6 +660,7 @@ private:
 	void setAtIt(Iterator location, DataType* data) {
 		assert(location.exists);
 		location.leaf->setAsData(location.index, data);
+		refreshUp(location.leaf);
 	}
 
 
@@ -223,31 +671,60 @@ private:
 		return data;
 	}
 
-	void insertAt(Iterator location, const KeyType& key, DataType* data) {
-		if (location.leaf->childrenCount < N) {
-			location.leaf->insertAtLeaf(location.index + 1, key, data);
+	// K is const KeyType& or KeyType, the key is copied or moved into the leaf.
+	template<typename K>
+	void insertAt(Iterator location, K&& key, DataType* data) {
+		if (location.leaf->childrenCount < capacity()) {
+			location.leaf->insertAtLeaf(location.index + 1, std::forward<K>(key), data);
+			if constexpr (Augment::commutative) {
+				addUp(location.leaf, location.index + 1);
+			}
+			else {
+				refreshUp(location.leaf);
+			}
 		}
 		else {
+			// appending past the largest key keeps the full leaf as is
+			const bool append = location.leaf == rightmostLeaf && location.index + 1 == capacity();
+
 			// split node,
-			TNode* second = TNode::splitAndInsertLeaf(location.leaf, location.index + 1, key, data);
+			TNode* second = append
+				? TNode::splitAppendLeaf(location.leaf, std::forward<K>(key), data)
+				: TNode::splitAndInsertLeaf(location.leaf, location.index + 1, std::forward<K>(key), data);
 			second->isLeaf = true;
 			nodes++;
+			if (location.leaf == rightmostLeaf) {
+				rightmostLeaf = second;
+			}
 
 			// now update parent, maybe multiple parents
-			insertInParent(location.leaf, second, second->keys[0]);
+			insertInParent(location.leaf, second, second->keys[0], append);
+			refreshUp(second);
+			refreshUp(location.leaf);
 		}
 		elementCount++;
 	}
 
-	bool insertKeyVal(const KeyType& key, DataType* data, bool modifyIfExists = true) {
-		Iterator location = find(key);
+	// Where key is or would be inserted. Keys larger than the current max (ids, timestamps) go to the rightmost
+	// leaf without a descent.
+	Iterator locate(const KeyType& key) const {
+		TNode* tail = rightmostLeaf;
+		if (tail->childrenCount > 0 && tail->keys[tail->childrenCount - 1] < key) {
+			return Iterator(tail, tail->childrenCount - 1, false);
+		}
+		return find(key);
+	}
+
+	template<typename K>
+	bool insertKeyVal(K&& key, DataType* data, bool modifyIfExists = true) {
+		Iterator location = locate(key);
 		if (location.exists) {
 			if (modifyIfExists) {
 				setAtIt(location, data);
 			}
 			return false;
 		}
-		insertAt(location, key, data);
+		insertAt(location, std::forward<K>(key), data);
 		return true;
 	}
 
@@ -269,9 +746,13 @@ private:
 
 			deleteFromArrayAt(right->ptrs, right->childrenCount, 0);
 			deleteFromArrayAt(right->keys, right->childrenCount, 0);
+			if constexpr (Fingerprints) {
+				deleteFromArrayAt(right->fingerprints, right->childrenCount, 0);
+			}
 
 			if (found) {
-				parent->keys[loc - 1] = MoveVal(right->keys[0]);
+				// a copy, the key stays the first of right
+				parent->keys[loc - 1] = right->keys[0];
 			}
 			right->childrenCount--;
 		}
@@ -286,6 +767,8 @@ private:
 			}
 			left->childrenCount--;
 		}
+		refreshSlot(left);
+		refreshSlot(right);
 	}
 
 	void redistributeBetween(TNode* left, TNode* right, const KeyType& keyInBetween) {
@@ -299,6 +782,7 @@ private:
 		if (smallerLeft) {
 			left->insertAtInternal(left->childrenCount, keyInBetween, right->ptrs[0]);
 			left->ptrs[left->childrenCount]->parent = left;
+			left->copyAggregate(left->childrenCount, right, 0);
 
 			int loc = parent->getIndexOf(keyInBetween);
 
@@ -306,11 +790,17 @@ private:
 
 			deleteFromArrayAt(right->ptrs, right->childrenCount + 1, 0);
 			deleteFromArrayAt(right->keys, right->childrenCount, 0);
+			if constexpr (Augmented) {
+				deleteFromArrayAt(right->aggregates, right->childrenCount + 1, 0);
+			}
 			right->childrenCount--;
 		}
 		else {
 			insertAtArray(right->keys, right->childrenCount, 0, keyInBetween);
 			insertAtArray(right->ptrs, right->childrenCount + 1, 0, left->ptrs[left->childrenCount]);
+			if constexpr (Augmented) {
+				insertAtArray(right->aggregates, right->childrenCount + 1, 0, left->aggregates[left->childrenCount]);
+			}
 			right->childrenCount++;
 			right->ptrs[0]->parent = right;
 
@@ -319,7 +809,8 @@ private:
 			parent->keys[loc - 1] = MoveVal(left->keys[left->childrenCount - 1]);
 			left->childrenCount--;
 		}
-
+		refreshSlot(left);
+		refreshSlot(right);
 	}
 
 	void deleteEntryInternal(TNode* initial, const KeyType& key, TNode* ptr) {
@@ -335,7 +826,7 @@ private:
 			TNode* newRoot = initial->ptrs[0];
 			newRoot->parent = nullptr;
 			root = newRoot;
-			delete initial;
+			TNode::destroy(initial);
 			nodes--;
 			height--;
 			return;
@@ -343,9 +834,6 @@ private:
 
 		int index = initial->parent->getIndexOf(initial->keys[0]);
 
-		// The selected pointer is not cached so we need a new block for the node.
-		INCR_BLOCKS();
-
 		KeyType& mergeKey = (index == 0) ? initial->parent->keys[0] : initial->parent->keys[index - 1];
 		
 		TNode* left;
@@ -362,8 +850,11 @@ private:
 			right = initial;
 		}
 
+		// The selected sibling is not cached so we need a new block for the node.
+		INCR_BLOCKS(index == 0 ? right : left);
+
 		bool CanMerge = left->childrenCount + 1
-				+ right->childrenCount + 1 <= N + 1;
+				+ right->childrenCount + 1 <= capacity() + 1;
 
 		if (CanMerge) {
 			const int leftChildren = left->childrenCount;
@@ -372,15 +863,17 @@ private:
 			left->keys[leftChildren] = mergeKey;
 			left->ptrs[leftChildren + 1] = right->ptrs[0];
 			left->ptrs[leftChildren + 1]->parent = left;
+			left->copyAggregate(leftChildren + 1, right, 0);
 
 			for (int i = 0; i < rightChildren; ++i) {
 				left->keys[i + leftChildren + 1] = right->keys[i];
 				left->ptrs[i + leftChildren + 1 + 1] = right->ptrs[i + 1];
 				left->ptrs[i + leftChildren + 1 + 1]->parent = left;
+				left->copyAggregate(i + leftChildren + 1 + 1, right, i + 1);
 			}
 			left->childrenCount = leftChildren + rightChildren + 1;
 			deleteEntryInternal(left->parent, mergeKey, right);
-			delete right;
+			TNode::destroy(right);
 			nodes--;
 		}
 		else { // redistribute
@@ -391,7 +884,8 @@ private:
 		}
 	}
 
-	void deleteEntryLeaf(Iterator location) {
+	// Returns the leaf that now holds the neighbors of the deleted key.
+	TNode* deleteEntryLeaf(Iterator location) {
 		TNode* initial = location.leaf;
 		assert(initial);
 		assert(initial->isLeaf);
@@ -402,22 +896,22 @@ private:
 
 		if (initial->isRoot()) {
 			if (initial->childrenCount > 0 || height == 0) {
-				return;
+				return initial;
 			}
 			TNode* newRoot = initial->ptrs[0];
 			newRoot->parent = nullptr;
 			root = newRoot;
-			delete initial;
+			TNode::destroy(initial);
 			nodes--;
 			height--;
-			return;
+			return root;
 		}
 
-		if (initial->childrenCount >= HN) {
-			return;
+		if (initial->childrenCount >= half()) {
+			refreshUp(initial);
+			return initial;
 		}
 		
-		INCR_BLOCKS();
 		int index = initial->parent->getIndexOf(initial->keys[0]);
 
 		TNode* left;
@@ -432,37 +926,73 @@ private:
 			right = initial;
 			left = initial->parent->ptrs[index - 1];
 		}
+		INCR_BLOCKS(index == 0 ? right : left);
 
 		int totalChildren = left->childrenCount + right->childrenCount;
 		
-		if (totalChildren <= N) {
-			for (int i = totalChildren - 1; i >= left->childrenCount; --i) {
-				left->ptrs[i] = right->ptrs[i - left->childrenCount];
-				left->keys[i] = right->keys[i - left->childrenCount];
-			}
-			left->childrenCount = totalChildren;
-			left->setNextLeaf(right->getNextLeaf());
-			deleteEntryInternal(right->parent, mergeKey, right);
-			delete right;
-			nodes--;
+		if (totalChildren <= capacity()) {
+			mergeLeaves(left, right, mergeKey);
+			return left;
 		}
 		else { // redistribute
 			redistributeBetweenLeaves(left, right, mergeKey);
+			refreshUp(initial);
+			return initial;
+		}
+	}
+
+	// Moves everything of right into left and frees right. Both have the same parent, mergeKey separates them.
+	void mergeLeaves(TNode* left, TNode* right, const KeyType& mergeKey) {
+		const int totalChildren = left->childrenCount + right->childrenCount;
+		for (int i = totalChildren - 1; i >= left->childrenCount; --i) {
+			left->ptrs[i] = right->ptrs[i - left->childrenCount];
+			left->keys[i] = right->keys[i - left->childrenCount];
+			left->copyFingerprint(i, right, i - left->childrenCount);
+		}
+		left->childrenCount = totalChildren;
+		left->setNextLeaf(right->getNextLeaf());
+		if (right == rightmostLeaf) {
+			rightmostLeaf = left;
+		}
+		deleteEntryInternal(right->parent, mergeKey, right);
+		TNode::destroy(right);
+		nodes--;
+		refreshUp(left);
+	}
+
+	// Keys per node for a fill factor, at least the minimum a node keeps after deletes.
+	int fillCount(double targetFill) const {
+		const int count = int(targetFill * capacity() + 0.5);
+		return std::max(half(), std::min(capacity(), count));
+	}
+
+	// Frees the inner nodes under node, leaves stay.
+	void destroyInner(TNode* node) {
+		if (node->isLeaf) {
+			return;
+		}
+		for (int i = 0; i <= node->childrenCount; ++i) {
+			destroyInner(node->ptrs[i]);
 		}
+		TNode::destroy(node);
 	}
 
 	// use after split to update leftNode, new rightNode the tree parent
-	void insertInParent(TNode* leftNode, TNode* rightNode, const KeyType& rightMinKey) {
+	// append: the split happened at the right edge, full parents on the right spine are split 100/0 as well.
+	// rightMinKey is the only copy of a key an insert makes: the separator of a leaf split. Keys popped out
+	// of splitting internal nodes are moved up.
+	void insertInParent(TNode* leftNode, TNode* rightNode, KeyType rightMinKey, bool append = false) {
 
 		if (leftNode->isRoot()) {
 			assert(leftNode->parent == nullptr);
-			root = new TNode();
+			root = TNode::create(capacity());
+			root->allocateAggregates();
 			nodes++;
 			leftNode->parent = root;
 			rightNode->parent = root;
 			root->ptrs[0] = leftNode;
 			root->ptrs[1] = rightNode;
-			root->keys[0] = rightMinKey;
+			root->keys[0] = MoveVal(rightMinKey);
 			root->childrenCount = 1;
 			height++;
 			return;
@@ -471,27 +1001,186 @@ private:
 
 		int insertLoc = parent->getIndexOf(rightMinKey);
 
-		if (parent->childrenCount < N) {
-			parent->insertAtInternal(insertLoc, rightMinKey, rightNode);
+		if (parent->childrenCount < capacity()) {
+			parent->insertAtInternal(insertLoc, MoveVal(rightMinKey), rightNode);
 			rightNode->parent = parent;
 		}
 		else {
 			TNode* added = nullptr;
-			KeyType poppedKey = TNode::splitAndInsertInternal(parent, added, insertLoc, rightMinKey, rightNode);
+			append = append && insertLoc == parent->childrenCount;
+			KeyType poppedKey = append
+				? TNode::splitAppendInternal(parent, added, MoveVal(rightMinKey), rightNode)
+				: TNode::splitAndInsertInternal(parent, added, insertLoc, MoveVal(rightMinKey), rightNode);
 			nodes++;
 			added->isLeaf = false;
 			added->parent = parent;
-			insertInParent(parent, added, poppedKey);
+			insertInParent(parent, added, MoveVal(poppedKey), append);
+			// the children of both halves kept their aggregates, the halves need new ones above them
+			refreshUp(parent);
+			refreshUp(added);
 		}
 	}
 
+	static constexpr bool Augmented = TNode::Augmented;
+
+	// Aggregate of everything under node: its entries for a leaf, its per child aggregates otherwise.
+	static Aggregate summarize(const TNode* node) {
+		Aggregate result = Augment::identity();
+		if (node->isLeaf) {
+			for (int i = 0; i < node->childrenCount; ++i) {
+				result = Augment::combine(result, Augment::of(node->keys[i], node->getAsData(i)));
+			}
+			return result;
+		}
+		for (int i = 0; i <= node->childrenCount; ++i) {
+			result = Augment::combine(result, node->aggregates[i]);
+		}
+		return result;
+	}
+
+	// Position of node in its parent, found by its first key (separators only lag behind on the left). Nodes
+	// emptied in the middle of a delete are searched among the pointers.
+	static int childIndex(const TNode* parent, const TNode* node) {
+		if (node->childrenCount > 0) {
+			const int index = parent->getIndexOf(node->keys[0]);
+			if (parent->ptrs[index] == node) {
+				return index;
+			}
+		}
+		int index = 0;
+		while (parent->ptrs[index] != node) {
+			++index;
+		}
+		return index;
+	}
+
+	// Stores the aggregate of node in its parent, after node or one of its children changed.
+	static void refreshSlot(TNode* node) {
+		if constexpr (Augmented) {
+			TNode* parent = node->parent;
+			if (!parent) {
+				return;
+			}
+			parent->aggregates[childIndex(parent, node)] = summarize(node);
+		}
+	}
+
+	// After entry index was inserted into leaf without a split: a commutative augment takes it into every
+	// aggregate on the path in O(1) per level, without reading the other values of the leaf.
+	static void addUp(TNode* leaf, int index) {
+		if constexpr (Augmented) {
+			const Aggregate added = Augment::of(leaf->keys[index], leaf->getAsData(index));
+			for (TNode* node = leaf; !node->isRoot(); node = node->parent) {
+				Aggregate& slot = node->parent->aggregates[childIndex(node->parent, node)];
+				slot = Augment::combine(slot, added);
+			}
+		}
+	}
+
+	// refreshSlot for node and all its ancestors, O(N) per level.
+	static void refreshUp(TNode* node) {
+		if constexpr (Augmented) {
+			for (; !node->isRoot(); node = node->parent) {
+				refreshSlot(node);
+			}
+		}
+	}
+
+	// aggregate(lo, hi) under node. boundedBelow / boundedAbove: the node may hold keys below lo / above hi,
+	// a child without either bound is taken from the aggregate array.
+	static Aggregate aggregateUnder(const TNode* node, const KeyType& lo, const KeyType& hi, bool boundedBelow,
+		bool boundedAbove) {
+		if (node->isLeaf) {
+			int from = 0;
+			if (boundedBelow) {
+				bool found = false;
+				from = node->getIndexOfFound(lo, found);
+				from -= found;
+			}
+			const int to = boundedAbove ? node->getIndexOf(hi) : node->childrenCount;
+			Aggregate result = Augment::identity();
+			for (int i = from; i < to; ++i) {
+				result = Augment::combine(result, Augment::of(node->keys[i], node->getAsData(i)));
+			}
+			return result;
+		}
+
+		const int first = boundedBelow ? node->getIndexOf(lo) : 0;
+		const int last = boundedAbove ? node->getIndexOf(hi) : node->childrenCount;
+		if (first == last) {
+			INCR_BLOCKS(node->ptrs[first]);
+			return aggregateUnder(node->ptrs[first], lo, hi, boundedBelow, boundedAbove);
+		}
+		Aggregate result = node->aggregates[first];
+		if (boundedBelow) {
+			INCR_BLOCKS(node->ptrs[first]);
+			result = aggregateUnder(node->ptrs[first], lo, hi, true, false);
+		}
+		for (int i = first + 1; i < last; ++i) {
+			result = Augment::combine(result, node->aggregates[i]);
+		}
+		if (!boundedAbove) {
+			return Augment::combine(result, node->aggregates[last]);
+		}
+		INCR_BLOCKS(node->ptrs[last]);
+		return Augment::combine(result, aggregateUnder(node->ptrs[last], lo, hi, false, true));
+	}
+
 public:
 
+	// Immutable copy for read only use, see FrozenTree. The values are the same pointers as in the tree.
+	FrozenTree<KeyType, DataType> freeze() const {
+		return FrozenTree<KeyType, DataType>(first(), size());
+	}
+
+	// Walks every node, O(nodes).
+	TreeStats stats() const {
+		TreeStats result;
+		result.elements = elementCount;
+		result.payloadBytes = size_t(elementCount) * (sizeof(KeyType) + sizeof(DataType*));
+
+		std::vector<const TNode*> level(1, root);
+		while (!level.empty()) {
+			TreeStats::Level info;
+			std::vector<const TNode*> below;
+			for (const TNode* node : level) {
+				info.nodes++;
+				info.keys += node->childrenCount;
+				const int bucket = std::min(TreeStats::FillBuckets - 1,
+					node->childrenCount * TreeStats::FillBuckets / node->capacity());
+				info.fill[bucket]++;
+				result.nodeBytes += node->allocatedBytes();
+				if (node->isLeaf) {
+					result.leaves++;
+					continue;
+				}
+				result.innerNodes++;
+				for (int i = 0; i <= node->childrenCount; ++i) {
+					below.push_back(node->ptrs[i]);
+				}
+			}
+			result.levels.push_back(info);
+			level.swap(below);
+		}
+
+		for (const TNode* leaf = first().leaf; leaf && leaf->getNextLeaf(); leaf = leaf->getNextLeaf()) {
+			const uintptr_t end = reinterpret_cast<uintptr_t>(leaf) + leaf->allocatedBytes();
+			const uintptr_t next = reinterpret_cast<uintptr_t>(leaf->getNextLeaf());
+			if (next >= end && next - end <= CacheLineSize) {
+				result.adjacentLinks++;
+			}
+			if (next > reinterpret_cast<uintptr_t>(leaf)) {
+				result.forwardLinks++;
+			}
+		}
+		return result;
+	}
+
 	void validate_ptrs() const {
 		std::function<void(TNode*)> for_node;
 
 		for_node = [&](TNode* node) -> void {
-			if (node->childrenCount < 0 || node->childrenCount > N) {
+			if (node->childrenCount < 0 || node->childrenCount > capacity()) {
 				std::cerr << "found incorrect children count!\n";
 				getchar();
 			}
@@ -506,6 +1195,15 @@ public:
 					}
 				}
 
+				if constexpr (Fingerprints) {
+					for (int i = 0; i < node->childrenCount; ++i) {
+						if (node->fingerprints[i] != KeyFingerprint<KeyType>::of(node->keys[i])) {
+							std::cerr << "found incorrect fingerprint!\n";
+							getchar();
+						}
+					}
+				}
+
 				return;
 			}
 
@@ -558,7 +1256,7 @@ public:
 			if (!node->isLeaf) {
 				out << "<f" << 0 << "> # |";
 			}
-			for (int i = 0; i < N; ++i) {
+			for (int i = 0; i < node->capacity(); ++i) {
 				if (i < node->childrenCount) {
 					if (!node->isLeaf) {
 						out << "<f" << i + 1 << "> " << node->keys[i] << "|";
@@ -603,4 +1301,16 @@ public:
 	}
 };
 
+// Node capacity picked at construction, e.g. DynTree<int, int> tree(64);
+template<typename KeyType, typename DataType>
+using DynTree = Tree<KeyType, DataType, DynamicSize>;
+
+// Leaves with key fingerprints, see Tree.
+template<typename KeyType, typename DataType, uint N = 10>
+using FingerprintTree = Tree<KeyType, DataType, N, true>;
+
+// Inner nodes with per child aggregates, e.g. AugmentedTree<int, int, StatsOf<int>> for range sum / min / max.
+template<typename KeyType, typename DataType, typename Augment, uint N = 10>
+using AugmentedTree = Tree<KeyType, DataType, N, false, Augment>;
+
 #endif // __TREE_H_
\ No newline at end of file
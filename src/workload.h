@@ -0,0 +1,361 @@
+#ifndef __WORKLOAD_H_
+#define __WORKLOAD_H_
+
+#include <random>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+//
+// Workload engine for the benchmark.
+// Records are identified by a dense id [0, inserted). A key distribution picks an id,
+// makeKey() turns it into the actual key. With hashed keys the id goes through a bijective
+// mix so insertion order does not match key order (like YCSB's "hashed" insert order).
+//
+// All operations are generated up front so the timed loops only execute them.
+//
+
+namespace wl {
+
+enum class KeyDist : int {
+	Uniform = 0,
+	Zipfian,
+	Latest,
+	Sequential,
+	Hotspot
+};
+
+enum class OpType : int {
+	Read = 0,
+	Update,
+	Insert,
+	Scan,
+	ReadModifyWrite
+};
+
+// Ratios do not have to sum to 1, they get normalized.
+struct OpMix {
+	double read;
+	double update;
+	double insert;
+	double scan;
+	double rmw;
+
+	// At least 1 ratio above 0, otherwise there is nothing to normalize by.
+	bool valid() const {
+		return read + update + insert + scan + rmw > 0;
+	}
+};
+
+struct Spec {
+	std::string name;
+	KeyDist dist;
+	OpMix mix;
+	double theta;			// zipfian constant, must not be 1
+	double hotSetFraction;	// hotspot: fraction of the records that are hot
+	double hotOpFraction;	// hotspot: fraction of the operations that go to the hot set
+	int recordCount;		// records inserted before the timed phase
+	int operationCount;
+	int maxScanLength;
+	bool hashedKeys;
+	int seed;
+
+	Spec()
+		: name("custom")
+		, dist(KeyDist::Zipfian)
+		, mix{ 0.5, 0.5, 0.0, 0.0, 0.0 }
+		, theta(0.99)
+		, hotSetFraction(0.2)
+		, hotOpFraction(0.8)
+		, recordCount(1000000)
+		, operationCount(1000000)
+		, maxScanLength(100)
+		, hashedKeys(true)
+		, seed(42) {}
+};
+
+struct Operation {
+	OpType type;
+	int key;
+	int scanLength;
+};
+
+// Bijective on [0, 2^31), so distinct ids never collide into the same key.
+inline int makeKey(unsigned int id, bool hashed) {
+	if (!hashed) {
+		return static_cast<int>(id);
+	}
+	constexpr unsigned int Mask = 0x7fffffffu;
+	unsigned int x = id & Mask;
+	x = (x * 0x2545f491u) & Mask;
+	x ^= x >> 13;
+	x = (x * 0x5bd1e995u) & Mask;
+	x ^= x >> 16;
+	return static_cast<int>(x);
+}
+
+// Zipfian over [0, items) as described in "Quickly Generating Billion-Record Synthetic Databases" (Gray et al.)
+// and used by YCSB. Item 0 is the most popular. The item count can only grow and zeta is extended incrementally.
+struct ZipfianGenerator {
+	double theta;
+	double zeta2;
+	double zetaN;
+	double alpha;
+	double eta;
+	unsigned long long items;
+
+	ZipfianGenerator(double theta)
+		: theta(theta)
+		, zetaN(0)
+		, eta(0)
+		, items(0) {
+		zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+		alpha = 1.0 / (1.0 - theta);
+	}
+
+	void grow(unsigned long long newItems) {
+		if (newItems <= items) {
+			return;
+		}
+		for (unsigned long long i = items + 1; i <= newItems; ++i) {
+			zetaN += 1.0 / std::pow(static_cast<double>(i), theta);
+		}
+		items = newItems;
+		eta = (1.0 - std::pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+	}
+
+	template<typename Gen>
+	unsigned long long next(Gen& gen) {
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		double u = unit(gen);
+		double uz = u * zetaN;
+		if (uz < 1.0) {
+			return 0;
+		}
+		if (uz < 1.0 + std::pow(0.5, theta)) {
+			return 1;
+		}
+		unsigned long long result = static_cast<unsigned long long>(items * std::pow(eta * u - eta + 1.0, alpha));
+		return result < items ? result : items - 1;
+	}
+};
+
+// Picks the id of an existing record according to the distribution.
+struct KeyChooser {
+	const Spec& spec;
+	ZipfianGenerator zipf;
+	unsigned int sequentialNext;
+
+	KeyChooser(const Spec& spec)
+		: spec(spec)
+		, zipf(spec.theta)
+		, sequentialNext(0) {}
+
+	template<typename Gen>
+	unsigned int next(Gen& gen, unsigned int inserted) {
+		switch (spec.dist) {
+		case KeyDist::Zipfian:
+			zipf.grow(inserted);
+			return static_cast<unsigned int>(zipf.next(gen));
+		case KeyDist::Latest:
+			zipf.grow(inserted);
+			return inserted - 1 - static_cast<unsigned int>(zipf.next(gen));
+		case KeyDist::Sequential:
+			if (sequentialNext >= inserted) {
+				sequentialNext = 0;
+			}
+			return sequentialNext++;
+		case KeyDist::Hotspot: {
+			unsigned int hotCount = static_cast<unsigned int>(inserted * spec.hotSetFraction);
+			hotCount = hotCount == 0 ? 1 : hotCount;
+			std::uniform_real_distribution<double> unit(0.0, 1.0);
+			if (hotCount >= inserted || unit(gen) < spec.hotOpFraction) {
+				return std::uniform_int_distribution<unsigned int>(0, hotCount - 1)(gen);
+			}
+			return std::uniform_int_distribution<unsigned int>(hotCount, inserted - 1)(gen);
+		}
+		case KeyDist::Uniform:
+		default:
+			return std::uniform_int_distribution<unsigned int>(0, inserted - 1)(gen);
+		}
+	}
+};
+
+struct Workload {
+	Spec spec;
+	std::vector<int> loadKeys;
+	std::vector<Operation> ops;
+
+	Workload(const Spec& spec)
+		: spec(spec) {}
+
+	void generate() {
+		std::mt19937 gen(spec.seed);
+		KeyChooser chooser(spec);
+
+		loadKeys.clear();
+		loadKeys.reserve(spec.recordCount);
+		for (int i = 0; i < spec.recordCount; ++i) {
+			loadKeys.push_back(makeKey(i, spec.hashedKeys));
+		}
+
+		const OpMix& m = spec.mix;
+		const double total = m.read + m.update + m.insert + m.scan + m.rmw;
+		const double cut[] = {
+			m.read / total,
+			(m.read + m.update) / total,
+			(m.read + m.update + m.insert) / total,
+			(m.read + m.update + m.insert + m.scan) / total
+		};
+
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		std::uniform_int_distribution<int> scanLen(1, spec.maxScanLength > 0 ? spec.maxScanLength : 1);
+
+		unsigned int inserted = spec.recordCount;
+		ops.clear();
+		ops.reserve(spec.operationCount);
+
+		for (int i = 0; i < spec.operationCount; ++i) {
+			double r = unit(gen);
+			Operation op;
+			op.scanLength = 0;
+
+			if (r < cut[0]) {
+				op.type = OpType::Read;
+			}
+			else if (r < cut[1]) {
+				op.type = OpType::Update;
+			}
+			else if (r < cut[2]) {
+				op.type = OpType::Insert;
+			}
+			else if (r < cut[3]) {
+				op.type = OpType::Scan;
+				op.scanLength = scanLen(gen);
+			}
+			else {
+				op.type = OpType::ReadModifyWrite;
+			}
+
+			if (op.type == OpType::Insert || inserted == 0) {
+				op.type = OpType::Insert;
+				op.key = makeKey(inserted++, spec.hashedKeys);
+			}
+			else {
+				op.key = makeKey(chooser.next(gen, inserted), spec.hashedKeys);
+			}
+			ops.push_back(op);
+		}
+	}
+};
+
+// YCSB core workloads A-F. Returns false for unknown names.
+inline bool applyPreset(Spec& spec, const std::string& preset) {
+	spec.name = preset;
+	spec.dist = KeyDist::Zipfian;
+	if (preset == "a") {
+		spec.mix = { 0.50, 0.50, 0.00, 0.00, 0.00 };
+	}
+	else if (preset == "b") {
+		spec.mix = { 0.95, 0.05, 0.00, 0.00, 0.00 };
+	}
+	else if (preset == "c") {
+		spec.mix = { 1.00, 0.00, 0.00, 0.00, 0.00 };
+	}
+	else if (preset == "d") {
+		spec.mix = { 0.95, 0.00, 0.05, 0.00, 0.00 };
+		spec.dist = KeyDist::Latest;
+	}
+	else if (preset == "e") {
+		spec.mix = { 0.00, 0.00, 0.05, 0.95, 0.00 };
+	}
+	else if (preset == "f") {
+		spec.mix = { 0.50, 0.00, 0.00, 0.00, 0.50 };
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+inline bool parseDist(const std::string& value, KeyDist& out) {
+	if (value == "uniform")			out = KeyDist::Uniform;
+	else if (value == "zipfian")	out = KeyDist::Zipfian;
+	else if (value == "latest")		out = KeyDist::Latest;
+	else if (value == "sequential")	out = KeyDist::Sequential;
+	else if (value == "hotspot")	out = KeyDist::Hotspot;
+	else return false;
+	return true;
+}
+
+inline const char* distName(KeyDist dist) {
+	switch (dist) {
+	case KeyDist::Uniform:		return "uniform";
+	case KeyDist::Zipfian:		return "zipfian";
+	case KeyDist::Latest:		return "latest";
+	case KeyDist::Sequential:	return "sequential";
+	case KeyDist::Hotspot:		return "hotspot";
+	}
+	return "?";
+}
+
+// Apply a single "--name=value" option. Returns false if the option is not a workload option or is malformed.
+inline bool applyOption(Spec& spec, const std::string& arg) {
+	if (arg.compare(0, 2, "--") != 0) {
+		return false;
+	}
+	size_t eq = arg.find('=');
+	std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+	std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+	if (name == "workload")			return applyPreset(spec, value);
+	if (name == "dist")				return parseDist(value, spec.dist);
+	if (name == "ordered")			{ spec.hashedKeys = false; return true; }
+	if (value.empty())				return false;
+	const double number = std::atof(value.c_str());
+	// theta 1 makes alpha infinite, a negative ratio breaks the normalization. A mix of all zeros can be a step
+	// on the way to another mix (--read=0 --update=0 --insert=1), checked once all options are in (OpMix::valid).
+	if (name == "theta")			{ if (number == 1.0) return false; spec.theta = number; }
+	else if (name == "read")		{ if (number < 0) return false; spec.mix.read = number; }
+	else if (name == "update")		{ if (number < 0) return false; spec.mix.update = number; }
+	else if (name == "insert")		{ if (number < 0) return false; spec.mix.insert = number; }
+	else if (name == "scan")		{ if (number < 0) return false; spec.mix.scan = number; }
+	else if (name == "rmw")			{ if (number < 0) return false; spec.mix.rmw = number; }
+	else if (name == "records")		spec.recordCount = std::atoi(value.c_str());
+	else if (name == "ops")			spec.operationCount = std::atoi(value.c_str());
+	else if (name == "scan-length")	spec.maxScanLength = std::atoi(value.c_str());
+	else if (name == "hot-set")		spec.hotSetFraction = std::atof(value.c_str());
+	else if (name == "hot-ops")		spec.hotOpFraction = std::atof(value.c_str());
+	else if (name == "seed")		spec.seed = std::atoi(value.c_str());
+	else return false;
+	return true;
+}
+
+inline void printUsage(std::ostream& out) {
+	out << "Options (no options runs the default add/get/delete benchmark):\n"
+		"  --workload=a|b|c|d|e|f      YCSB core workload preset\n"
+		"  --dist=uniform|zipfian|latest|sequential|hotspot\n"
+		"  --theta=0.99                zipfian constant, not 1\n"
+		"  --read= --update= --insert= --scan= --rmw=   operation ratios\n"
+		"  --records=N --ops=N --scan-length=N --seed=N\n"
+		"  --hot-set=0.2 --hot-ops=0.8 hotspot fractions\n"
+		"  --ordered                   keys follow insertion order instead of being hashed\n";
+}
+
+inline void printSpec(std::ostream& out, const Spec& spec) {
+	const OpMix& m = spec.mix;
+	out << "Workload " << spec.name << ": " << distName(spec.dist);
+	if (spec.dist == KeyDist::Zipfian || spec.dist == KeyDist::Latest) {
+		out << " (theta " << spec.theta << ")";
+	}
+	out << " | read " << m.read << " update " << m.update << " insert " << m.insert
+		<< " scan " << m.scan << " rmw " << m.rmw
+		<< " | records " << spec.recordCount << " ops " << spec.operationCount
+		<< (spec.hashedKeys ? " hashed" : " ordered") << "\n";
+}
+
+}
+
+#endif //__WORKLOAD_H_